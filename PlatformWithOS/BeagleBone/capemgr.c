@@ -0,0 +1,356 @@
+// Copyright 2013-2015 Pervasive Displays, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at:
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+// express or implied.  See the License for the specific language
+// governing permissions and limitations under the License.
+
+// the state file is plain text, one "key value" per line:
+//
+//   slots /sys/devices/bone_capemgr.9/slots
+//   ocp /sys/devices/ocp.3
+//   overlay BB-SPIDEV0
+//   device gpio-P8.15_gpio47.17
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <err.h>
+
+#include "capemgr.h"
+
+
+#define SYS_DEVICES "/sys/devices"
+#define CAPE_MANAGER "bone_capemgr."
+#define OCP "ocp."
+
+#define SLOTS "slots"
+
+// get the size of a constant string at compile time
+// (note ignore the trailing '\0')
+#define CONST_STRLEN(const_string) (sizeof(const_string) - sizeof((char)('\0')))
+
+// interval between looks for a new ocp device
+#define DEVICE_POLL_US 1000
+
+
+// list of strings
+typedef struct {
+	char **item;
+	size_t count;
+} list_type;
+
+// discovered paths
+static char *slots = NULL;   // e.g. "/sys/devices/bone_capemgr.9/slots"
+static char *ocp = NULL;     // e.g. "/sys/devices/ocp.3"
+static list_type overlays;   // loaded overlays e.g. "BB-SPIDEV0"
+static list_type devices;    // ocp device directories e.g. "gpio-P8.15_gpio47.17"
+
+
+// local function prototypes
+static bool read_state(void);
+static void write_state(void);
+static bool scan_devices(void);
+static char *join(const char *directory, const char *name);
+static const char *find(const list_type *list, const char *prefix);
+static void add(list_type *list, const char *s);
+static void drop(list_type *list, const char *s);
+static void clear(list_type *list);
+static uint64_t now_ms(void);
+
+
+bool CAPEMGR_setup(void) {
+	if (NULL != slots) {
+		return true;  // already done
+	}
+
+	// trust the state file while its paths are still there
+	if (read_state() && 0 == access(slots, W_OK) && 0 == access(ocp, X_OK)) {
+		return true;
+	}
+	CAPEMGR_teardown();
+
+	if (!scan_devices()) {
+		CAPEMGR_teardown();
+		return false;  // failed
+	}
+	write_state();
+	return true;
+}
+
+
+void CAPEMGR_teardown(void) {
+	// overlays are never unloaded: any attempt to do this crashes
+	// the process, probably a kernel bug, which may cause system
+	// instablility
+	free(slots);
+	slots = NULL;
+	free(ocp);
+	ocp = NULL;
+	clear(&overlays);
+	clear(&devices);
+}
+
+
+int CAPEMGR_load(const char *const *names, size_t count) {
+	if (!CAPEMGR_setup()) {
+		return -1;  // failed
+	}
+
+	int fd = -1;
+	char buffer[8192];  // only 4096 is indicated in sysfs, can it be larger?
+	int loaded = 0;
+	size_t known = overlays.count;
+
+	for (size_t i = 0; i < count; ++i) {
+		if (NULL != find(&overlays, names[i])) {
+			continue;
+		}
+
+		// only read the slots when something is not known
+		if (fd < 0) {
+			fd = open(slots, O_RDWR);
+			if (fd < 0) {
+				warn("cannot open: %s", slots);
+				return -1;  // failed
+			}
+			memset(buffer, 0, sizeof(buffer));
+			read(fd, buffer, sizeof(buffer) - 1);  // allow one nul at end
+		}
+
+		if (NULL == strstr(buffer, names[i])) {
+			size_t length = strlen(names[i]);
+			char line[length + sizeof((char)('\n'))];
+			memcpy(line, names[i], length);
+			line[length] = '\n';
+			lseek(fd, 0, SEEK_SET);
+			if (write(fd, line, sizeof(line)) != sizeof(line)) {
+				warn("cape manager cannot load: %s", names[i]);
+				continue;
+			}
+			++loaded;
+		}
+		add(&overlays, names[i]);
+	}
+
+	// finished with the cape manager
+	if (fd >= 0) {
+		close(fd);
+	}
+	if (overlays.count != known) {
+		write_state();
+	}
+	return loaded;
+}
+
+
+char *CAPEMGR_device(const char *prefix, int timeout_ms) {
+	if (!CAPEMGR_setup()) {
+		return NULL;  // failed
+	}
+
+	const char *name = find(&devices, prefix);
+	if (NULL != name) {
+		char *path = join(ocp, name);
+		if (NULL == path || 0 == access(path, F_OK)) {
+			return path;
+		}
+		free(path);
+		drop(&devices, name);
+		write_state();
+	}
+
+	// a newly loaded overlay takes a moment to create its device
+	size_t length = strlen(prefix);
+	uint64_t deadline = now_ms() + (timeout_ms > 0 ? timeout_ms : 0);
+	for (;;) {
+		DIR *dir = opendir(ocp);
+		if (NULL == dir) {
+			return NULL;  // failed
+		}
+		struct dirent *dp;
+		while (NULL != (dp = readdir(dir))) {
+			if (0 == strncmp(dp->d_name, prefix, length)) {
+				break;
+			}
+		}
+		char *path = NULL;
+		if (NULL != dp) {
+			path = join(ocp, dp->d_name);
+			add(&devices, dp->d_name);
+			write_state();
+		}
+		closedir(dir);
+
+		if (NULL != path || now_ms() >= deadline) {
+			return path;
+		}
+		usleep(DEVICE_POLL_US);
+	}
+}
+
+
+// private functions
+// =================
+
+static bool read_state(void) {
+	FILE *f = fopen(CAPEMGR_STATE_FILE, "r");
+	if (NULL == f) {
+		return false;  // first run since boot
+	}
+
+	char line[4096];
+	while (NULL != fgets(line, sizeof(line), f)) {
+		line[strcspn(line, "\n")] = '\0';
+		char *value = strchr(line, ' ');
+		if (NULL == value) {
+			continue;
+		}
+		*value++ = '\0';
+
+		if (0 == strcmp(line, "slots") && NULL == slots) {
+			slots = strdup(value);
+		} else if (0 == strcmp(line, "ocp") && NULL == ocp) {
+			ocp = strdup(value);
+		} else if (0 == strcmp(line, "overlay")) {
+			add(&overlays, value);
+		} else if (0 == strcmp(line, "device")) {
+			add(&devices, value);
+		}
+	}
+	fclose(f);
+
+	return NULL != slots && NULL != ocp;
+}
+
+
+// replace the state file atomically, it is only a cache so any
+// failure just means the next start does the full scan again
+static void write_state(void) {
+	FILE *f = fopen(CAPEMGR_STATE_FILE ".tmp", "w");
+	if (NULL == f) {
+		return;
+	}
+
+	fprintf(f, "slots %s\n", slots);
+	fprintf(f, "ocp %s\n", ocp);
+	for (size_t i = 0; i < overlays.count; ++i) {
+		fprintf(f, "overlay %s\n", overlays.item[i]);
+	}
+	for (size_t i = 0; i < devices.count; ++i) {
+		fprintf(f, "device %s\n", devices.item[i]);
+	}
+
+	if (0 != fclose(f) || 0 != rename(CAPEMGR_STATE_FILE ".tmp", CAPEMGR_STATE_FILE)) {
+		unlink(CAPEMGR_STATE_FILE ".tmp");
+	}
+}
+
+
+static bool scan_devices(void) {
+	DIR *dir = opendir(SYS_DEVICES);
+	if (NULL == dir) {
+		return false; // failed
+	}
+
+	struct dirent *dp;
+	while (NULL != (dp = readdir(dir)) && (NULL == slots || NULL == ocp)) {
+		if (0 == strncmp(dp->d_name, CAPE_MANAGER, CONST_STRLEN(CAPE_MANAGER))
+		    && NULL == slots) {
+			char *manager = join(SYS_DEVICES, dp->d_name);
+			if (NULL != manager) {
+				slots = join(manager, SLOTS);
+				free(manager);
+			}
+		} else if (0 == strncmp(dp->d_name, OCP, CONST_STRLEN(OCP))
+			   && NULL == ocp) {
+			ocp = join(SYS_DEVICES, dp->d_name);
+		}
+	}
+	(void)closedir(dir);
+
+	return NULL != slots && NULL != ocp;
+}
+
+
+// directory + "/" + name
+static char *join(const char *directory, const char *name) {
+	char *path = malloc(strlen(directory)
+			    + sizeof((char)('/'))
+			    + strlen(name)
+			    + sizeof((char)('\0')));
+	if (NULL != path) {
+		strcpy(path, directory);
+		strcat(path, "/");
+		strcat(path, name);
+	}
+	return path;
+}
+
+
+static const char *find(const list_type *list, const char *prefix) {
+	size_t length = strlen(prefix);
+	for (size_t i = 0; i < list->count; ++i) {
+		if (0 == strncmp(list->item[i], prefix, length)) {
+			return list->item[i];
+		}
+	}
+	return NULL;
+}
+
+
+static void add(list_type *list, const char *s) {
+	char **item = realloc(list->item, (list->count + 1) * sizeof(char *));
+	if (NULL == item) {
+		return;  // not cached, only costs another search
+	}
+	list->item = item;
+	list->item[list->count] = strdup(s);
+	if (NULL != list->item[list->count]) {
+		++list->count;
+	}
+}
+
+
+static void drop(list_type *list, const char *s) {
+	for (size_t i = 0; i < list->count; ++i) {
+		if (s == list->item[i]) {
+			free(list->item[i]);
+			list->item[i] = list->item[--list->count];
+			return;
+		}
+	}
+}
+
+
+static void clear(list_type *list) {
+	for (size_t i = 0; i < list->count; ++i) {
+		free(list->item[i]);
+	}
+	free(list->item);
+	list->item = NULL;
+	list->count = 0;
+}
+
+
+// monotonic time in milliseconds
+static uint64_t now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
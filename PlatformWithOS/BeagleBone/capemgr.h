@@ -0,0 +1,52 @@
+// Copyright 2013-2015 Pervasive Displays, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at:
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+// express or implied.  See the License for the specific language
+// governing permissions and limitations under the License.
+
+// cape manager (Linux 3.8) overlay loading and ocp device discovery
+//
+// Scanning /sys/devices for the cape manager and ocp directories,
+// loading overlays and waiting for their ocp devices is slow, so the
+// results are saved in CAPEMGR_STATE_FILE and the next process only
+// checks that they still exist.  /run is cleared at boot, so a
+// reboot always starts with a fresh scan.
+
+
+#if !defined(CAPEMGR_H)
+#define CAPEMGR_H 1
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define CAPEMGR_STATE_FILE "/run/epd-fuse.bone"
+
+// how long to wait for the ocp device of a newly loaded overlay
+#define CAPEMGR_DEVICE_TIMEOUT_MS 1000
+
+
+// find the cape manager slots and the ocp directory
+bool CAPEMGR_setup(void);
+
+// forget the cached paths (the state file is kept)
+void CAPEMGR_teardown(void);
+
+// load the overlays (/lib/firmware/NAME-00A0.dtbo) that are not loaded
+// yet, all through a single open of the slots file
+// returns the number newly loaded or -1 if the cape manager failed
+int CAPEMGR_load(const char *const *names, size_t count);
+
+// full path of the ocp device directory whose name starts with
+// prefix, waiting up to timeout_ms for it to appear
+// returns a malloc'ed string or NULL if not found
+char *CAPEMGR_device(const char *prefix, int timeout_ms);
+
+#endif
@@ -31,29 +31,29 @@
 #include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
 #include <sys/mman.h>
 #include <unistd.h>
 #include <err.h>
 
 #include "gpio.h"
-
-
-// cape manager info
-static char *slots = NULL;
-static char *ocp = NULL;
+#include "capemgr.h"
 
 
 // GPIO
 
 #define MAKE_PIN(_name, _bank, _pin)   \
 	[GPIO_PIN(_bank, _pin)] = {    \
-		.name = _name "\n",    \
+		.name = _name,         \
 		.state = NULL,         \
 		.number = NULL,        \
 		.direction = NULL,     \
 		.active_low = NULL,    \
 		.value = NULL,         \
-		.fd = -1               \
+		.fd = -1,              \
+		.edge = false          \
 	}
 
 // GPIO states / direction
@@ -67,10 +67,13 @@ static char *ocp = NULL;
 #define DIRECTION_in  "in"
 #define DIRECTION_out "out"
 
+#define EDGE_none "none"
+#define EDGE_both "both"
+
 // GPIO control information
 static struct {
 	const char *name;   // e.g. "gpio-P8.15" -> /lib/firmware/gpio-P8.15.dtbo
-			    // alse to search cape manager slots to avoid reload
+			    // also the prefix of its ocp device directory
 	char *state;        // e.g. "/sys/devices/ocp.3/gpio-P8.15_gpio47.17/state"
 			    // set to any of the STATE_xxx above
 	char *number;       // e.g. "47"  from the "_gpioXX." when determining state path
@@ -79,6 +82,7 @@ static struct {
 	char *active_low;   // e.g. "/sys/class/gpio/gpio47/active_low" <- [ "0" | "1" ]
 	char *direction;    // e.g. "/sys/class/gpio/gpio47/direction" <- DIRECTION_xxx
 	int fd;             // open fd to value file for fast access
+	bool edge;          // fd signals both edges to poll() (input only)
 } gpio_info[] = {
 	// Connector P8
 	MAKE_PIN("gpio-P8.03", 1, 6),   //  GPIO1_6
@@ -157,6 +161,17 @@ static struct {
 	uint32_t period;
 } pwm[4];
 
+// firmware files (/lib/firmware/NAME.dtbo) loaded by setup
+#define CAPE_IIO "cape-bone-iio"
+#define CAPE_PWM "am33xx_pwm"
+#define CAPE_SPI "BB-SPIDEV0"   // SPI0 -> /dev/spidevX.Y
+
+static const char *const base_overlays[] = {
+	CAPE_IIO,  // I/O multiplexing
+	CAPE_PWM,
+	CAPE_SPI
+};
+
 
 // compute array size at compile time
 #define SIZE_OF_ARRAY(a) (sizeof(a) / sizeof((a)[0]))
@@ -169,8 +184,9 @@ static struct {
 
 
 // local function prototypes:
-static bool load_firmware(const char *pin_name);
-static void write_file(const char *file_name, const char *buffer, size_t length);
+static bool write_file(const char *file_name, const char *buffer, size_t length);
+static bool set_edge(int pin, const char *edge);
+static uint64_t now_ms(void);
 static void export(const char *pin_number);
 static void unexport(const char *pin_number);
 static bool GPIO_enable(int pin);
@@ -182,7 +198,7 @@ static void PWM_set_duty(int channel, int16_t value);
 bool GPIO_setup() {
 
 	// ensure the base firmware is setup
-	if (load_firmware(NULL)) {
+	if (CAPEMGR_load(base_overlays, SIZE_OF_ARRAY(base_overlays)) >= 0) {
 		// return success
 		return true;
 	}
@@ -203,6 +219,7 @@ bool GPIO_teardown() {
 			close(gpio_info[i].fd);
 			gpio_info[i].fd = -1;
 		}
+		gpio_info[i].edge = false;
 		if (NULL != gpio_info[i].state) {
 			free(gpio_info[i].state);
 			gpio_info[i].state = NULL;
@@ -235,18 +252,7 @@ bool GPIO_teardown() {
 		}
 	}
 
-	if (NULL != slots) {
-		// should unload the loaded firmware here,
-		// but any attempt to do this crashes the process
-		// probably a kernel bug, which may cause system instablility
-		free(slots);
-		slots = NULL;
-	}
-
-	if (NULL != ocp) {
-		free(ocp);
-		ocp = NULL;
-	}
+	CAPEMGR_teardown();
 
 	// all data cleared so calling setup again will work
 
@@ -270,12 +276,18 @@ void GPIO_mode(GPIO_pin_type pin, GPIO_mode_type mode) {
 		write_file(gpio_info[pin].direction, DIRECTION_in "\n", CONST_STRLEN(DIRECTION_in "\n"));
 		write_file(gpio_info[pin].active_low, "0\n", 2);
 		write_file(gpio_info[pin].state, STATE_rxEnable_pullNone "\n", CONST_STRLEN(STATE_rxEnable_pullNone "\n"));
+		gpio_info[pin].edge = set_edge(pin, EDGE_both "\n");
 		break;
 
 	case GPIO_OUTPUT:
 		if (gpio_info[pin].fd < 0 && !GPIO_enable(pin)) {
 			return;
 		}
+		// an edge interrupt would keep the pin an input
+		if (gpio_info[pin].edge) {
+			set_edge(pin, EDGE_none "\n");
+			gpio_info[pin].edge = false;
+		}
 		write_file(gpio_info[pin].direction, DIRECTION_out "\n", CONST_STRLEN(DIRECTION_out "\n"));
 		write_file(gpio_info[pin].active_low, "0\n", 2);
 		write_file(gpio_info[pin].state, STATE_rxDisable_pullNone "\n", CONST_STRLEN(STATE_rxDisable_pullNone "\n"));
@@ -343,6 +355,53 @@ void GPIO_write(GPIO_pin_type pin, int value) {
 }
 
 
+// each pin has its own value file, so there is nothing to combine
+void GPIO_write_pins(const GPIO_pin_value *pins, size_t count) {
+	for (size_t i = 0; i < count; ++i) {
+		GPIO_write(pins[i].pin, pins[i].value);
+	}
+}
+
+bool GPIO_wait_edge(GPIO_pin_type pin, int level, int timeout_ms) {
+	// ignore unimplemented or inactive pins
+	if (pin < 0 || pin >= SIZE_OF_ARRAY(gpio_info) || NULL == gpio_info[pin].name || gpio_info[pin].fd < 0) {
+		return false;
+	}
+	level = (0 != level);
+
+	uint64_t deadline = now_ms() + (timeout_ms > 0 ? timeout_ms : 0);
+
+	for (;;) {
+		// reading the value also re-arms the edge notification
+		if (level == GPIO_read(pin)) {
+			return true;
+		}
+
+		int remaining = -1;
+		if (timeout_ms >= 0) {
+			uint64_t t = now_ms();
+			if (t >= deadline) {
+				return false;
+			}
+			remaining = deadline - t;
+		}
+
+		if (!gpio_info[pin].edge) {
+			usleep(10);
+			continue;
+		}
+		struct pollfd p = {
+			.fd = gpio_info[pin].fd,
+			.events = POLLPRI | POLLERR
+		};
+		if (poll(&p, 1, remaining) < 0 && EINTR != errno) {
+			warn("poll failed on GPIO %d", pin);
+			return false;
+		}
+	}
+}
+
+
 // only affect PWM if correct pin is addressed
 void GPIO_pwm_write(int pin, uint32_t value) {
 	if (value > 1023) {
@@ -371,24 +430,17 @@ void GPIO_pwm_write(int pin, uint32_t value) {
 // =================
 
 #include <ctype.h>
-#include <sys/types.h>
-#include <dirent.h>
 
 #define SYS_EXPORT   "/sys/class/gpio/export"
 #define SYS_UNEXPORT "/sys/class/gpio/unexport"
 
-#define SYS_DEVICES "/sys/devices"
-#define CAPE_MANAGER "bone_capemgr."
-#define OCP "ocp."
-
-#define SLOTS "/slots"
-
 // GPIO files
 #define SYS_CLASS_GPIO "/sys/class/gpio/gpio"
 #define STATE "state"
 #define DIRECTION "direction"
 #define ACTIVE_LOW "active_low"
 #define VALUE "value"
+#define EDGE "edge"
 
 
 // pwm files
@@ -398,121 +450,20 @@ void GPIO_pwm_write(int pin, uint32_t value) {
 #define POLARITY "/polarity"
 
 // firmware files (/lib/firmware/NAME.dtbo) to load
-#define CAPE_IIO "cape-bone-iio"
-#define CAPE_PWM "am33xx_pwm"
-#define CAPE_SPI "BB-SPIDEV0"
 #define CAPE_PWM_PIN_PREFIX "bone_pwm_"
 
 // ocp files
 #define OCP_PWM_PREFIX "pwm_test_"
 
 
-static bool find_slots_and_ocp() {
-	if (NULL != slots) {
-		return true;  // already done
-	}
-
-	DIR *dir = opendir(SYS_DEVICES);
-	if (NULL == dir) {
-		return false; // failed
-	}
-
-	struct dirent *dp;
-	while (NULL != (dp = readdir(dir))) {
-		if (0 == strncmp(dp->d_name, CAPE_MANAGER, CONST_STRLEN(CAPE_MANAGER))
-		    && NULL == slots) {
-			slots = malloc(CONST_STRLEN(SYS_DEVICES) + sizeof((char)('/')) + strlen(dp->d_name)
-				       + CONST_STRLEN(SLOTS) + sizeof((char)('\0')));
-			if (NULL == slots) {
-				break;   // failed
-			}
-			strcpy(slots, SYS_DEVICES "/");
-			strcat(slots, dp->d_name);
-			strcat(slots, SLOTS);
-		} else if (0 == strncmp(dp->d_name, OCP, CONST_STRLEN(OCP))
-			   && NULL == ocp) {
-			ocp = malloc(CONST_STRLEN(SYS_DEVICES)
-				     + sizeof((char)('/'))
-				     + strlen(dp->d_name)
-				     + sizeof((char)('\0')));
-			if (NULL == ocp) {
-				break;   // failed
-			}
-			strcpy(ocp, SYS_DEVICES "/");
-			strcat(ocp, dp->d_name);
-		}
-	}
-	(void)closedir(dir);
-
-	if (NULL == slots || NULL == ocp) {
-		if (NULL != slots) {
-			free(slots);
-			slots = NULL;
-		}
-		if (NULL != ocp) {
-			free(ocp);
-			ocp = NULL;
-		}
-
-		return false;  // failed
-	}
-
-	// success
-	return true;
-}
-
-
-static bool load_firmware(const char *pin_name) {
-
-	// find slots and ocp paths
-	if (!find_slots_and_ocp()) {
-		return false;  // failed
-	}
-
-	int fd = open(slots, O_RDWR);
-	if (fd < 0) {
-		return false;  // failed
-	}
-
-	char buffer[8192];  // only 4096 is indicated in sysfs, can it be larger?
-
-	memset(buffer, 0, sizeof(buffer));
-	read(fd, buffer, sizeof(buffer) - 1);  // allow one nul at end
-
-	// I/O multiplexing
-	if (NULL == strstr(buffer, CAPE_IIO)) {
-		lseek(fd, 0, SEEK_SET);
-		write(fd, CAPE_IIO "\n", CONST_STRLEN(CAPE_IIO "\n"));
-	}
-	// PWM
-	if (NULL == strstr(buffer, CAPE_PWM)) {
-		lseek(fd, 0, SEEK_SET);
-		write(fd, CAPE_PWM "\n", CONST_STRLEN(CAPE_PWM "\n"));
-	}
-	// also set up SPI0 -> /dev/spidevX.Y
-	if (NULL == strstr(buffer, CAPE_SPI)) {
-		lseek(fd, 0, SEEK_SET);
-		write(fd, CAPE_SPI "\n", CONST_STRLEN(CAPE_SPI "\n"));
-	}
-
-	// The desired I/O pin
-	if (NULL != pin_name) {
-		lseek(fd, 0, SEEK_SET);
-		write(fd, pin_name, strlen(pin_name));
-	}
-	// finished with the cape manager
-	close(fd);
-	return true;
-}
-
-static void write_file(const char *file_name, const char *buffer, size_t length) {
+static bool write_file(const char *file_name, const char *buffer, size_t length) {
 	if (length <= 0) {
 		length = strlen(buffer);
 	}
 	int fd = open(file_name, O_WRONLY);
 	if (fd < 0) {
 		fprintf(stderr, "write_file failed: '%s' <- '%s'\n", file_name, buffer); fflush(stderr);
-		return;  // failed
+		return false;  // failed
 	}
 	size_t n = write(fd, buffer, length);
 	fsync(fd);
@@ -520,6 +471,25 @@ static void write_file(const char *file_name, const char *buffer, size_t length)
 		fprintf(stderr, "write_file only wrote: %d of %d\n", n, length); fflush(stderr);
 	}
 	close(fd);
+	return n == length;
+}
+
+
+// set the edge file next to the value file
+static bool set_edge(int pin, const char *edge) {
+	size_t length = strlen(gpio_info[pin].value) - CONST_STRLEN(VALUE);
+	char file_name[length + CONST_STRLEN(EDGE) + sizeof((char)('\0'))];
+	memcpy(file_name, gpio_info[pin].value, length);
+	strcpy(&file_name[length], EDGE);
+	return write_file(file_name, edge, 0);
+}
+
+
+// monotonic time in milliseconds
+static uint64_t now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
 
@@ -543,125 +513,111 @@ static bool GPIO_enable(int pin) {
 	}
 
 	// try to load its firmware
-	if (!load_firmware(gpio_info[pin].name)) {
+	if (CAPEMGR_load(&gpio_info[pin].name, 1) < 0) {
 		return false;  // failed
 	}
 
-	// wait a bit for the device to appear
-	// is this long enough or should the whole code below be in a retry loop
-	usleep(10000);
-
-	size_t length = strlen(gpio_info[pin].name) - 1;  // ignore trailing '\n'
-
-	// find pwm path
-	DIR *dir = opendir(ocp);
-	if (NULL == dir) {
+	// find the device, waiting a bit for it to appear
+	char *device = CAPEMGR_device(gpio_info[pin].name, CAPEMGR_DEVICE_TIMEOUT_MS);
+	if (NULL == device) {
 		return false;  // failed
 	}
-	struct dirent *dp;
-	while (NULL != (dp = readdir(dir))) {
-		if (0 == strncmp(dp->d_name, gpio_info[pin].name, length)) {
-
-			gpio_info[pin].state = malloc(strlen(ocp)
-						      + sizeof((char)('/'))
-						      + strlen(dp->d_name)
-						      + sizeof((char)('/'))
-						      + CONST_STRLEN(STATE)
-						      + sizeof((char)('\0')));
-			if (NULL == gpio_info[pin].state) {
-				break;  // failed
-			}
 
-			// state - for setting optional pullup/pulldown
-			strcpy(gpio_info[pin].state, ocp);
-			strcat(gpio_info[pin].state, "/");
-			strcat(gpio_info[pin].state, dp->d_name);
-			strcat(gpio_info[pin].state, "/");
-			strcat(gpio_info[pin].state, STATE);
+	do {
+		gpio_info[pin].state = malloc(strlen(device)
+					      + sizeof((char)('/'))
+					      + CONST_STRLEN(STATE)
+					      + sizeof((char)('\0')));
+		if (NULL == gpio_info[pin].state) {
+			break;  // failed
+		}
 
-			const char *p = &(dp->d_name[length]);
-			while ('\0' != *p && !isdigit(*p)) {
-				++p;
-			}
-			size_t l = strspn(p, "0123456789");
-			if (l <= 0) {
-				break;  // failed
-			}
+		// state - for setting optional pullup/pulldown
+		strcpy(gpio_info[pin].state, device);
+		strcat(gpio_info[pin].state, "/");
+		strcat(gpio_info[pin].state, STATE);
 
-			// save the GPIO number - the 'pin' variable probably has
-			// the same value, but it is safer to use the kernel provided value
-			// in case the kernel logic changes
-			gpio_info[pin].number = malloc(l +  sizeof((char)('/')) + sizeof((char)('\0')));
-			if (NULL == gpio_info[pin].number) {
-				break;  // failed
-			}
-			strncpy(gpio_info[pin].number, p, l);
-			gpio_info[pin].number[l] = '\n';
-			gpio_info[pin].number[l + 1] = '\0';
-
-			// as the kernel to allocate the pin
-			export(gpio_info[pin].number);
-
-			// the direction file name
-			gpio_info[pin].direction = malloc(CONST_STRLEN(SYS_CLASS_GPIO)
-							  + l
-							  + sizeof((char)('/'))
-							  + CONST_STRLEN(DIRECTION)
-							  + sizeof((char)('\0')));
-			if (NULL == gpio_info[pin].direction) {
-				break;  // failed
-			}
+		const char *p = strrchr(device, '/') + 1 + strlen(gpio_info[pin].name);
+		while ('\0' != *p && !isdigit(*p)) {
+			++p;
+		}
+		size_t l = strspn(p, "0123456789");
+		if (l <= 0) {
+			break;  // failed
+		}
 
-			strcpy(gpio_info[pin].direction, SYS_CLASS_GPIO);
-			strncat(gpio_info[pin].direction, p, l);
-			strcat(gpio_info[pin].direction, "/");
-			strcat(gpio_info[pin].direction, DIRECTION);
-
-			// the active low file name
-			gpio_info[pin].active_low = malloc(CONST_STRLEN(SYS_CLASS_GPIO)
-							  + l
-							  + sizeof((char)('/'))
-							  + CONST_STRLEN(ACTIVE_LOW)
-							  + sizeof((char)('\0')));
-			if (NULL == gpio_info[pin].active_low) {
-				break;  // failed
-			}
+		// save the GPIO number - the 'pin' variable probably has
+		// the same value, but it is safer to use the kernel provided value
+		// in case the kernel logic changes
+		gpio_info[pin].number = malloc(l +  sizeof((char)('/')) + sizeof((char)('\0')));
+		if (NULL == gpio_info[pin].number) {
+			break;  // failed
+		}
+		strncpy(gpio_info[pin].number, p, l);
+		gpio_info[pin].number[l] = '\n';
+		gpio_info[pin].number[l + 1] = '\0';
+
+		// as the kernel to allocate the pin
+		export(gpio_info[pin].number);
+
+		// the direction file name
+		gpio_info[pin].direction = malloc(CONST_STRLEN(SYS_CLASS_GPIO)
+						  + l
+						  + sizeof((char)('/'))
+						  + CONST_STRLEN(DIRECTION)
+						  + sizeof((char)('\0')));
+		if (NULL == gpio_info[pin].direction) {
+			break;  // failed
+		}
 
-			strcpy(gpio_info[pin].active_low, SYS_CLASS_GPIO);
-			strncat(gpio_info[pin].active_low, p, l);
-			strcat(gpio_info[pin].active_low, "/");
-			strcat(gpio_info[pin].active_low, ACTIVE_LOW);
-
-			// the value file name
-			gpio_info[pin].value = malloc(CONST_STRLEN(SYS_CLASS_GPIO)
-						      + l
-						      + sizeof((char)('/'))
-						      + CONST_STRLEN(VALUE)
-						      + sizeof((char)('\0')));
-			if (NULL == gpio_info[pin].value) {
-				break;  // failed
-			}
+		strcpy(gpio_info[pin].direction, SYS_CLASS_GPIO);
+		strncat(gpio_info[pin].direction, p, l);
+		strcat(gpio_info[pin].direction, "/");
+		strcat(gpio_info[pin].direction, DIRECTION);
 
-			strcpy(gpio_info[pin].value, SYS_CLASS_GPIO);
-			strncat(gpio_info[pin].value, p, l);
-			strcat(gpio_info[pin].value, "/");
-			strcat(gpio_info[pin].value, VALUE);
-
-			// open a file handle to the value - to speed
-			// up access assumes most read/write go to
-			// this as other items (like direction) are
-			// only changed occasionally.
-			gpio_info[pin].fd = open(gpio_info[pin].value, O_RDWR | O_EXCL);
-			if (gpio_info[pin].fd < 0) {
-				break;  // failed
-			}
+		// the active low file name
+		gpio_info[pin].active_low = malloc(CONST_STRLEN(SYS_CLASS_GPIO)
+						   + l
+						   + sizeof((char)('/'))
+						   + CONST_STRLEN(ACTIVE_LOW)
+						   + sizeof((char)('\0')));
+		if (NULL == gpio_info[pin].active_low) {
+			break;  // failed
+		}
 
-			return true;
+		strcpy(gpio_info[pin].active_low, SYS_CLASS_GPIO);
+		strncat(gpio_info[pin].active_low, p, l);
+		strcat(gpio_info[pin].active_low, "/");
+		strcat(gpio_info[pin].active_low, ACTIVE_LOW);
+
+		// the value file name
+		gpio_info[pin].value = malloc(CONST_STRLEN(SYS_CLASS_GPIO)
+					      + l
+					      + sizeof((char)('/'))
+					      + CONST_STRLEN(VALUE)
+					      + sizeof((char)('\0')));
+		if (NULL == gpio_info[pin].value) {
+			break;  // failed
+		}
 
-			break;
+		strcpy(gpio_info[pin].value, SYS_CLASS_GPIO);
+		strncat(gpio_info[pin].value, p, l);
+		strcat(gpio_info[pin].value, "/");
+		strcat(gpio_info[pin].value, VALUE);
+
+		// open a file handle to the value - to speed
+		// up access assumes most read/write go to
+		// this as other items (like direction) are
+		// only changed occasionally.
+		gpio_info[pin].fd = open(gpio_info[pin].value, O_RDWR | O_EXCL);
+		if (gpio_info[pin].fd < 0) {
+			break;  // failed
 		}
-	}
-	closedir(dir);
+
+		free(device);
+		return true;
+	} while (false);
+	free(device);
 
 	// clean up any allocated memory or descriptors
 	if (gpio_info[pin].fd >= 0) {
@@ -700,111 +656,75 @@ static bool PWM_enable(int channel, const char *pin_name) {
 		return true;  // already configured
 	}
 
-	// compose PWM pin name
-	char *config = malloc(CONST_STRLEN(CAPE_PWM_PIN_PREFIX)
-			      + strlen(pin_name)
-			      + sizeof((char)('\n'))
-			      + sizeof((char)('\0')));
+	// compose PWM pin firmware and device names
+	size_t length = strlen(pin_name);
+	char overlay[CONST_STRLEN(CAPE_PWM_PIN_PREFIX) + length + sizeof((char)('\0'))];
+	char prefix[CONST_STRLEN(OCP_PWM_PREFIX) + length + sizeof((char)('\0'))];
+	const char *const overlays[] = {overlay};
 
-	if (NULL == config) {
-		return false;  // failed
-	}
-	strcpy(config, CAPE_PWM_PIN_PREFIX);
-	strcat(config, pin_name);
-	strcat(config, "\n");
+	strcpy(overlay, CAPE_PWM_PIN_PREFIX);
+	strcat(overlay, pin_name);
+	strcpy(prefix, OCP_PWM_PREFIX);
+	strcat(prefix, pin_name);
 
 	// try to load its firmware
-	if (!load_firmware(config)) {
-		free(config);
+	if (CAPEMGR_load(overlays, SIZE_OF_ARRAY(overlays)) < 0) {
 		return false;  // failed
 	}
-	free(config);
-
-	// wait a bit for the pwm device to appear.
-	// is this long enough or should the whole code below be in a retry loop?
-	usleep(10000);
-
-	config = malloc(CONST_STRLEN(OCP_PWM_PREFIX)
-			      + strlen(pin_name)
-			      + sizeof((char)('\0')));
 
-	if (NULL == config) {
-		return false; // failed
+	// find pwm path, waiting a bit for it to appear
+	char *device = CAPEMGR_device(prefix, CAPEMGR_DEVICE_TIMEOUT_MS);
+	if (NULL == device) {
+		return false;  // failed
 	}
 
-	strcpy(config, OCP_PWM_PREFIX);
-	strcat(config, pin_name);
-	size_t length = strlen(config);
-
-	// find pwm path
-	DIR *dir = opendir(ocp);
-	if (NULL == dir) {
-		goto done; // failed
+	pwm[channel].name = malloc(strlen(device) + CONST_STRLEN(DUTY) + sizeof((char)('\0')));
+	if (NULL == pwm[channel].name) {
+		goto done;  // failed
 	}
-	struct dirent *dp;
-	while (NULL != (dp = readdir(dir))) {
-		if (0 == strncmp(dp->d_name, config, length)) {
-			pwm[channel].name = malloc(strlen(ocp)
-						   + sizeof((char)('/'))
-						   + strlen(dp->d_name) + CONST_STRLEN(DUTY)
-						   + sizeof((char)('\0')));
-			if (NULL == pwm[channel].name) {
-				break;  // failed
-			}
 
-			strcpy(pwm[channel].name, ocp);
-			strcat(pwm[channel].name, "/");
-			strcat(pwm[channel].name, dp->d_name);
-			strcat(pwm[channel].name, DUTY);
-
-			// wait up to 5 seconds for the pwm driver to appear.
-			// is the device tree populated in the background?
-			for (int i = 0; i < 500; ++i) {
-				pwm[channel].fd = open(pwm[channel].name, O_RDWR);
-				if (pwm[channel].fd >= 0) {
-					break;
-				}
-				usleep(10000);
-			}
-			if (pwm[channel].fd < 0) {
-				fprintf(stderr, "PWM failed to appear\n"); fflush(stderr);
-				free(pwm[channel].name);
-				pwm[channel].name = NULL;
-				break;  // failed
-			}
+	strcpy(pwm[channel].name, device);
+	strcat(pwm[channel].name, DUTY);
 
-			// set duty = zero
-			lseek(pwm[channel].fd, 0, SEEK_SET);
-			write(pwm[channel].fd, "0\n", 2);
+	// wait up to 5 seconds for the pwm driver to appear.
+	// is the device tree populated in the background?
+	for (int i = 0; i < 500; ++i) {
+		pwm[channel].fd = open(pwm[channel].name, O_RDWR);
+		if (pwm[channel].fd >= 0) {
+			break;
+		}
+		usleep(10000);
+	}
+	if (pwm[channel].fd < 0) {
+		fprintf(stderr, "PWM failed to appear\n"); fflush(stderr);
+		free(pwm[channel].name);
+		pwm[channel].name = NULL;
+		goto done;  // failed
+	}
 
-			char buffer[4096];
-			// set zero duty => zero output
-			strcpy(buffer, ocp);
-			strcat(buffer, "/");
-			strcat(buffer, dp->d_name);
-			strcat(buffer, POLARITY);
+	// set duty = zero
+	lseek(pwm[channel].fd, 0, SEEK_SET);
+	write(pwm[channel].fd, "0\n", 2);
 
-			write_file(buffer, "0\n", 2);
+	char buffer[4096];
+	// set zero duty => zero output
+	strcpy(buffer, device);
+	strcat(buffer, POLARITY);
 
-			// read and save period?
-			// ???currently seems to be fixed to 500000
-			pwm[channel].period = 500000;
+	write_file(buffer, "0\n", 2);
 
-			// start
-			strcpy(buffer, ocp);
-			strcat(buffer, "/");
-			strcat(buffer, dp->d_name);
-			strcat(buffer, RUN);
+	// read and save period?
+	// ???currently seems to be fixed to 500000
+	pwm[channel].period = 500000;
 
-			write_file(buffer, "1\n", 2);
+	// start
+	strcpy(buffer, device);
+	strcat(buffer, RUN);
 
-			break;
-		}
-	}
-	closedir(dir);
+	write_file(buffer, "1\n", 2);
 
 done:
-	free(config);
+	free(device);
 	return NULL != pwm[channel].name;
 }
 
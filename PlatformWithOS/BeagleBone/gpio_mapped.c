@@ -43,6 +43,7 @@
 #include <err.h>
 
 #include "gpio.h"
+#include "capemgr.h"
 
 
 // register addresses in BeagleBone Black
@@ -94,10 +95,6 @@ enum {
 };
 
 
-// cape manager info
-static char *slots = NULL;
-static char *ocp = NULL;
-
 // access to peripherals
 volatile uint32_t *gpio_map[4];  // GPIO 0..3
 
@@ -107,12 +104,22 @@ static struct {
 	uint32_t period;
 } pwm[4];
 
+// firmware files (/lib/firmware/NAME.dtbo) loaded by setup
+#define CAPE_IIO "cape-bone-iio"
+#define CAPE_PWM "am33xx_pwm"
+#define CAPE_SPI "BB-SPIDEV0"   // SPI0 -> /dev/spidevX.Y
+
+static const char *const base_overlays[] = {
+	CAPE_IIO,  // I/O multiplexing
+	CAPE_PWM,
+	CAPE_SPI
+};
+
 #define SIZE_OF_ARRAY(a) (sizeof(a) / sizeof((a)[0]))
 
 // local function prototypes;
 static bool create_rw_map(volatile uint32_t **map, int fd, uint32_t offset);
 static bool delete_map(volatile uint32_t *address);
-static bool load_firmware(const char *pin_name);
 static bool PWM_enable(int channel, const char *pin_name);
 static void PWM_set_duty(int channel, int16_t value);
 
@@ -153,7 +160,7 @@ bool GPIO_setup() {
 	close(mem_fd);
 
 	// ensure the base firmware is setup
-	if (!load_firmware(NULL)) {
+	if (CAPEMGR_load(base_overlays, SIZE_OF_ARRAY(base_overlays)) < 0) {
 		goto fail;
 	}
 
@@ -182,22 +189,11 @@ bool GPIO_teardown() {
 		}
 	}
 
-	if (NULL != slots) {
-		// should unload the loaded firmware here,
-		// but any attempt to do this crashes the process
-		// probably a kernel bug, which may cause system instablility
-		free(slots);
-	}
-
-	if (NULL != ocp) {
-		free(ocp);
-	}
+	CAPEMGR_teardown();
 
 	// clear all pointers so calling setup again will work
 	memset(gpio_map, 0, sizeof(gpio_map));
 	memset(pwm, 0, sizeof(pwm));
-	slots = NULL;
-	ocp = NULL;
 
 	return true;
 }
@@ -271,6 +267,52 @@ void GPIO_write(GPIO_pin_type pin, int value) {
 }
 
 
+void GPIO_write_pins(const GPIO_pin_value *pins, size_t count) {
+	uint32_t set[4] = {0, 0, 0, 0};
+	uint32_t clear[4] = {0, 0, 0, 0};
+	for (size_t i = 0; i < count; ++i) {
+		int bank = (pins[i].pin >> 8) & 0xff;
+		int pin = pins[i].pin & 0xff;
+		if (bank > 3 || pin > 31) {
+			continue;
+		}
+		uint32_t bit = 1 << pin;
+		if (0 != pins[i].value) {
+			set[bank] |= bit;
+		} else {
+			clear[bank] |= bit;
+		}
+	}
+	for (int bank = 0; bank < 4; ++bank) {
+		if (0 != set[bank]) {
+			gpio_map[bank][GPIO_SETDATAOUT] = set[bank];
+		}
+		if (0 != clear[bank]) {
+			gpio_map[bank][GPIO_CLEARDATAOUT] = clear[bank];
+		}
+	}
+}
+
+// the 3.8 kernels this is for have no GPIO character device and the
+// pins are not exported, so there is nothing to poll(); just sample
+// the data register
+bool GPIO_wait_edge(GPIO_pin_type pin, int level, int timeout_ms) {
+	int bank = (pin >> 8) & 0xff;
+	if (bank < 0 || bank > 3 || (pin & 0xff) > 31) {
+		return false;
+	}
+	level = (0 != level);
+
+	for (long elapsed_us = 0; level != GPIO_read(pin); elapsed_us += 10) {
+		if (timeout_ms >= 0 && elapsed_us >= timeout_ms * 1000L) {
+			return false;
+		}
+		usleep(10);
+	}
+	return true;
+}
+
+
 // only affect PWM if correct pin is addressed
 void GPIO_pwm_write(int pin, uint32_t value) {
 	if (value > 1023) {
@@ -322,15 +364,6 @@ static bool delete_map(volatile uint32_t *address) {
 
 
 
-#include <sys/types.h>
-#include <dirent.h>
-
-#define DEVICES "/sys/devices"
-#define CAPE_MANAGER "bone_capemgr."
-#define OCP "ocp."
-
-#define SLOTS "/slots"
-
 // pwm files
 #define PERIOD "/period"
 #define DUTY "/duty"
@@ -338,9 +371,6 @@ static bool delete_map(volatile uint32_t *address) {
 #define POLARITY "/polarity"
 
 // firmware files (/lib/firmware/NAME.dtbo) to load
-#define CAPE_IIO "cape-bone-iio"
-#define CAPE_PWM "am33xx_pwm"
-#define CAPE_SPI "BB-SPIDEV0"
 #define CAPE_PWM_PIN_PREFIX "bone_pwm_"
 
 // ocp files
@@ -352,217 +382,83 @@ static bool delete_map(volatile uint32_t *address) {
 #define CONST_STRLEN(const_string) (sizeof(const_string) - sizeof((char)('\0')))
 
 
-static bool find_slots_and_ocp() {
-	if (NULL != slots) {
-		return true;  // already done
-	}
-
-	DIR *dir = opendir(DEVICES);
-	if (NULL == dir) {
-		return false; // failed
-	}
-
-	struct dirent *dp;
-	while (NULL != (dp = readdir(dir))) {
-		if (0 == strncmp(dp->d_name, CAPE_MANAGER, CONST_STRLEN(CAPE_MANAGER))
-		    && NULL == slots) {
-			slots = malloc(CONST_STRLEN(DEVICES) + sizeof((char)('/')) + strlen(dp->d_name)
-				       + CONST_STRLEN(SLOTS) + sizeof((char)('\0')));
-			if (NULL == slots) {
-				break;   // failed
-			}
-			strcpy(slots, DEVICES "/");
-			strcat(slots, dp->d_name);
-			strcat(slots, SLOTS);
-		} else if (0 == strncmp(dp->d_name, OCP, CONST_STRLEN(OCP))
-			   && NULL == ocp) {
-			ocp = malloc(CONST_STRLEN(DEVICES)
-				     + sizeof((char)('/'))
-				     + strlen(dp->d_name)
-				     + sizeof((char)('\0')));
-			if (NULL == ocp) {
-				break;   // failed
-			}
-			strcpy(ocp, DEVICES "/");
-			strcat(ocp, dp->d_name);
-		}
+// enable PWM
+static bool PWM_enable(int channel, const char *pin_name) {
+	if (NULL != pwm[channel].name) {
+		return true;  // already configured
 	}
-	(void)closedir(dir);
-
-	if (NULL == slots || NULL == ocp) {
-		if (NULL != slots) {
-			free(slots);
-			slots = NULL;
-		}
-		if (NULL != ocp) {
-			free(ocp);
-			ocp = NULL;
-		}
 
-		return false;  // failed
-	}
+	// compose PWM pin firmware and device names
+	size_t length = strlen(pin_name);
+	char overlay[CONST_STRLEN(CAPE_PWM_PIN_PREFIX) + length + sizeof((char)('\0'))];
+	char prefix[CONST_STRLEN(OCP_PWM_PREFIX) + length + sizeof((char)('\0'))];
+	const char *const overlays[] = {overlay};
 
-	// success
-	return true;
-}
+	strcpy(overlay, CAPE_PWM_PIN_PREFIX);
+	strcat(overlay, pin_name);
+	strcpy(prefix, OCP_PWM_PREFIX);
+	strcat(prefix, pin_name);
 
-static bool load_firmware(const char *pin_name) {
-	// find slots and ocp paths
-	if (!find_slots_and_ocp()) {
+	// try to load its firmware
+	if (CAPEMGR_load(overlays, SIZE_OF_ARRAY(overlays)) < 0) {
 		return false;  // failed
 	}
 
-	int fd = open(slots, O_RDWR);
-	if (fd < 0) {
+	// find pwm path, waiting a bit for it to appear
+	char *device = CAPEMGR_device(prefix, CAPEMGR_DEVICE_TIMEOUT_MS);
+	if (NULL == device) {
 		return false;  // failed
 	}
 
-	char buffer[8192];  // only 4096 is indicated in sysfs, can it be larger?
-
-	memset(buffer, 0, sizeof(buffer));
-	read(fd, buffer, sizeof(buffer) - 1);  // allow one nul at end
-
-	// I/O multiplexing
-	if (NULL == strstr(buffer, CAPE_IIO)) {
-		lseek(fd, 0, SEEK_SET);
-		write(fd, CAPE_IIO "\n", CONST_STRLEN(CAPE_IIO "\n"));
-	}
-	// PWM
-	if (NULL == strstr(buffer, CAPE_PWM)) {
-		lseek(fd, 0, SEEK_SET);
-		write(fd, CAPE_PWM "\n", CONST_STRLEN(CAPE_PWM "\n"));
-	}
-	// also set up SPI0 -> /dev/spidevX.Y
-	if (NULL == strstr(buffer, CAPE_SPI)) {
-		lseek(fd, 0, SEEK_SET);
-		write(fd, CAPE_SPI "\n", CONST_STRLEN(CAPE_SPI "\n"));
+	pwm[channel].name = malloc(strlen(device) + CONST_STRLEN(DUTY) + sizeof((char)('\0')));
+	if (NULL == pwm[channel].name) {
+		goto done;  // failed
 	}
 
-	// The desired PWM pin
-	if (NULL != pin_name) {
-		char *config = malloc(CONST_STRLEN(CAPE_PWM_PIN_PREFIX)
-				      + strlen(pin_name)
-				      + sizeof((char)('\n'))
-				      + sizeof((char)('\0')));
-
-		if (NULL == config) {
-			close(fd);
-			return false; // failed
-		}
-		strcpy(config, CAPE_PWM_PIN_PREFIX);
-		strcat(config, pin_name);
-		strcat(config, "\n");
+	strcpy(pwm[channel].name, device);
+	strcat(pwm[channel].name, DUTY);
 
-		if (NULL == strstr(buffer, config)) {
-			lseek(fd, 0, SEEK_SET);
-			write(fd, config, strlen(config));
+	// wait up to 5 seconds for the pwm driver to appear.
+	// is the device tree populated in the background?
+	for (int i = 0; i < 500; ++i) {
+		pwm[channel].fd = open(pwm[channel].name, O_RDWR);
+		if (pwm[channel].fd >= 0) {
+			break;
 		}
-		free(config);
+		usleep(10000);
 	}
-	// finished with the cape manager
-	close(fd);
-	return true;
-}
-
-
-// enable PWM
-static bool PWM_enable(int channel, const char *pin_name) {
-	if (NULL != pwm[channel].name) {
-		return true;  // already configured
+	if (pwm[channel].fd < 0) {
+		fprintf(stderr, "PWM failed to appear\n"); fflush(stderr);
+		free(pwm[channel].name);
+		pwm[channel].name = NULL;
+		goto done;  // failed
 	}
 
-	// find slots and ocp paths
-	if (!load_firmware(pin_name)) {
-		return false;  // failed
-	}
-
-	// wait a bit for the pwm device to appear.
-	// is this long enough or should the whole code below be in a retry loop?
-	usleep(10000);
-
-	char *config = malloc(CONST_STRLEN(OCP_PWM_PREFIX)
-			      + strlen(pin_name)
-			      + sizeof((char)('\0')));
-
-	if (NULL == config) {
-		return false; // failed
-	}
-
-	strcpy(config, OCP_PWM_PREFIX);
-	strcat(config, pin_name);
-	size_t length = strlen(config);
+	// set duty = zero
+	lseek(pwm[channel].fd, 0, SEEK_SET);
+	write(pwm[channel].fd, "0\n", 2);
+
+	char buffer[4096];
+	// set zero duty => zero output
+	strcpy(buffer, device);
+	strcat(buffer, POLARITY);
+	int fd = open(buffer, O_WRONLY);
+	write(fd, "0\n", 2);
+	close(fd);
 
-	// find pwm path
-	DIR *dir = opendir(ocp);
-	if (NULL == dir) {
-		goto done; // failed
-	}
-	struct dirent *dp;
-	while (NULL != (dp = readdir(dir))) {
-		if (0 == strncmp(dp->d_name, config, length)) {
-			pwm[channel].name = malloc(strlen(ocp)
-						   + sizeof((char)('/'))
-						   + strlen(dp->d_name) + CONST_STRLEN(DUTY)
-						   + sizeof((char)('\0')));
-			if (NULL == pwm[channel].name) {
-				break;  // failed
-			}
-
-			strcpy(pwm[channel].name, ocp);
-			strcat(pwm[channel].name, "/");
-			strcat(pwm[channel].name, dp->d_name);
-			strcat(pwm[channel].name, DUTY);
-
-			// wait up to 5 seconds for the pwm driver to appear.
-			// is the device tree populated in the background?
-			for (int i = 0; i < 500; ++i) {
-				pwm[channel].fd = open(pwm[channel].name, O_RDWR);
-				if (pwm[channel].fd >= 0) {
-					break;
-				}
-				usleep(10000);
-			}
-			if (pwm[channel].fd < 0) {
-				fprintf(stderr, "PWM failed to appear\n"); fflush(stderr);
-				free(pwm[channel].name);
-				pwm[channel].name = NULL;
-				break;  // failed
-			}
-
-			// set duty = zero
-			lseek(pwm[channel].fd, 0, SEEK_SET);
-			write(pwm[channel].fd, "0\n", 2);
-
-			char buffer[4096];
-			// set zero duty => zero output
-			strcpy(buffer, ocp);
-			strcat(buffer, "/");
-			strcat(buffer, dp->d_name);
-			strcat(buffer, POLARITY);
-			int fd = open(buffer, O_WRONLY);
-			write(fd, "0\n", 2);
-			close(fd);
-
-			// read and save period?
-			// ???currently seems to be fixed to 500000
-			pwm[channel].period = 500000;
-
-			// start
-			strcpy(buffer, ocp);
-			strcat(buffer, "/");
-			strcat(buffer, dp->d_name);
-			strcat(buffer, RUN);
-			fd = open(buffer, O_WRONLY);
-			write(fd, "1\n", 2);
-			close(fd);
+	// read and save period?
+	// ???currently seems to be fixed to 500000
+	pwm[channel].period = 500000;
 
-			break;
-		}
-	}
-	closedir(dir);
+	// start
+	strcpy(buffer, device);
+	strcat(buffer, RUN);
+	fd = open(buffer, O_WRONLY);
+	write(fd, "1\n", 2);
+	close(fd);
 
 done:
-	free(config);
+	free(device);
 	return NULL != pwm[channel].name;
 }
 
@@ -18,6 +18,7 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <stddef.h>
 
 #define GPIO_PIN(bank, pin) ((((bank) & 0xff) << 8) | ((pin) & 0xff))
 
@@ -131,6 +132,15 @@ typedef enum {
 	GPIO_PWM      // as PWM output (only for P1_12
 } GPIO_mode_type;
 
+// timeout for GPIO_wait_edge
+#define GPIO_WAIT_FOREVER (-1)
+
+// a pin and the value to write to it, for GPIO_write_pins
+typedef struct {
+	GPIO_pin_type pin;
+	int value;
+} GPIO_pin_value;
+
 
 // functions
 // =========
@@ -151,6 +161,15 @@ int GPIO_read(int pin);
 // set or clear a given output pin
 void GPIO_write(GPIO_pin_type pin, int value);
 
+// set or clear several output pins together, one GPIO_SETDATAOUT and
+// one GPIO_CLEARDATAOUT store per bank (sets first)
+void GPIO_write_pins(const GPIO_pin_value *pins, size_t count);
+
+// block until an input pin reads level (0/1) or timeout_ms
+// milliseconds pass (GPIO_WAIT_FOREVER => no timeout)
+// return false on timeout
+bool GPIO_wait_edge(GPIO_pin_type pin, int level, int timeout_ms);
+
 // set the PWM ration 0..1023 for hardware PWM pin (GPIO_P1_12)
 void GPIO_pwm_write(int pin, uint32_t value);
 
@@ -18,6 +18,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
 //#include <sys/mman.h>
 #include <unistd.h>
 #include <err.h>
@@ -35,7 +38,8 @@
 		.pwm_chip = 0,       \
 		.pwm_channel = 0,    \
 		.pwm_state = 0,     \
-		.fd = -1             \
+		.fd = -1,            \
+		.edge = false        \
 	}
 
 // if the pin can also be a pwm
@@ -47,7 +51,8 @@
 		.pwm_chip = _chip,   \
 		.pwm_channel = _channel, \
 		.pwm_state = _state, \
-		.fd = -1             \
+		.fd = -1,            \
+		.edge = false        \
 	}
 
 // GPIO mode
@@ -66,6 +71,7 @@ static struct {
 	int pwm_channel;        // channel number
 	int pwm_state;          // index of a state file for multiplexor control
 	int fd;                 // open fd to value/duty_cycle file for fast access
+	bool edge;              // fd signals both edges to poll() (input only)
 } gpio_info[] = {
 	// Connector P8
 	MAKE_PIN("P8.03", 1, 6),   //  GPIO1_6
@@ -174,6 +180,7 @@ static struct {
 //#define STATE_rxEnable_pullDown  "rxEnable_pullDown"
 
 #define GPIO_EDGE_none     "none"
+#define GPIO_EDGE_both     "both"
 #define GPIO_DIRECTION_in  "in"
 #define GPIO_DIRECTION_out "out"
 
@@ -227,8 +234,8 @@ const char *const spi_state_file[] = {
 
 // local function prototypes;
 static bool load_firmware(const char *pin_name);
-static void write_file(const char *file_name, const char *buffer, size_t length);
-static void write_pin_file(const char *file_name, int pin, const char *buffer, size_t length);
+static bool write_file(const char *file_name, const char *buffer, size_t length);
+static bool write_pin_file(const char *file_name, int pin, const char *buffer, size_t length);
 static void write_pwm_file(const char *file_name, int chip, int channel, const char *buffer, size_t length);
 static char *make_formatted_buffer(const char *format, ...);
 static void export(int number);
@@ -238,6 +245,7 @@ static void unexport_pwm(int chip, int number);
 static bool GPIO_enable(int pin);
 static bool PWM_enable(int pin);
 static void PWM_set_duty(int pin, int16_t value);
+static uint64_t now_ms(void);
 
 
 // set up access to the GPIO and PWM
@@ -271,6 +279,7 @@ bool GPIO_teardown() {
 			close(gpio_info[pin].fd);
 			gpio_info[pin].fd = -1;
 		}
+		gpio_info[pin].edge = false;
 
 		switch(gpio_info[pin].active) {
 		case Mode_NONE:
@@ -317,7 +326,7 @@ void GPIO_mode(GPIO_pin_type pin, GPIO_mode_type mode) {
 		}
 		write_pin_file(GPIO_DIRECTION, pin, GPIO_DIRECTION_in "\n", CONST_STRLEN(GPIO_DIRECTION_in "\n"));
 		write_pin_file(GPIO_ACTIVE_LOW, pin, "0\n", 2);
-		write_pin_file(GPIO_EDGE, pin, GPIO_EDGE_none "\n", CONST_STRLEN(GPIO_EDGE_none "\n"));
+		gpio_info[pin].edge = write_pin_file(GPIO_EDGE, pin, GPIO_EDGE_both "\n", CONST_STRLEN(GPIO_EDGE_both "\n"));
 		//write_pin_file(GPIO_STATE, pin, STATE_rxEnable_pullNone "\n", CONST_STRLEN(STATE_rxEnable_pullNone "\n"));
 		break;
 
@@ -325,9 +334,11 @@ void GPIO_mode(GPIO_pin_type pin, GPIO_mode_type mode) {
 		if (gpio_info[pin].fd < 0 && !GPIO_enable(pin)) {
 			return;
 		}
+		// an edge interrupt would keep the pin an input
+		write_pin_file(GPIO_EDGE, pin, GPIO_EDGE_none "\n", CONST_STRLEN(GPIO_EDGE_none "\n"));
+		gpio_info[pin].edge = false;
 		write_pin_file(GPIO_DIRECTION, pin, GPIO_DIRECTION_out "\n", CONST_STRLEN(GPIO_DIRECTION_out "\n"));
 		write_pin_file(GPIO_ACTIVE_LOW, pin, "0\n", 2);
-		write_pin_file(GPIO_EDGE, pin, GPIO_EDGE_none "\n", CONST_STRLEN(GPIO_EDGE_none "\n"));
 		//write_pin_file(GPIO_STATE, pin, STATE_rxDisable_pullNone "\n", CONST_STRLEN(STATE_rxDisable_pullNone "\n"));
 		break;
 
@@ -380,6 +391,54 @@ void GPIO_write(GPIO_pin_type pin, int value) {
 }
 
 
+// each pin has its own value file, so there is nothing to combine
+void GPIO_write_pins(const GPIO_pin_value *pins, size_t count) {
+	for (size_t i = 0; i < count; ++i) {
+		GPIO_write(pins[i].pin, pins[i].value);
+	}
+}
+
+bool GPIO_wait_edge(GPIO_pin_type pin, int level, int timeout_ms) {
+	// ignore unimplemented or inactive pins
+	if (pin < 0 || pin >= SIZE_OF_ARRAY(gpio_info) || NULL == gpio_info[pin].name || gpio_info[pin].fd < 0
+	    || Mode_GPIO != gpio_info[pin].active) {
+		return false;
+	}
+	level = (0 != level);
+
+	uint64_t deadline = now_ms() + (timeout_ms > 0 ? timeout_ms : 0);
+
+	for (;;) {
+		// reading the value also re-arms the edge notification
+		if (level == GPIO_read(pin)) {
+			return true;
+		}
+
+		int remaining = -1;
+		if (timeout_ms >= 0) {
+			uint64_t t = now_ms();
+			if (t >= deadline) {
+				return false;
+			}
+			remaining = deadline - t;
+		}
+
+		if (!gpio_info[pin].edge) {
+			usleep(10);
+			continue;
+		}
+		struct pollfd p = {
+			.fd = gpio_info[pin].fd,
+			.events = POLLPRI | POLLERR
+		};
+		if (poll(&p, 1, remaining) < 0 && EINTR != errno) {
+			warn("poll failed on GPIO %d", pin);
+			return false;
+		}
+	}
+}
+
+
 // only affect PWM if correct pin is addressed
 void GPIO_pwm_write(int pin, uint32_t value) {
 	if (value > 1023) {
@@ -450,14 +509,14 @@ static bool load_firmware(const char *pin_name) {
 	return true;
 }
 
-static void write_file(const char *file_name, const char *buffer, size_t length) {
+static bool write_file(const char *file_name, const char *buffer, size_t length) {
 	if (length <= 0) {
 		length = strlen(buffer);
 	}
 	int fd = open(file_name, O_WRONLY);
 	if (fd < 0) {
 		fprintf(stderr, "write_file failed: '%s' <- '%s'\n", file_name, buffer); fflush(stderr);
-		return;  // failed
+		return false;  // failed
 	}
 	size_t n = write(fd, buffer, length);
 	fsync(fd);
@@ -465,13 +524,15 @@ static void write_file(const char *file_name, const char *buffer, size_t length)
 		fprintf(stderr, "write_file only wrote: %d of %d\n", n, length); fflush(stderr);
 	}
 	close(fd);
+	return n == length;
 }
 
 
-static void write_pin_file(const char *path, int pin, const char *buffer, size_t length) {
+static bool write_pin_file(const char *path, int pin, const char *buffer, size_t length) {
 	char *f = make_formatted_buffer(path, pin);
-	write_file(f, buffer, length);
+	bool ok = write_file(f, buffer, length);
 	free(f);
+	return ok;
 }
 
 static void write_pwm_file(const char *path, int chip, int pin, const char *buffer, size_t length) {
@@ -656,3 +717,11 @@ static void PWM_set_duty(int pin, int16_t value) {
 	}
 	fsync(gpio_info[pin].fd);
 }
+
+
+// monotonic time in milliseconds
+static uint64_t now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
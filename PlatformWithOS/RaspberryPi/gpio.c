@@ -28,10 +28,16 @@
 #include <string.h>
 #include <ctype.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
 #include <sys/mman.h>
+#include <sys/ioctl.h>
 #include <unistd.h>
 #include <err.h>
 
+#include <linux/gpio.h>
+
 #include <bcm_host.h>
 #include "gpio.h"
 
@@ -232,10 +238,24 @@ volatile uint32_t *pwm_map;
 volatile uint32_t *clock_map;
 /* volatile uint32_t *timer_map; */
 
+// GPIO character device for edge events, the BCM GPIO
+// numbers are the line offsets of the first chip
+#define GPIO_CHIP "/dev/gpiochip0"
+
+// line event handles for GPIO_wait_edge
+enum {
+	EVENT_NOT_REQUESTED = -1,  // try to request on first wait
+	EVENT_UNAVAILABLE = -2     // no kernel support => poll the level
+};
+static int event_fd[64] = {[0 ... 63] = EVENT_NOT_REQUESTED};
+
 
 // local function prototypes;
 static bool create_rw_map(volatile uint32_t **map, int fd, uint32_t base_address, uint32_t offset);
 static bool delete_map(volatile uint32_t *address);
+static int line_events(GPIO_pin_type pin);
+static void drain_events(int fd);
+static uint64_t now_ms(void);
 
 
 // set up access to the GPIO and PWM
@@ -292,6 +312,12 @@ close_mem:
 
 // revoke access to GPIO and PWM
 bool GPIO_teardown() {
+	for (size_t pin = 0; pin < SIZE_OF_ARRAY(event_fd); ++pin) {
+		if (event_fd[pin] >= 0) {
+			close(event_fd[pin]);
+		}
+		event_fd[pin] = EVENT_NOT_REQUESTED;
+	}
 //	delete_map(timer_map);
 	delete_map(clock_map);
 	delete_map(pwm_map);
@@ -379,6 +405,75 @@ void GPIO_write(GPIO_pin_type pin, int value) {
 }
 
 
+void GPIO_write_pins(const GPIO_pin_value *pins, size_t count) {
+	uint32_t set[2] = {0, 0};
+	uint32_t clear[2] = {0, 0};
+	for (size_t i = 0; i < count; ++i) {
+		unsigned int pin = pins[i].pin;
+		if (pin > 63) {
+			continue;
+		}
+		uint32_t bit = 1 << (pin & 0x1f);
+		if (0 != pins[i].value) {
+			set[pin >> 5] |= bit;
+		} else {
+			clear[pin >> 5] |= bit;
+		}
+	}
+	for (int bank = 0; bank < 2; ++bank) {
+		if (0 != set[bank]) {
+			gpio_map[GPSET0 + bank] = set[bank];
+		}
+		if (0 != clear[bank]) {
+			gpio_map[GPCLR0 + bank] = clear[bank];
+		}
+	}
+}
+
+bool GPIO_wait_edge(GPIO_pin_type pin, int level, int timeout_ms) {
+	if ((unsigned)(pin) > 63) {
+		return false;
+	}
+	level = (0 != level);
+
+	int fd = line_events(pin);
+	uint64_t deadline = now_ms() + (timeout_ms > 0 ? timeout_ms : 0);
+
+	for (;;) {
+		// discard edges seen before this read, any later
+		// edge stays queued and ends the poll below
+		if (fd >= 0) {
+			drain_events(fd);
+		}
+		if (level == GPIO_read(pin)) {
+			return true;
+		}
+
+		int remaining = -1;
+		if (timeout_ms >= 0) {
+			uint64_t t = now_ms();
+			if (t >= deadline) {
+				return false;
+			}
+			remaining = deadline - t;
+		}
+
+		if (fd < 0) {
+			usleep(10);
+			continue;
+		}
+		struct pollfd p = {
+			.fd = fd,
+			.events = POLLIN
+		};
+		if (poll(&p, 1, remaining) < 0 && EINTR != errno) {
+			warn("poll failed on GPIO %d", pin);
+			return false;
+		}
+	}
+}
+
+
 // only affetct PWM if correct pin is addressed
 void GPIO_pwm_write(GPIO_pin_type pin, uint32_t value) {
 	if (GPIO_P1_12 == pin) {
@@ -411,3 +506,53 @@ static bool delete_map(volatile uint32_t *address) {
 	munmap((void *)address, MAP_SIZE);
 	return true;
 }
+
+
+// request both edge events for an input pin from the kernel
+// -1 => not possible, wait by polling the level instead
+static int line_events(GPIO_pin_type pin) {
+	if (EVENT_NOT_REQUESTED != event_fd[pin]) {
+		return event_fd[pin] >= 0 ? event_fd[pin] : -1;
+	}
+	event_fd[pin] = EVENT_UNAVAILABLE;
+
+	int chip_fd = open(GPIO_CHIP, O_RDONLY | O_CLOEXEC);
+	if (chip_fd < 0) {
+		return -1;
+	}
+
+	struct gpioevent_request request;
+	memset(&request, 0, sizeof(request));
+	request.lineoffset = pin;
+	request.handleflags = GPIOHANDLE_REQUEST_INPUT;
+	request.eventflags = GPIOEVENT_REQUEST_BOTH_EDGES;
+	strncpy(request.consumer_label, "epd", sizeof(request.consumer_label) - 1);
+
+	int rc = ioctl(chip_fd, GPIO_GET_LINEEVENT_IOCTL, &request);
+	close(chip_fd);
+	if (rc < 0) {
+		warn("no edge events for GPIO %d, polling instead", pin);
+		return -1;
+	}
+
+	// only read queued events, never block on them
+	fcntl(request.fd, F_SETFL, fcntl(request.fd, F_GETFL) | O_NONBLOCK);
+	event_fd[pin] = request.fd;
+	return request.fd;
+}
+
+
+// read all queued edge events
+static void drain_events(int fd) {
+	struct gpioevent_data event[16];
+	while (read(fd, event, sizeof(event)) > 0) {
+	}
+}
+
+
+// monotonic time in milliseconds
+static uint64_t now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
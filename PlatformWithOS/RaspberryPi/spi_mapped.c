@@ -0,0 +1,362 @@
+// Copyright 2013-2015 Pervasive Displays, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at:
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+// express or implied.  See the License for the specific language
+// governing permissions and limitations under the License.
+
+// SPI0 driven through its registers instead of spidev
+//
+// For the BCM SOC Preipheral Manual register layout see:
+//   http://www.raspberrypi.org/wp-content/uploads/2012/02/BCM2835-ARM-Peripherals.pdf
+//
+// Every transfer is polled: the FIFO is filled and drained by the
+// caller, so there is no system call and no delay between bytes or
+// transfers.  The spidev path only selects the chip select
+// (/dev/spidev0.N uses CE N).  The SPI pins must already be in their
+// SPI function, which dtparam=spi=on does, and nothing else may use
+// SPI0 while this runs.  All the SPI_batch calls are accepted, but
+// each transfer is sent at once since there is nothing to save.
+//
+// Built with SPI_MAPPED_MODEL (by spi_mapped_model.c, for epd_bench)
+// nothing is mapped and the registers are read and written through
+// the model's functions instead.
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <err.h>
+
+#if !defined(SPI_MAPPED_MODEL)
+#include <bcm_host.h>
+#endif
+#include "spi.h"
+#include "epd.h"
+
+
+// register addresses in Rasberry PI
+enum {
+	SPI0_REGISTERS = 0x00204000
+};
+
+// SPI0 registers (all registers are 32 bit)
+// (Manual Chapter 10)
+enum {                // byte offset     function
+	SPI_CS   = 0x00,  // 0x0000  Control and Status
+	SPI_FIFO = 0x01,  // 0x0004  TX and RX FIFOs
+	SPI_CLK  = 0x02,  // 0x0008  Clock Divider
+	SPI_DLEN = 0x03,  // 0x000C  Data Length (DMA only)
+	SPI_LTOH = 0x04,  // 0x0010  LoSSI mode Control
+	SPI_DC   = 0x05   // 0x0014  DMA DREQ Controls
+};
+
+// SPI_CS bits
+// (Manual Chapter 10)
+enum {
+	SPI_CS_CS_MASK  = 0x00000003,  // chip select
+	SPI_CS_CPHA     = 0x00000004,  // clock phase
+	SPI_CS_CPOL     = 0x00000008,  // clock polarity
+	SPI_CS_CLEAR_TX = 0x00000010,  // clear TX FIFO
+	SPI_CS_CLEAR_RX = 0x00000020,  // clear RX FIFO
+	SPI_CS_TA       = 0x00000080,  // transfer active
+	SPI_CS_DONE     = 0x00010000,  // transfer done
+	SPI_CS_RXD      = 0x00020000,  // RX FIFO contains data
+	SPI_CS_TXD      = 0x00040000   // TX FIFO can accept data
+};
+
+// core clock used if the firmware cannot be asked
+#define SPI_DEFAULT_CORE_CLOCK 250000000
+
+// firmware mailbox property interface
+#define VCIO_DEVICE "/dev/vcio"
+#define VCIO_PROPERTY _IOWR(100, 0, char *)
+#define VCIO_GET_CLOCK_RATE 0x00030002
+#define VCIO_CORE_CLOCK 4
+
+// mode used between SPI_on and SPI_off
+#if EPD_CHIP_VERSION == 1
+#define SPI_ON_MODE SPI_CS_CPOL  // mode 2: clock idles high
+#else
+#define SPI_ON_MODE 0            // mode 0
+#endif
+
+// map page size
+#define MAP_SIZE 4096
+
+// register access, the model only sees the register number
+#if defined(SPI_MAPPED_MODEL)
+static uint32_t model_read(unsigned int reg);
+static void model_write(unsigned int reg, uint32_t value);
+#define REGISTER_READ(registers, reg) ((void)(registers), model_read(reg))
+#define REGISTER_WRITE(registers, reg, value) ((void)(registers), model_write(reg, value))
+#else
+#define REGISTER_READ(registers, reg) ((registers)[reg])
+#define REGISTER_WRITE(registers, reg, value) ((registers)[reg] = (value))
+#endif
+
+
+// spi information
+struct SPI_struct {
+	volatile uint32_t *registers;
+	uint32_t chip_select;          // SPI_CS_CS_MASK bits
+	uint32_t mode;                 // SPI_CS_CPOL and SPI_CS_CPHA bits
+	uint32_t divider;              // SPI_CLK value
+
+	// between SPI_session_begin and SPI_session_end SPI_off keeps the
+	// SPI_on mode instead of switching back and forth every line
+	bool session;
+};
+
+// panels on different threads share SPI0
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+// prototypes
+static void transfer(SPI_type *spi, const uint8_t *buffer, uint8_t *received, size_t length);
+static uint32_t clock_divider(uint32_t bps);
+static uint32_t core_clock(void);
+
+
+// map SPI0, the path selects the chip select
+SPI_type *SPI_create(const char *spi_path, uint32_t bps) {
+
+	const char *device = strrchr(spi_path, '/');
+	device = (NULL == device) ? spi_path : device + 1;
+	unsigned int bus = 0;
+	unsigned int chip = 0;
+	if (2 != sscanf(device, "spidev%u.%u", &bus, &chip) || 0 != bus || chip > 1) {
+		warn("SPI: only /dev/spidev0.0 and /dev/spidev0.1 can be mapped: %s", spi_path);
+		return NULL;
+	}
+
+	// allocate memory
+	SPI_type *spi = malloc(sizeof(SPI_type));
+	if (NULL == spi) {
+		warn("falled to allocate SPI structure");
+		return NULL;
+	}
+
+#if defined(SPI_MAPPED_MODEL)
+	void *m = NULL;
+#else
+	const char *memory_device = "/dev/mem";
+
+	int mem_fd = open(memory_device, O_RDWR | O_SYNC | O_CLOEXEC);
+	if (mem_fd < 0) {
+		free(spi);
+		warn("cannot open: %s", memory_device);
+		return NULL;
+	}
+	void *m = mmap(0, MAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, mem_fd,
+		       bcm_host_get_peripheral_address() + SPI0_REGISTERS);
+	close(mem_fd);
+	if (MAP_FAILED == m) {
+		free(spi);
+		warn("failed to mmap spi");
+		return NULL;
+	}
+#endif
+
+	spi->registers = (volatile uint32_t *)(m);
+	spi->chip_select = chip;
+	spi->mode = 0;
+	spi->divider = clock_divider(bps);
+	spi->session = false;
+
+	return spi;
+}
+
+
+// release the map
+bool SPI_destroy(SPI_type *spi) {
+	if (NULL == spi) {
+		return false;
+	}
+#if !defined(SPI_MAPPED_MODEL)
+	munmap((void *)spi->registers, MAP_SIZE);
+#endif
+	free(spi);
+	return true;
+}
+
+
+// enable SPI, ensures a zero byte was sent (MOSI=0) in SPI_ON_MODE,
+// for COG 1 mode 2 (CPOL only) so the clock stays high
+void SPI_on(SPI_type *spi) {
+	const uint8_t buffer[1] = {0};
+
+	spi->mode = SPI_ON_MODE;
+	SPI_send(spi, buffer, sizeof(buffer));
+}
+
+
+// disable SPI, ensures a zero byte was sent (MOSI=0) in mode 0 so
+// the clock stays low (the SPI_on mode is kept during a session)
+void SPI_off(SPI_type *spi) {
+	const uint8_t buffer[1] = {0};
+
+	if (!spi->session) {
+		spi->mode = 0;
+	}
+	SPI_send(spi, buffer, sizeof(buffer));
+}
+
+
+// send a data block to SPI
+// will only change CS if the SPI_CS bits are set
+void SPI_send(SPI_type *spi, const void *buffer, size_t length) {
+	transfer(spi, buffer, NULL, length);
+}
+
+
+// send a data block to SPI and return last bytes returned by slave
+// will only change CS if the SPI_CS bits are set
+void SPI_read(SPI_type *spi, const void *buffer, void *received, size_t length) {
+	transfer(spi, buffer, received, length);
+}
+
+
+// select the SPI_on mode and keep it until SPI_session_end
+void SPI_session_begin(SPI_type *spi) {
+	spi->mode = SPI_ON_MODE;
+	spi->session = true;
+}
+
+
+// leave the bus as SPI_off would have
+void SPI_session_end(SPI_type *spi) {
+	const uint8_t buffer[1] = {0};
+
+	spi->session = false;
+	if (0 != spi->mode) {
+		spi->mode = 0;
+		SPI_send(spi, buffer, sizeof(buffer));
+	}
+}
+
+
+// each transfer is already sent at once
+void SPI_batch_begin(SPI_type *spi) {
+}
+
+
+void SPI_batch_end(SPI_type *spi) {
+}
+
+
+void SPI_flush(SPI_type *spi) {
+}
+
+
+// nothing is queued, the next transfer uses the new divider
+void SPI_set_speed(SPI_type *spi, uint32_t bps) {
+	spi->divider = clock_divider(bps);
+}
+
+
+// internal functions
+// ==================
+
+// one polled transfer with CS active throughout; the RX FIFO is
+// drained while sending, as the controller stops when it is full
+static void transfer(SPI_type *spi, const uint8_t *buffer, uint8_t *received, size_t length) {
+	volatile uint32_t *registers = spi->registers;
+	uint32_t cs = spi->chip_select | spi->mode;
+
+	pthread_mutex_lock(&lock);
+
+	// barrier: the GPIO writes before this must reach the pins first
+	__sync_synchronize();
+
+	REGISTER_WRITE(registers, SPI_CLK, spi->divider);
+	REGISTER_WRITE(registers, SPI_CS, cs | SPI_CS_CLEAR_TX | SPI_CS_CLEAR_RX);
+	REGISTER_WRITE(registers, SPI_CS, cs | SPI_CS_TA);
+
+	size_t sent = 0;
+	size_t read = 0;
+	while (read < length) {
+		uint32_t status = REGISTER_READ(registers, SPI_CS);
+		if (sent < length && 0 != (status & SPI_CS_TXD)) {
+			REGISTER_WRITE(registers, SPI_FIFO, buffer[sent++]);
+		}
+		if (0 != (status & SPI_CS_RXD)) {
+			uint8_t c = REGISTER_READ(registers, SPI_FIFO);
+			if (NULL != received) {
+				received[read] = c;
+			}
+			++read;
+		}
+	}
+	while (0 == (REGISTER_READ(registers, SPI_CS) & SPI_CS_DONE)) {
+	}
+
+	// release CS, the clock stays at its idle level for the mode
+	REGISTER_WRITE(registers, SPI_CS, cs);
+
+	__sync_synchronize();
+
+	pthread_mutex_unlock(&lock);
+}
+
+
+// smallest even divider of the core clock not faster than bps
+static uint32_t clock_divider(uint32_t bps) {
+	if (0 == bps) {
+		return 0;  // slowest: core clock / 65536
+	}
+	uint32_t clock = core_clock();
+	uint32_t divider = (clock + bps - 1) / bps;
+	divider += divider & 1;
+	if (divider < 2) {
+		divider = 2;
+	} else if (divider > 65534) {
+		divider = 0;
+	}
+	return divider;
+}
+
+
+// ask the firmware for the core clock that drives SPI0
+static uint32_t core_clock(void) {
+#if defined(SPI_MAPPED_MODEL)
+	return SPI_DEFAULT_CORE_CLOCK;
+#else
+	uint32_t message[] = {
+		8 * sizeof(uint32_t),  // message size
+		0,                     // request
+		VCIO_GET_CLOCK_RATE,   // tag
+		2 * sizeof(uint32_t),  // value buffer size
+		0,                     // request
+		VCIO_CORE_CLOCK,       // clock id
+		0,                     // rate in Hz
+		0                      // end tag
+	};
+
+	int fd = open(VCIO_DEVICE, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return SPI_DEFAULT_CORE_CLOCK;
+	}
+	int rc = ioctl(fd, VCIO_PROPERTY, message);
+	close(fd);
+
+	if (rc < 0 || 0 == message[6]) {
+		return SPI_DEFAULT_CORE_CLOCK;
+	}
+	return message[6];
+#endif
+}
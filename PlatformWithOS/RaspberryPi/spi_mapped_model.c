@@ -0,0 +1,141 @@
+// Copyright 2013-2015 Pervasive Displays, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at:
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+// express or implied.  See the License for the specific language
+// governing permissions and limitations under the License.
+
+// spi_mapped.c against a model of the SPI0 registers, for epd_bench
+//
+// The SPI functions are renamed MODEL_SPI_* so they can be linked next
+// to the bench's null spidev sink.  The model clocks each byte written
+// to the FIFO out at once unless the 64 byte RX FIFO is full (nothing
+// has read it back), in which case it waits in the TX FIFO.  So the
+// driver sees TXD, RXD and DONE change as they would on the SOC, with
+// no time taken on the wire.  The bytes sent are counted and hashed
+// so that they can be compared with what the driver was given.
+
+
+#define SPI_MAPPED_MODEL 1
+
+#define SPI_struct MODEL_SPI_struct
+#define SPI_type MODEL_SPI_type
+#define SPI_create MODEL_SPI_create
+#define SPI_destroy MODEL_SPI_destroy
+#define SPI_set_speed MODEL_SPI_set_speed
+#define SPI_on MODEL_SPI_on
+#define SPI_off MODEL_SPI_off
+#define SPI_send MODEL_SPI_send
+#define SPI_read MODEL_SPI_read
+#define SPI_batch_begin MODEL_SPI_batch_begin
+#define SPI_batch_send MODEL_SPI_batch_send
+#define SPI_batch_end MODEL_SPI_batch_end
+#define SPI_session_begin MODEL_SPI_session_begin
+#define SPI_session_end MODEL_SPI_session_end
+#define SPI_flush MODEL_SPI_flush
+
+#include "spi_mapped.c"
+
+
+// FIFO depth (Manual Chapter 10)
+#define MODEL_FIFO_SIZE 64
+
+// register state
+static uint32_t model_cs;
+static uint32_t model_clk;
+static int model_tx;  // bytes waiting to be sent
+static int model_rx;  // bytes received and not read back
+
+// what went out on MOSI
+static size_t model_bytes;
+static uint32_t model_hash = 2166136261u;
+
+
+// functions
+// =========
+
+// bytes clocked out and their FNV-1a hash since the last call
+void MODEL_SPI_sent(size_t *bytes, uint32_t *hash) {
+	*bytes = model_bytes;
+	*hash = model_hash;
+	model_bytes = 0;
+	model_hash = 2166136261u;
+}
+
+
+// private functions
+// =================
+
+static uint32_t model_read(unsigned int reg) {
+	switch (reg) {
+	case SPI_CS: {
+		uint32_t status = model_cs;
+		if (model_tx < MODEL_FIFO_SIZE) {
+			status |= SPI_CS_TXD;
+		}
+		if (model_rx > 0) {
+			status |= SPI_CS_RXD;
+		}
+		if (0 == model_tx) {
+			status |= SPI_CS_DONE;
+		}
+		return status;
+	}
+
+	case SPI_FIFO:
+		if (model_rx > 0) {
+			--model_rx;
+			// room to clock a waiting byte
+			if (model_tx > 0) {
+				--model_tx;
+				++model_rx;
+			}
+		}
+		return 0;  // MISO is not connected
+
+	case SPI_CLK:
+		return model_clk;
+
+	default:
+		return 0;
+	}
+}
+
+
+static void model_write(unsigned int reg, uint32_t value) {
+	switch (reg) {
+	case SPI_CS:
+		if (0 != (value & SPI_CS_CLEAR_TX)) {
+			model_tx = 0;
+		}
+		if (0 != (value & SPI_CS_CLEAR_RX)) {
+			model_rx = 0;
+		}
+		model_cs = value & ~(SPI_CS_CLEAR_TX | SPI_CS_CLEAR_RX);
+		break;
+
+	case SPI_FIFO:
+		model_hash = (model_hash ^ (value & 0xff)) * 16777619u;
+		++model_bytes;
+		if (model_rx < MODEL_FIFO_SIZE) {
+			++model_rx;
+		} else {
+			++model_tx;
+		}
+		break;
+
+	case SPI_CLK:
+		model_clk = value;
+		break;
+
+	default:
+		break;
+	}
+}
@@ -0,0 +1,30 @@
+// Copyright 2013-2015 Pervasive Displays, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at:
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+// express or implied.  See the License for the specific language
+// governing permissions and limitations under the License.
+
+#if !defined(EPD_IO_H)
+#define EPD_IO_H 1
+
+#define panel_on_pin  GPIO_SIM_23
+#define border_pin    GPIO_SIM_14
+#define discharge_pin GPIO_SIM_15
+#define pwm_pin       GPIO_SIM_18
+#define reset_pin     GPIO_SIM_24
+#define busy_pin      GPIO_SIM_25
+
+// the simulated SPI device is the file the panel image is written
+// to (PBM) each time the COG is powered off
+#define SPI_DEVICE    "/tmp/epd_sim.pbm"
+#define SPI_BPS       8000000
+
+#endif
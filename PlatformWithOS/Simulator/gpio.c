@@ -0,0 +1,167 @@
+// Copyright 2013-2015 Pervasive Displays, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at:
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+// express or implied.  See the License for the specific language
+// governing permissions and limitations under the License.
+
+// software GPIO for running the drivers without any hardware
+//
+// Output pins simply hold the last value written.  The only input a
+// driver uses is BUSY, which the COG raises while it comes out of
+// reset; this is modelled by every input pin reading 1 for
+// GPIO_SIM_BUSY_US after any output pin goes from 0 to 1 (the last
+// such edge before the wait is always RESET).
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <err.h>
+
+#include "gpio.h"
+
+
+// pin state
+static struct {
+	GPIO_mode_type mode;
+	int value;
+} pins[GPIO_SIM_PINS];
+
+// inputs read busy until this CLOCK_MONOTONIC time
+static uint64_t busy_until_ns;
+
+// panels on different threads share the pins
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+// local function prototypes
+static uint64_t now_ns(void);
+static void sleep_until(uint64_t deadline);
+
+
+// set up all pins as low inputs
+bool GPIO_setup() {
+	pthread_mutex_lock(&lock);
+	memset(pins, 0, sizeof(pins));
+	busy_until_ns = 0;
+	pthread_mutex_unlock(&lock);
+	return true;
+}
+
+
+// nothing to release
+bool GPIO_teardown() {
+	return true;
+}
+
+
+void GPIO_mode(GPIO_pin_type pin, GPIO_mode_type mode) {
+	if ((unsigned)(pin) >= GPIO_SIM_PINS) {
+		return;
+	}
+	pthread_mutex_lock(&lock);
+	pins[pin].mode = mode;
+	pins[pin].value = 0;
+	pthread_mutex_unlock(&lock);
+}
+
+
+int GPIO_read(GPIO_pin_type pin) {
+	if ((unsigned)(pin) >= GPIO_SIM_PINS) {
+		return 0;
+	}
+	pthread_mutex_lock(&lock);
+	int value = pins[pin].value;
+	if (GPIO_INPUT == pins[pin].mode) {
+		value = now_ns() < busy_until_ns;
+	}
+	pthread_mutex_unlock(&lock);
+	return value;
+}
+
+
+void GPIO_write(GPIO_pin_type pin, int value) {
+	if ((unsigned)(pin) >= GPIO_SIM_PINS) {
+		return;
+	}
+	value = (0 != value);
+	pthread_mutex_lock(&lock);
+	if (GPIO_OUTPUT == pins[pin].mode) {
+		if (1 == value && 0 == pins[pin].value) {
+			busy_until_ns = now_ns() + GPIO_SIM_BUSY_US * 1000ull;
+		}
+		pins[pin].value = value;
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+
+void GPIO_write_pins(const GPIO_pin_value *pins, size_t count) {
+	for (size_t i = 0; i < count; ++i) {
+		GPIO_write(pins[i].pin, pins[i].value);
+	}
+}
+
+// no event to wait for, the only change of an input is the end of
+// the busy time, so sleep until then
+bool GPIO_wait_edge(GPIO_pin_type pin, int level, int timeout_ms) {
+	if ((unsigned)(pin) >= GPIO_SIM_PINS) {
+		return false;
+	}
+	level = (0 != level);
+	if (level == GPIO_read(pin)) {
+		return true;
+	}
+
+	pthread_mutex_lock(&lock);
+	uint64_t change = busy_until_ns;
+	bool changes = GPIO_INPUT == pins[pin].mode && 0 == level;
+	pthread_mutex_unlock(&lock);
+
+	uint64_t deadline = now_ns() + (uint64_t)(timeout_ms > 0 ? timeout_ms : 0) * 1000000;
+	if (timeout_ms >= 0 && (!changes || change > deadline)) {
+		sleep_until(deadline);
+		return false;
+	}
+	if (!changes) {
+		warn("GPIO_wait_edge: pin %d never reads %d", pin, level);
+		return false;
+	}
+	sleep_until(change);
+	return true;
+}
+
+
+void GPIO_pwm_write(GPIO_pin_type pin, uint32_t value) {
+}
+
+
+// private functions
+// =================
+
+// monotonic time in nanoseconds
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+
+static void sleep_until(uint64_t deadline) {
+	struct timespec ts;
+	ts.tv_sec = deadline / 1000000000u;
+	ts.tv_nsec = deadline % 1000000000u;
+	while (EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)) {
+	}
+}
@@ -0,0 +1,95 @@
+// Copyright 2013-2015 Pervasive Displays, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at:
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+// express or implied.  See the License for the specific language
+// governing permissions and limitations under the License.
+
+#if !defined(GPIO_H)
+#define GPIO_H 1
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// pin types
+// the simulator has no connector, pins are just numbers; these
+// follow the Raspberry Pi BCM numbers so --pins values carry over
+typedef enum {
+	GPIO_SIM_07 =  7,
+	GPIO_SIM_08 =  8,
+	GPIO_SIM_14 = 14,
+	GPIO_SIM_15 = 15,
+	GPIO_SIM_17 = 17,
+	GPIO_SIM_18 = 18,
+	GPIO_SIM_22 = 22,
+	GPIO_SIM_23 = 23,
+	GPIO_SIM_24 = 24,
+	GPIO_SIM_25 = 25,
+	GPIO_SIM_27 = 27,
+
+	GPIO_SIM_PINS = 64   // pins 0..63 are accepted
+} GPIO_pin_type;
+
+
+// GPIO modes
+typedef enum {
+	GPIO_INPUT,   // as input
+	GPIO_OUTPUT,  // as output
+	GPIO_PWM      // as PWM output (any pin)
+} GPIO_mode_type;
+
+// timeout for GPIO_wait_edge
+#define GPIO_WAIT_FOREVER (-1)
+
+// a pin and the value to write to it, for GPIO_write_pins
+typedef struct {
+	GPIO_pin_type pin;
+	int value;
+} GPIO_pin_value;
+
+// how long an input pin reads 1 after a rising output pin, this
+// stands in for the COG holding BUSY while it comes out of reset
+#define GPIO_SIM_BUSY_US 10000
+
+
+// functions
+// =========
+
+// set all pins to low inputs
+// return false if failure
+bool GPIO_setup();
+
+// nothing to release
+bool GPIO_teardown();
+
+// set a mode for a given GPIO pin
+void GPIO_mode(GPIO_pin_type pin, GPIO_mode_type mode);
+
+// return a value (0/1) for a given pin, input pins read 1 for
+// GPIO_SIM_BUSY_US after any output pin is set high and 0 otherwise
+int GPIO_read(GPIO_pin_type pin);
+
+// set or clear a given output pin
+void GPIO_write(GPIO_pin_type pin, int value);
+
+// set or clear several output pins in list order
+void GPIO_write_pins(const GPIO_pin_value *pins, size_t count);
+
+// block until an input pin reads level (0/1) or timeout_ms
+// milliseconds pass (GPIO_WAIT_FOREVER => no timeout)
+// return false on timeout
+bool GPIO_wait_edge(GPIO_pin_type pin, int level, int timeout_ms);
+
+// PWM is not simulated, the value is ignored
+void GPIO_pwm_write(GPIO_pin_type pin, uint32_t value);
+
+
+#endif
@@ -0,0 +1,430 @@
+// Copyright 2013-2015 Pervasive Displays, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at:
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+// express or implied.  See the License for the specific language
+// governing permissions and limitations under the License.
+
+// software SPI with a model of the chip on glass (COG) behind it
+//
+// Every SPI_send is one chip select frame and the first byte says
+// what follows:
+//   0x70 index      select a COG register
+//   0x72 data...    write the selected register
+//   0x71 0x00       read the COG ID
+//   0x73 0x00       read the selected register
+//
+// The channel select (register 0x01) identifies the panel size and
+// each write of register 0x0a (a line: border, scan and pixel bytes)
+// is decoded into the panel pixels.  The pixels are written to the
+// "device" path as a PBM image each time the charge pumps are turned
+// off (end of an update) and when the SPI is destroyed.
+//
+// Reads above SIMULATED_MAX_BPS return 0xff, as a real bus does when
+// the clock is too fast, so the SPI speed calibration has a limit.
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+
+#include "spi.h"
+#include "epd.h"
+
+
+// COG registers and values the model reacts to
+enum {
+	COG_CHANNEL_SELECT = 0x01,
+	COG_CHARGE_PUMP = 0x05,
+	COG_LINE_DATA = 0x0a,
+	COG_STATUS = 0x0f,
+
+	COG_ID = 0x12,                 // G2 COG; the G1 driver never reads it
+	COG_STATUS_NOT_BROKEN = 0x80,
+	COG_STATUS_DC_OK = 0x40,
+	COG_CHARGE_PUMP_ALL_ON = 0x0f,
+	COG_CHARGE_PUMP_OFF = 0x00
+};
+
+// order of the pixel and scan bytes in a line
+typedef enum {
+	LAYOUT_G1,           // even pixels (reversed), scan, odd pixels
+	LAYOUT_G2,           // odd pixels (reversed), scan (reversed), even pixels
+	LAYOUT_INTERLEAVED   // odd lines scan, all pixels (reversed), even lines scan (reversed)
+} layout_type;
+
+// panel sizes as told by the channel select
+typedef struct {
+	uint8_t channel_select[8];
+	int lines;
+	int dots;
+	int leading;         // bytes before the pixel and scan bytes
+	layout_type layout;
+} geometry_type;
+
+static const geometry_type geometries[] = {
+#if EPD_CHIP_VERSION == 1
+	{{0x00, 0x00, 0x00, 0x00, 0x00, 0x0f, 0xff, 0x00},  96, 128, 1, LAYOUT_G1},  // 1.44"
+	{{0x00, 0x00, 0x00, 0x00, 0x01, 0xff, 0xe0, 0x00},  96, 200, 0, LAYOUT_G1},  // 2.0"
+	{{0x00, 0x00, 0x00, 0x7f, 0xff, 0xfe, 0x00, 0x00}, 176, 264, 0, LAYOUT_G1},  // 2.7"
+#elif EPD_FILM_VERSION == 230
+	{{0x00, 0x00, 0x00, 0x00, 0x00, 0x0f, 0xff, 0x00},  96, 128, 1, LAYOUT_G2},  // 1.44"
+	{{0x00, 0x00, 0x00, 0x00, 0x01, 0xff, 0xe0, 0x00},  96, 200, 1, LAYOUT_G2},  // 2.0"
+	{{0x00, 0x00, 0x00, 0x7f, 0xff, 0xfe, 0x00, 0x00}, 176, 264, 1, LAYOUT_G2},  // 2.7"
+#else
+	{{0x00, 0x00, 0x00, 0x00, 0x00, 0x0f, 0xff, 0x00},  96, 128, 0, LAYOUT_G2},  // 1.44"
+	{{0x00, 0x00, 0x00, 0x03, 0xfc, 0x00, 0x00, 0xff}, 128, 144, 0, LAYOUT_INTERLEAVED},  // 1.9"
+	{{0x00, 0x00, 0x00, 0x00, 0x01, 0xff, 0xe0, 0x00},  96, 200, 1, LAYOUT_G2},  // 2.0"
+	{{0x00, 0x00, 0x1f, 0xe0, 0x00, 0x00, 0x00, 0xff}, 128, 232, 0, LAYOUT_INTERLEAVED},  // 2.6"
+	{{0x00, 0x00, 0x00, 0x7f, 0xff, 0xfe, 0x00, 0x00}, 176, 264, 1, LAYOUT_G2},  // 2.7"
+#endif
+};
+
+#define SIZE_OF_ARRAY(a) (sizeof(a) / sizeof((a)[0]))
+
+// fastest clock at which reads are answered correctly
+#define SIMULATED_MAX_BPS 16000000
+
+
+// spi information
+struct SPI_struct {
+	char *path;                    // PBM file for the panel image
+	uint32_t bps;
+
+	uint8_t index;                 // register selected by 0x70
+	uint8_t registers[256];        // first byte last written to each register
+
+	const geometry_type *geometry; // NULL => no channel select yet
+	uint8_t *pixels;               // lines * dots, 1 => black
+	uint8_t border;                // last border byte
+	unsigned long lines;           // lines decoded
+};
+
+
+// local function prototypes
+static uint8_t transfer(SPI_type *spi, const uint8_t *buffer, size_t length);
+static void set_geometry(SPI_type *spi, const uint8_t *channel_select, size_t length);
+static void decode_line(SPI_type *spi, const uint8_t *buffer, size_t length);
+static void decode_pixels(SPI_type *spi, int line, const uint8_t *data);
+static void set_pixel(SPI_type *spi, int line, int x, int code);
+static void write_image(SPI_type *spi);
+
+
+// functions
+// =========
+
+// the path names the PBM file to write, nothing is opened
+SPI_type *SPI_create(const char *spi_path, uint32_t bps) {
+	SPI_type *spi = malloc(sizeof(SPI_type));
+	if (NULL == spi) {
+		warn("cannot allocate SPI structure");
+		return NULL;
+	}
+	memset(spi, 0, sizeof(*spi));
+
+	spi->path = strdup(spi_path);
+	if (NULL == spi->path) {
+		warn("cannot allocate SPI path");
+		free(spi);
+		return NULL;
+	}
+	spi->bps = bps;
+	return spi;
+}
+
+
+// write the final image and release
+bool SPI_destroy(SPI_type *spi) {
+	if (NULL == spi) {
+		return false;
+	}
+	write_image(spi);
+	free(spi->pixels);
+	free(spi->path);
+	free(spi);
+	return true;
+}
+
+
+// the bus level and mode are not simulated
+void SPI_on(SPI_type *spi) {
+}
+
+
+void SPI_off(SPI_type *spi) {
+}
+
+
+void SPI_send(SPI_type *spi, const void *buffer, size_t length) {
+	transfer(spi, buffer, length);
+}
+
+
+void SPI_read(SPI_type *spi, const void *buffer, void *received, size_t length) {
+	if (0 == length) {
+		return;
+	}
+	memset(received, 0, length);
+	uint8_t c = transfer(spi, buffer, length);
+	((uint8_t *)received)[length - 1] = (spi->bps > SIMULATED_MAX_BPS) ? 0xff : c;
+}
+
+
+// every transfer is handled at once, so there is nothing to hold or
+// collect
+void SPI_session_begin(SPI_type *spi) {
+}
+
+
+void SPI_session_end(SPI_type *spi) {
+}
+
+
+void SPI_batch_begin(SPI_type *spi) {
+}
+
+
+void SPI_batch_end(SPI_type *spi) {
+}
+
+
+void SPI_flush(SPI_type *spi) {
+}
+
+
+void SPI_set_speed(SPI_type *spi, uint32_t bps) {
+	spi->bps = bps;
+}
+
+
+// private functions
+// =================
+
+// one chip select frame, returns the byte the COG sends back last
+static uint8_t transfer(SPI_type *spi, const uint8_t *buffer, size_t length) {
+	if (length < 2) {
+		return 0;  // the zero byte of SPI_on/SPI_off
+	}
+
+	switch (buffer[0]) {
+	case 0x70:
+		spi->index = buffer[1];
+		break;
+
+	case 0x71:
+		return COG_ID;
+
+	case 0x72:
+		spi->registers[spi->index] = buffer[1];
+		switch (spi->index) {
+		case COG_CHANNEL_SELECT:
+			set_geometry(spi, &buffer[1], length - 1);
+			break;
+		case COG_LINE_DATA:
+			decode_line(spi, &buffer[1], length - 1);
+			break;
+		case COG_CHARGE_PUMP:
+			if (COG_CHARGE_PUMP_OFF == buffer[1]) {
+				write_image(spi);
+			}
+			break;
+		}
+		break;
+
+	case 0x73:
+		if (COG_STATUS == spi->index) {
+			return COG_STATUS_NOT_BROKEN
+				| (COG_CHARGE_PUMP_ALL_ON == spi->registers[COG_CHARGE_PUMP] ? COG_STATUS_DC_OK : 0);
+		}
+		return spi->registers[spi->index];
+
+	default:
+		warn("SPI: unknown COG command 0x%02x", buffer[0]);
+		break;
+	}
+	return 0;
+}
+
+
+// find the panel from its channel select, keeping the pixels if
+// it is the same one
+static void set_geometry(SPI_type *spi, const uint8_t *channel_select, size_t length) {
+	for (size_t i = 0; i < SIZE_OF_ARRAY(geometries); ++i) {
+		const geometry_type *g = &geometries[i];
+		if (length != sizeof(g->channel_select) || 0 != memcmp(channel_select, g->channel_select, length)) {
+			continue;
+		}
+		if (g == spi->geometry) {
+			return;
+		}
+		uint8_t *pixels = calloc(g->lines, g->dots);
+		if (NULL == pixels) {
+			warn("cannot allocate simulated panel");
+			return;
+		}
+		free(spi->pixels);
+		spi->pixels = pixels;
+		spi->geometry = g;
+		return;
+	}
+	warn("SPI: unknown channel select");
+}
+
+
+// find the selected line from the scan bytes and decode its pixels
+static void decode_line(SPI_type *spi, const uint8_t *buffer, size_t length) {
+	const geometry_type *g = spi->geometry;
+	if (NULL == g) {
+		return;
+	}
+	int bytes_per_line = g->dots / 8;
+	int bytes_per_scan = g->lines / 4;
+	size_t used = g->leading + 2 * bytes_per_line + bytes_per_scan;
+	if (length < used) {
+		warn("SPI: short line %zu < %zu bytes", length, used);
+		return;
+	}
+
+	// the border byte follows the line when there is one, otherwise
+	// it is the leading byte
+	if (length > used) {
+		spi->border = buffer[length - 1];
+	} else if (g->leading > 0) {
+		spi->border = buffer[0];
+	}
+
+	const uint8_t *p = buffer + g->leading;
+	for (int k = 0; k < bytes_per_scan; ++k) {
+		uint8_t scan = 0;
+		switch (g->layout) {
+		case LAYOUT_G1:
+		case LAYOUT_G2:
+			scan = p[bytes_per_line + k];
+			break;
+		case LAYOUT_INTERLEAVED:
+			scan = (k < bytes_per_scan / 2) ? p[k] : p[2 * bytes_per_line + k];
+			break;
+		}
+		for (int j = 0; j < 4; ++j) {
+			if (0x03 != ((scan >> (2 * j)) & 0x03)) {
+				continue;
+			}
+			int line = 0;
+			switch (g->layout) {
+			case LAYOUT_G1:
+				line = 4 * k + 3 - j;
+				break;
+			case LAYOUT_G2:
+				line = 4 * (bytes_per_scan - 1 - k) + j;
+				break;
+			case LAYOUT_INTERLEAVED:
+				if (k < bytes_per_scan / 2) {
+					line = 8 * k + 2 * (3 - j) + 1;
+				} else {
+					line = 8 * (bytes_per_scan - 1 - k) + 2 * j;
+				}
+				break;
+			}
+			if (line < g->lines) {
+				decode_pixels(spi, line, p);
+				++spi->lines;
+			}
+		}
+	}
+}
+
+
+// pixel codes are two bits: 11 => black, 10 => white, 0x => no change
+static void decode_pixels(SPI_type *spi, int line, const uint8_t *data) {
+	const geometry_type *g = spi->geometry;
+	int bytes_per_line = g->dots / 8;
+	int bytes_per_scan = g->lines / 4;
+
+	switch (g->layout) {
+	case LAYOUT_G1:
+		for (int k = 0; k < bytes_per_line; ++k) {
+			int even_byte = bytes_per_line - 1 - k;
+			uint8_t even = data[k];
+			uint8_t odd = data[bytes_per_line + bytes_per_scan + k];
+			for (int j = 0; j < 4; ++j) {
+				set_pixel(spi, line, 8 * even_byte + 2 * j + 1, even >> (2 * j));
+				set_pixel(spi, line, 8 * k + 6 - 2 * j, odd >> (2 * j));
+			}
+		}
+		break;
+
+	case LAYOUT_G2:
+		for (int k = 0; k < bytes_per_line; ++k) {
+			int odd_byte = bytes_per_line - 1 - k;
+			uint8_t odd = data[k];
+			uint8_t even = data[bytes_per_line + bytes_per_scan + k];
+			for (int j = 0; j < 4; ++j) {
+				set_pixel(spi, line, 8 * odd_byte + 2 * j, odd >> (2 * j));
+				set_pixel(spi, line, 8 * k + 7 - 2 * j, even >> (2 * j));
+			}
+		}
+		break;
+
+	case LAYOUT_INTERLEAVED:
+		data += bytes_per_scan / 2;
+		for (int k = 0; k < bytes_per_line; ++k) {
+			int b = bytes_per_line - 1 - k;
+			uint16_t pixels = (data[2 * k] << 8) | data[2 * k + 1];
+			for (int i = 0; i < 8; ++i) {
+				set_pixel(spi, line, 8 * b + i, pixels >> (2 * i));
+			}
+		}
+		break;
+	}
+}
+
+
+static void set_pixel(SPI_type *spi, int line, int x, int code) {
+	if (0 != (code & 0x02)) {
+		spi->pixels[line * spi->geometry->dots + x] = code & 0x01;
+	}
+}
+
+
+// write the pixels as a binary PBM, replacing the file in one step
+static void write_image(SPI_type *spi) {
+	const geometry_type *g = spi->geometry;
+	if (NULL == g) {
+		return;
+	}
+
+	size_t length = strlen(spi->path);
+	char temp[length + sizeof(".tmp")];
+	strcpy(temp, spi->path);
+	strcat(temp, ".tmp");
+
+	FILE *f = fopen(temp, "w");
+	if (NULL == f) {
+		warn("cannot create: %s", temp);
+		return;
+	}
+	fprintf(f, "P4\n# border 0x%02x lines %lu\n%d %d\n", spi->border, spi->lines, g->dots, g->lines);
+	for (int line = 0; line < g->lines; ++line) {
+		const uint8_t *p = &spi->pixels[line * g->dots];
+		for (int b = 0; b < g->dots / 8; ++b) {
+			uint8_t byte = 0;
+			for (int i = 0; i < 8; ++i) {
+				byte = (byte << 1) | *p++;
+			}
+			fputc(byte, f);
+		}
+	}
+	if (0 != fclose(f) || 0 != rename(temp, spi->path)) {
+		warn("cannot write: %s", spi->path);
+	}
+}
@@ -17,6 +17,7 @@ from PIL import Image
 from PIL import ImageOps
 import re
 import os
+import select
 
 
 class EPDError(Exception):
@@ -123,6 +124,17 @@ to use:
 
     def display(self, image):
 
+        # newer drivers dither grayscale themselves, much faster than PIL
+        gray_path = os.path.join(self._epd_path, 'display_gray')
+        if image.mode != "1" and os.path.exists(gray_path):
+            if image.size != self.size:
+                raise EPDError('image size mismatch')
+            with open(gray_path, 'wb') as f:
+                f.write(ImageOps.grayscale(image).tobytes())
+            if self.auto:
+                self.update()
+            return
+
         # attempt grayscale conversion, and then to single bit.
         # better to do this before calling this if the image is to
         # be displayed several times
@@ -152,5 +164,25 @@ to use:
         self._command('C')
 
     def _command(self, c):
-        with open(os.path.join(self._epd_path, 'command'), 'wb') as f:
-            f.write(c)
+        status_path = os.path.join(self._epd_path, 'status')
+        if not os.path.exists(status_path):
+            # older driver: writing the command waits for it to finish
+            with open(os.path.join(self._epd_path, 'command'), 'wb') as f:
+                f.write(c)
+            return
+
+        # the driver queues the command and returns at once, so wait
+        # for the status file to report that it has completed
+        with open(status_path, 'rb', 0) as status:
+            with open(os.path.join(self._epd_path, 'command'), 'wb') as f:
+                f.write(c)
+            with open(os.path.join(self._epd_path, 'sequence'), 'rb') as f:
+                queued = int(f.readline().split()[0])
+            poller = select.poll()
+            poller.register(status, select.POLLIN)
+            while True:
+                status.seek(0)
+                completed = int(status.read().split()[1])
+                if completed >= queued:
+                    break
+                poller.poll()
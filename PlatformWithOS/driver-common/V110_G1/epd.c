@@ -18,12 +18,12 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <err.h>
-#include <time.h>
-#include <signal.h>
 
 #include "gpio.h"
 #include "spi.h"
+#include "stage_timer.h"
 #include "epd.h"
 
 // delays - more consistent naming
@@ -39,6 +39,11 @@
 #define ARRAY(type, ...) ((type[]){__VA_ARGS__})
 #define CU8(...) (ARRAY(const uint8_t, __VA_ARGS__))
 
+// change several pins together: digitalWritePins({pin, value}, ...)
+#define PIN_VALUES(...) (ARRAY(const GPIO_pin_value, __VA_ARGS__))
+#define digitalWritePins(...) GPIO_write_pins(PIN_VALUES(__VA_ARGS__), \
+					      sizeof(PIN_VALUES(__VA_ARGS__)) / sizeof(GPIO_pin_value))
+
 
 // types
 typedef enum {           // Image pixel -> Display pixel
@@ -49,16 +54,28 @@ typedef enum {           // Image pixel -> Display pixel
 } EPD_stage;
 
 
+// names for EPD_stage_name
+static const char *stage_names[EPD_STAGE_COUNT] = {
+	[EPD_compensate] = "compensate",
+	[EPD_white] = "white",
+	[EPD_inverse] = "inverse",
+	[EPD_normal] = "normal",
+};
+
 // function prototypes
 static void power_off(EPD_type *epd);
 static void PWM_start(int pin);
 static void PWM_stop(int pin);
 static int temperature_to_factor_10x(int temperature);
-static void frame_fixed(EPD_type *epd, uint8_t fixed_value, EPD_stage stage);
-static void frame_data(EPD_type *epd, const uint8_t *image, const uint8_t *mask, EPD_stage stage);
+static int frame_fixed(EPD_type *epd, uint8_t fixed_value, EPD_stage stage);
+static int frame_data(EPD_type *epd, const uint8_t *image, const uint8_t *mask, EPD_stage stage);
+static void frame_send(void *context, int lines);
+static void frame_repeat(EPD_type *epd, int lines, EPD_stage stage);
 static void frame_fixed_repeat(EPD_type *epd, uint8_t fixed_value, EPD_stage stage);
 static void frame_data_repeat(EPD_type *epd, const uint8_t *image, const uint8_t *mask, EPD_stage stage);
 static void line(EPD_type *epd, uint16_t line, const uint8_t *data, uint8_t fixed_value, const uint8_t *mask, EPD_stage stage);
+static size_t encode_line(EPD_type *epd, uint8_t *buffer, uint16_t line, const uint8_t *data, uint8_t fixed_value, const uint8_t *mask, EPD_stage stage);
+static void send_line(EPD_type *epd, const uint8_t *buffer, size_t length);
 
 // panel configuration
 struct EPD_struct {
@@ -88,7 +105,11 @@ struct EPD_struct {
 	uint8_t *line_buffer;
 	size_t line_buffer_size;
 
-	timer_t timer;
+	uint8_t *frame_buffer;         // one stage encoded, line_buffer_size per line
+	size_t frame_line_length;      // bytes used in each line of frame_buffer
+
+	STAGE_type stage_timer;
+	STAGE_statistics statistics[EPD_STAGE_COUNT];  // indexed by EPD_stage
 	SPI_type *spi;
 };
 
@@ -102,16 +123,6 @@ EPD_type *EPD_create(EPD_size size,
 		     int busy_pin,
 		     SPI_type *spi) {
 
-	// create a polled timer
-	timer_t timer;
-	struct sigevent event;
-	event.sigev_notify = SIGEV_NONE;
-
-	if (-1 == timer_create(CLOCK_REALTIME, &event, &timer)) {
-		warn("falled to create timer");
-		return NULL;
-	}
-
 	// allocate memory
 	EPD_type *epd = malloc(sizeof(EPD_type));
 	if (NULL == epd) {
@@ -120,7 +131,8 @@ EPD_type *EPD_create(EPD_size size,
 	}
 
 	epd->spi = spi;
-	epd->timer = timer;
+	STAGE_init(&epd->stage_timer, STAGE_FINISH_NEAREST);
+	memset(epd->statistics, 0, sizeof(epd->statistics));
 
 	epd->EPD_Pin_PANEL_ON = panel_on_pin;
 	epd->EPD_Pin_BORDER = border_pin;
@@ -199,6 +211,16 @@ EPD_type *EPD_create(EPD_size size,
 		return NULL;
 	}
 
+	// buffer for a whole encoded stage
+	epd->frame_buffer = malloc(epd->line_buffer_size * epd->lines_per_display);
+	if (NULL == epd->frame_buffer) {
+		free(epd->line_buffer);
+		free(epd);
+		warn("falled to allocate EPD frame buffer");
+		return NULL;
+	}
+	epd->frame_line_length = 0;
+
 	// ensure I/O is all set to ZERO
 	power_off(epd);
 
@@ -214,6 +236,9 @@ void EPD_destroy(EPD_type *epd) {
 	if (NULL != epd->line_buffer) {
 		free(epd->line_buffer);
 	}
+	if (NULL != epd->frame_buffer) {
+		free(epd->frame_buffer);
+	}
 	free(epd);
 }
 
@@ -230,10 +255,10 @@ void EPD_begin(EPD_type *epd) {
 	epd->status = EPD_OK;
 
 	// power up sequence
-	digitalWrite(epd->EPD_Pin_RESET, LOW);
-	digitalWrite(epd->EPD_Pin_PANEL_ON, LOW);
-	digitalWrite(epd->EPD_Pin_DISCHARGE, LOW);
-	digitalWrite(epd->EPD_Pin_BORDER, LOW);
+	digitalWritePins({epd->EPD_Pin_RESET, LOW},
+			 {epd->EPD_Pin_PANEL_ON, LOW},
+			 {epd->EPD_Pin_DISCHARGE, LOW},
+			 {epd->EPD_Pin_BORDER, LOW});
 
 	SPI_on(epd->spi);
 
@@ -242,8 +267,8 @@ void EPD_begin(EPD_type *epd) {
 	digitalWrite(epd->EPD_Pin_PANEL_ON, HIGH);
 	Delay_ms(10);
 
-	digitalWrite(epd->EPD_Pin_RESET, HIGH);
-	digitalWrite(epd->EPD_Pin_BORDER, HIGH);
+	digitalWritePins({epd->EPD_Pin_RESET, HIGH},
+			 {epd->EPD_Pin_BORDER, HIGH});
 	Delay_ms(5);
 
 	digitalWrite(epd->EPD_Pin_RESET, LOW);
@@ -253,9 +278,7 @@ void EPD_begin(EPD_type *epd) {
 	Delay_ms(5);
 
 	// wait for COG to become ready
-	while (HIGH == digitalRead(epd->EPD_Pin_BUSY)) {
-		Delay_us(10);
-	}
+	GPIO_wait_edge(epd->EPD_Pin_BUSY, LOW, GPIO_WAIT_FOREVER);
 
 	// channel select
 	Delay_us(10);
@@ -349,7 +372,7 @@ void EPD_begin(EPD_type *epd) {
 void EPD_end(EPD_type *epd) {
 
 	// dummy frame
-	frame_fixed(epd, 0x55, EPD_normal);
+	frame_send(epd, frame_fixed(epd, 0x55, EPD_normal));
 
 	// dummy line and border
 	if (EPD_1_44 == epd->size) {
@@ -445,9 +468,9 @@ void EPD_end(EPD_type *epd) {
 static void power_off(EPD_type *epd) {
 
 	// turn of power and all signals
-	digitalWrite(epd->EPD_Pin_RESET, LOW);
-	digitalWrite(epd->EPD_Pin_PANEL_ON, LOW);
-	digitalWrite(epd->EPD_Pin_BORDER, LOW);
+	digitalWritePins({epd->EPD_Pin_RESET, LOW},
+			 {epd->EPD_Pin_PANEL_ON, LOW},
+			 {epd->EPD_Pin_BORDER, LOW});
 
 	// ensure SPI MOSI and CLOCK are Low before CS Low
 	SPI_off(epd->spi);
@@ -467,6 +490,18 @@ void EPD_set_factored_stage_time(EPD_type *epd, int pu_stagetime) {
         epd->factored_stage_time = pu_stagetime;
 }
 
+void EPD_set_stage_finish(EPD_type *epd, STAGE_finish finish) {
+	epd->stage_timer.finish = finish;
+}
+
+const char *EPD_stage_name(int stage) {
+	return stage_names[stage];
+}
+
+void EPD_stage_statistics(EPD_type *epd, STAGE_statistics statistics[EPD_STAGE_COUNT]) {
+	memcpy(statistics, epd->statistics, sizeof(epd->statistics));
+}
+
 // clear display (anything -> white)
 void EPD_clear(EPD_type *epd) {
 	frame_fixed_repeat(epd, 0xff, EPD_compensate);
@@ -534,83 +569,80 @@ static int temperature_to_factor_10x(int temperature) {
 // the image is arranged by line which matches the display size
 // so smallest would have 96 * 32 bytes
 
-static void frame_fixed(EPD_type *epd, uint8_t fixed_value, EPD_stage stage) {
+// every repeat of a stage sends identical bytes, so the stage is
+// encoded once into frame_buffer and the repeats only send it
+
+// encode all lines with a fixed value, returns number of lines
+static int frame_fixed(EPD_type *epd, uint8_t fixed_value, EPD_stage stage) {
+	uint8_t *p = epd->frame_buffer;
 	for (uint8_t l = 0; l < epd->lines_per_display ; ++l) {
-		line(epd, l, NULL, fixed_value, NULL, stage);
+		epd->frame_line_length = encode_line(epd, p, l, NULL, fixed_value, NULL, stage);
+		p += epd->line_buffer_size;
 	}
+	return epd->lines_per_display;
 }
 
 
-static void frame_data(EPD_type *epd, const uint8_t *image, const uint8_t *mask, EPD_stage stage) {
-	if (NULL == mask) {
-		for (uint8_t l = 0; l < epd->lines_per_display ; ++l) {
-			line(epd, l, &image[l * epd->bytes_per_line], 0, NULL, stage);
-		}
-	} else {
-		for (uint8_t l = 0; l < epd->lines_per_display ; ++l) {
-			size_t n = l * epd->bytes_per_line;
-			line(epd, l, &image[n], 0, &mask[n], stage);
+// encode the image lines, returns number of lines
+// with a mask, lines identical to it have every pixel masked so they
+// are not scanned at all; the comparison is done once here, not per repeat
+static int frame_data(EPD_type *epd, const uint8_t *image, const uint8_t *mask, EPD_stage stage) {
+	uint8_t *p = epd->frame_buffer;
+	int lines = 0;
+	for (uint8_t l = 0; l < epd->lines_per_display ; ++l) {
+		size_t n = l * epd->bytes_per_line;
+		if (NULL != mask && 0 == memcmp(&image[n], &mask[n], epd->bytes_per_line)) {
+			continue;
 		}
+		epd->frame_line_length = encode_line(epd, p, l, &image[n], 0, NULL == mask ? NULL : &mask[n], stage);
+		p += epd->line_buffer_size;
+		++lines;
 	}
+	return lines;
 }
 
 
-static void frame_fixed_repeat(EPD_type *epd, uint8_t fixed_value, EPD_stage stage) {
-	struct itimerspec its;
-	its.it_value.tv_sec = epd->factored_stage_time / 1000;
-	its.it_value.tv_nsec = (epd->factored_stage_time % 1000) * 1000000;
-	its.it_interval.tv_sec = 0;
-	its.it_interval.tv_nsec = 0;
-
-	if (-1 == timer_settime(epd->timer, 0, &its, NULL)) {
-		err(1, "timer_settime failed");
+// send the encoded lines once, holding the SPI mode for the whole frame
+static void frame_send(void *context, int lines) {
+	EPD_type *epd = context;
+	const uint8_t *p = epd->frame_buffer;
+	SPI_session_begin(epd->spi);
+	for (int l = 0; l < lines; ++l) {
+		send_line(epd, p, epd->frame_line_length);
+		p += epd->line_buffer_size;
 	}
-	do {
-		frame_fixed(epd, fixed_value, stage);
+	SPI_session_end(epd->spi);
+}
 
-		if (-1 == timer_gettime(epd->timer, &its)) {
-			err(1, "timer_gettime failed");
-		}
-	} while (its.it_value.tv_sec > 0 || its.it_value.tv_nsec > 0);
+
+// send the encoded lines for the stage time
+static void frame_repeat(EPD_type *epd, int lines, EPD_stage stage) {
+	STAGE_run(&epd->stage_timer, &epd->statistics[stage], epd->factored_stage_time,
+		  lines, frame_send, epd);
+}
+
+
+static void frame_fixed_repeat(EPD_type *epd, uint8_t fixed_value, EPD_stage stage) {
+	frame_repeat(epd, frame_fixed(epd, fixed_value, stage), stage);
 }
 
 
 static void frame_data_repeat(EPD_type *epd, const uint8_t *image, const uint8_t *mask, EPD_stage stage) {
-	struct itimerspec its;
-	its.it_value.tv_sec = epd->factored_stage_time / 1000;
-	its.it_value.tv_nsec = (epd->factored_stage_time % 1000) * 1000000;
-	its.it_interval.tv_sec = 0;
-	its.it_interval.tv_nsec = 0;
-
-	if (-1 == timer_settime(epd->timer, 0, &its, NULL)) {
-		err(1, "timer_settime failed");
-	}
-	do {
-		frame_data(epd, image, mask, stage);
-		if (-1 == timer_gettime(epd->timer, &its)) {
-			err(1, "timer_gettime failed");
-		}
-	} while (its.it_value.tv_sec > 0 || its.it_value.tv_nsec > 0);
+	frame_repeat(epd, frame_data(epd, image, mask, stage), stage);
 }
 
 
+// output one line of scan and data bytes to the display
 static void line(EPD_type *epd, uint16_t line, const uint8_t *data, uint8_t fixed_value, const uint8_t *mask, EPD_stage stage) {
+	size_t length = encode_line(epd, epd->line_buffer, line, data, fixed_value, mask, stage);
+	send_line(epd, epd->line_buffer, length);
+}
 
-	SPI_on(epd->spi);
-
-	// charge pump voltage levels
-	Delay_us(10);
-	SPI_send(epd->spi, CU8(0x70, 0x04), 2);
-	Delay_us(10);
-	SPI_send(epd->spi, epd->gate_source, epd->gate_source_length);
 
-	// send data
-	Delay_us(10);
-	SPI_send(epd->spi, CU8(0x70, 0x0a), 2);
-	Delay_us(10);
+// encode one line of scan and data bytes, returns the number of bytes
+static size_t encode_line(EPD_type *epd, uint8_t *buffer, uint16_t line, const uint8_t *data, uint8_t fixed_value, const uint8_t *mask, EPD_stage stage) {
 
-	// CS low
-	uint8_t *p = epd->line_buffer;
+	uint8_t *p = buffer;
 
 	*p++ = 0x72;
 
@@ -696,8 +728,28 @@ static void line(EPD_type *epd, uint16_t line, const uint8_t *data, uint8_t fixe
 	if (epd->filler) {
 		*p++ = 0x00;
 	}
-	// send the accumulated line buffer
-	SPI_send(epd->spi, epd->line_buffer, p - epd->line_buffer);
+	return p - buffer;
+}
+
+
+// send one encoded line to the display
+static void send_line(EPD_type *epd, const uint8_t *buffer, size_t length) {
+
+	SPI_on(epd->spi);
+
+	// charge pump voltage levels
+	Delay_us(10);
+	SPI_send(epd->spi, CU8(0x70, 0x04), 2);
+	Delay_us(10);
+	SPI_send(epd->spi, epd->gate_source, epd->gate_source_length);
+
+	// send data
+	Delay_us(10);
+	SPI_send(epd->spi, CU8(0x70, 0x0a), 2);
+	Delay_us(10);
+
+	// CS low
+	SPI_send(epd->spi, buffer, length);
 
 	// output data to panel
 	Delay_us(10);
@@ -16,6 +16,7 @@
 #define EPD_H 1
 
 #include "spi.h"
+#include "stage_timer.h"
 
 // compile-time #if configuration
 #define EPD_CHIP_VERSION      1
@@ -24,6 +25,12 @@
 #define EPD_IMAGE_ONE_ARG     0
 #define EPD_IMAGE_TWO_ARG     1
 #define EPD_PARTIAL_AVAILABLE 1
+#define EPD_PARTIAL_LINES_AVAILABLE 0
+#define EPD_PARTIAL_REGION_AVAILABLE 0  // frame_data skips lines but has no column mask
+#define EPD_PROBE_AVAILABLE   0
+
+// stages reported by EPD_stage_statistics
+#define EPD_STAGE_COUNT       4
 
 // display panels supported
 #define EPD_1_44_SUPPORT      1
@@ -69,6 +76,16 @@ void EPD_set_temperature(EPD_type *epd, int temperature);
 // set factored_stage_time directly ('F' command)
 void EPD_set_factored_stage_time(EPD_type *epd, int pu_stagetime);
 
+// how a timed stage uses the time after its last whole frame
+// (default STAGE_FINISH_NEAREST)
+void EPD_set_stage_finish(EPD_type *epd, STAGE_finish finish);
+
+// name of stage 0 .. EPD_STAGE_COUNT - 1
+const char *EPD_stage_name(int stage);
+
+// copy the repeat and overrun counts of every stage
+void EPD_stage_statistics(EPD_type *epd, STAGE_statistics statistics[EPD_STAGE_COUNT]);
+
 // sequence start/end
 void EPD_begin(EPD_type *epd);
 void EPD_end(EPD_type *epd);
@@ -20,11 +20,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <err.h>
-#include <time.h>
-#include <signal.h>
 
 #include "gpio.h"
 #include "spi.h"
+#include "stage_timer.h"
 #include "epd.h"
 
 // delays - more consistent naming
@@ -45,18 +44,46 @@
 #define ARRAY(type, ...) ((type[]){__VA_ARGS__})
 #define CU8(...) (ARRAY(const uint8_t, __VA_ARGS__))
 
+// change several pins together: digitalWritePins({pin, value}, ...)
+#define PIN_VALUES(...) (ARRAY(const GPIO_pin_value, __VA_ARGS__))
+#define digitalWritePins(...) GPIO_write_pins(PIN_VALUES(__VA_ARGS__), \
+					      sizeof(PIN_VALUES(__VA_ARGS__)) / sizeof(GPIO_pin_value))
+
 // types
 typedef enum {           // Image pixel -> Display pixel
 	EPD_inverse,     // B -> W, W -> B (New Image)
 	EPD_normal       // B -> B, W -> W (New Image)
 } EPD_stage;
 
+// index of each stage in the statistics
+enum {
+	STATISTICS_STAGE1,
+	STATISTICS_STAGE2,
+	STATISTICS_STAGE3
+};
+
+// a fixed value frame sent by the stage timer
+typedef struct {
+	EPD_type *epd;
+	uint8_t fixed_value;
+} timed_frame_type;
+
+
+// names for EPD_stage_name
+static const char *stage_names[EPD_STAGE_COUNT] = {
+	"stage1",
+	"stage2",
+	"stage3",
+};
 
 // function prototypes
 
+static void power_on(EPD_type *epd);
 static void power_off(EPD_type *epd);
 
 static void frame_fixed_timed(EPD_type *epd, uint8_t fixed_value, long stage_time);
+static void frame_fixed_send(void *context, int lines);
+static void count_stage(EPD_type *epd, EPD_stage stage, int repeat);
 static void frame_fixed_13(EPD_type *epd, uint8_t value, EPD_stage stage);
 static void frame_data_13(EPD_type *epd, const uint8_t *image, EPD_stage stage);
 static void frame_stage2(EPD_type *epd);
@@ -106,7 +133,8 @@ struct EPD_struct {
 	uint8_t *line_buffer;
 	size_t line_buffer_size;
 
-	timer_t timer;
+	STAGE_type stage_timer;
+	STAGE_statistics statistics[EPD_STAGE_COUNT];
 	SPI_type *spi;
 };
 
@@ -119,16 +147,6 @@ EPD_type *EPD_create(EPD_size size,
 		     int busy_pin,
 		     SPI_type *spi) {
 
-	// create a polled timer
-	timer_t timer;
-	struct sigevent event;
-	event.sigev_notify = SIGEV_NONE;
-
-	if (-1 == timer_create(CLOCK_REALTIME, &event, &timer)) {
-		warn("falled to create timer");
-		return NULL;
-	}
-
 	// allocate memory
 	EPD_type *epd = malloc(sizeof(EPD_type));
 	if (NULL == epd) {
@@ -137,7 +155,8 @@ EPD_type *EPD_create(EPD_size size,
 	}
 
 	epd->spi = spi;
-	epd->timer = timer;
+	STAGE_init(&epd->stage_timer, STAGE_FINISH_NEAREST);
+	memset(epd->statistics, 0, sizeof(epd->statistics));
 
 	epd->EPD_Pin_PANEL_ON = panel_on_pin;
 	epd->EPD_Pin_BORDER = border_pin;
@@ -238,32 +257,7 @@ void EPD_begin(EPD_type *epd) {
 	// assume OK
 	epd->status = EPD_OK;
 
-	// power up sequence
-	digitalWrite(epd->EPD_Pin_RESET, LOW);
-	digitalWrite(epd->EPD_Pin_PANEL_ON, LOW);
-	digitalWrite(epd->EPD_Pin_DISCHARGE, LOW);
-	digitalWrite(epd->EPD_Pin_BORDER, LOW);
-
-	SPI_on(epd->spi);
-
-	Delay_ms(5);
-	digitalWrite(epd->EPD_Pin_PANEL_ON, HIGH);
-	Delay_ms(10);
-
-	digitalWrite(epd->EPD_Pin_RESET, HIGH);
-	digitalWrite(epd->EPD_Pin_BORDER, HIGH);
-	Delay_ms(5);
-
-	digitalWrite(epd->EPD_Pin_RESET, LOW);
-	Delay_ms(5);
-
-	digitalWrite(epd->EPD_Pin_RESET, HIGH);
-	Delay_ms(5);
-
-	// wait for COG to become ready
-	while (HIGH == digitalRead(epd->EPD_Pin_BUSY)) {
-		Delay_us(10);
-	}
+	power_on(epd);
 
 	// read the COG ID
 	uint8_t receive_buffer[2];
@@ -433,12 +427,82 @@ void EPD_end(EPD_type *epd) {
 }
 
 
+// power the COG up only as far as EPD_begin reads it back
+void EPD_probe_begin(EPD_type *epd) {
+
+	// assume OK
+	epd->status = EPD_OK;
+
+	power_on(epd);
+
+	// Disable OE
+	SPI_send(epd->spi, CU8(0x70, 0x02), 2);
+	SPI_send(epd->spi, CU8(0x72, 0x40), 2);
+}
+
+
+// the COG ID and breakage reads of EPD_begin, without changing the
+// status: a wrong answer here may just mean the SPI clock is too fast
+bool EPD_probe(EPD_type *epd) {
+
+	// read the COG ID
+	uint8_t receive_buffer[2];
+	SPI_read(epd->spi, CU8(0x71, 0x00), receive_buffer, sizeof(receive_buffer));
+	SPI_read(epd->spi, CU8(0x71, 0x00), receive_buffer, sizeof(receive_buffer));
+	int cog_id = receive_buffer[1];
+	if (0x02 != (0x0f & cog_id)) {
+		return false;
+	}
+
+	// check breakage
+	SPI_send(epd->spi, CU8(0x70, 0x0f), 2);
+	SPI_read(epd->spi, CU8(0x73, 0x00), receive_buffer, sizeof(receive_buffer));
+	int broken_panel = receive_buffer[1];
+	return 0x00 != (0x80 & broken_panel);
+}
+
+
+void EPD_probe_end(EPD_type *epd) {
+	power_off(epd);
+}
+
+
+// power up the COG and wait until it is ready for commands
+static void power_on(EPD_type *epd) {
+
+	// power up sequence
+	digitalWritePins({epd->EPD_Pin_RESET, LOW},
+			 {epd->EPD_Pin_PANEL_ON, LOW},
+			 {epd->EPD_Pin_DISCHARGE, LOW},
+			 {epd->EPD_Pin_BORDER, LOW});
+
+	SPI_on(epd->spi);
+
+	Delay_ms(5);
+	digitalWrite(epd->EPD_Pin_PANEL_ON, HIGH);
+	Delay_ms(10);
+
+	digitalWritePins({epd->EPD_Pin_RESET, HIGH},
+			 {epd->EPD_Pin_BORDER, HIGH});
+	Delay_ms(5);
+
+	digitalWrite(epd->EPD_Pin_RESET, LOW);
+	Delay_ms(5);
+
+	digitalWrite(epd->EPD_Pin_RESET, HIGH);
+	Delay_ms(5);
+
+	// wait for COG to become ready
+	GPIO_wait_edge(epd->EPD_Pin_BUSY, LOW, GPIO_WAIT_FOREVER);
+}
+
+
 static void power_off(EPD_type *epd) {
 
 	// turn of power and all signals
-	digitalWrite(epd->EPD_Pin_RESET, LOW);
-	digitalWrite(epd->EPD_Pin_PANEL_ON, LOW);
-	digitalWrite(epd->EPD_Pin_BORDER, LOW);
+	digitalWritePins({epd->EPD_Pin_RESET, LOW},
+			 {epd->EPD_Pin_PANEL_ON, LOW},
+			 {epd->EPD_Pin_BORDER, LOW});
 
 	// ensure SPI MOSI and CLOCK are Low before CS Low
 	SPI_off(epd->spi);
@@ -498,6 +562,18 @@ void EPD_set_temperature(EPD_type *epd, int temperature) {
 	}
 }
 
+void EPD_set_stage_finish(EPD_type *epd, STAGE_finish finish) {
+	epd->stage_timer.finish = finish;
+}
+
+const char *EPD_stage_name(int stage) {
+	return stage_names[stage];
+}
+
+void EPD_stage_statistics(EPD_type *epd, STAGE_statistics statistics[EPD_STAGE_COUNT]) {
+	memcpy(statistics, epd->statistics, sizeof(epd->statistics));
+}
+
 // clear display (anything -> white)
 void EPD_clear(EPD_type *epd) {
 	frame_fixed_13(epd, 0xff, EPD_inverse);
@@ -525,25 +601,34 @@ void EPD_image(EPD_type *epd, const uint8_t *image) {
 // so smallest would have 96 * 32 bytes
 
 static void frame_fixed_timed(EPD_type *epd, uint8_t fixed_value, long stage_time) {
-	struct itimerspec its;
-	its.it_value.tv_sec = stage_time / 1000;
-	its.it_value.tv_nsec = (stage_time % 1000) * 1000000;
-	its.it_interval.tv_sec = 0;
-	its.it_interval.tv_nsec = 0;
-
-	if (-1 == timer_settime(epd->timer, 0, &its, NULL)) {
-		err(1, "timer_settime failed");
+	timed_frame_type frame = {
+		.epd = epd,
+		.fixed_value = fixed_value
+	};
+	STAGE_run(&epd->stage_timer, &epd->statistics[STATISTICS_STAGE2], stage_time,
+		  epd->lines_per_display, frame_fixed_send, &frame);
+}
+
+
+// send the first 'lines' lines of a fixed frame, bottom line first
+static void frame_fixed_send(void *context, int lines) {
+	const timed_frame_type *frame = context;
+	EPD_type *epd = frame->epd;
+
+	SPI_batch_begin(epd->spi);
+	for (int line = 0; line < lines; ++line) {
+		one_line(epd, epd->lines_per_display - line - 1, 0, frame->fixed_value, EPD_normal, BORDER_BYTE_NULL);
 	}
+	SPI_batch_end(epd->spi);
+}
 
-	do {
-		for (uint8_t line = 0; line < epd->lines_per_display ; ++line) {
-			one_line(epd, epd->lines_per_display - line - 1, 0, fixed_value, EPD_normal, BORDER_BYTE_NULL);
-		}
 
-		if (-1 == timer_gettime(epd->timer, &its)) {
-			err(1, "timer_gettime failed");
-		}
-	} while ((its.it_value.tv_sec > 0) || (its.it_value.tv_nsec > 0));
+// count a stage repeated a fixed number of times
+static void count_stage(EPD_type *epd, EPD_stage stage, int repeat) {
+	STAGE_statistics *statistics = &epd->statistics[EPD_inverse == stage ? STATISTICS_STAGE1 : STATISTICS_STAGE3];
+	++statistics->runs;
+	statistics->frames += repeat;
+	statistics->last_frames = repeat;
 }
 
 
@@ -564,6 +649,8 @@ static void frame_fixed_13(EPD_type *epd, uint8_t value, EPD_stage stage) {
 
 	int total_lines = epd->lines_per_display;
 
+	count_stage(epd, stage, repeat);
+	SPI_batch_begin(epd->spi);
 	for (int n = 0; n < repeat; ++n) {
 
 		int block_begin = 0;
@@ -593,6 +680,7 @@ static void frame_fixed_13(EPD_type *epd, uint8_t value, EPD_stage stage) {
 			}
 		}
 	}
+	SPI_batch_end(epd->spi);
 }
 
 
@@ -613,6 +701,8 @@ static void frame_data_13(EPD_type *epd, const uint8_t *image, EPD_stage stage)
 
 	int total_lines = epd->lines_per_display;
 
+	count_stage(epd, stage, repeat);
+	SPI_batch_begin(epd->spi);
 	for (int n = 0; n < repeat; ++n) {
 
 		int block_begin = 0;
@@ -642,6 +732,7 @@ static void frame_data_13(EPD_type *epd, const uint8_t *image, EPD_stage stage)
 			}
 		}
 	}
+	SPI_batch_end(epd->spi);
 }
 
 
@@ -654,6 +745,7 @@ static void frame_stage2(EPD_type *epd) {
 
 
 static void nothing_frame(EPD_type *epd) {
+	SPI_batch_begin(epd->spi);
 	for (int line = 0; line < epd->lines_per_display; ++line) {
 
 		// charge pump voltage level reduce voltage shift
@@ -662,6 +754,7 @@ static void nothing_frame(EPD_type *epd) {
 
 		one_line(epd, line, 0, 0x00, EPD_normal, BORDER_BYTE_NULL);
 	}
+	SPI_batch_end(epd->spi);
 }
 
 
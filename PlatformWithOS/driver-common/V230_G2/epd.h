@@ -16,6 +16,7 @@
 #define EPD_H 1
 
 #include "spi.h"
+#include "stage_timer.h"
 
 // compile-time #if configuration
 #define EPD_CHIP_VERSION      2
@@ -24,6 +25,12 @@
 #define EPD_IMAGE_ONE_ARG     1
 #define EPD_IMAGE_TWO_ARG     0
 #define EPD_PARTIAL_AVAILABLE 0
+#define EPD_PARTIAL_LINES_AVAILABLE 0
+#define EPD_PARTIAL_REGION_AVAILABLE 0
+#define EPD_PROBE_AVAILABLE   1
+
+// stages reported by EPD_stage_statistics
+#define EPD_STAGE_COUNT       3
 
 // display panels supported
 #define EPD_1_44_SUPPORT      1
@@ -68,6 +75,16 @@ void EPD_destroy(EPD_type *epd);
 // set the temperature compensation (call before begin)
 void EPD_set_temperature(EPD_type *epd, int temperature);
 
+// how a timed stage uses the time after its last whole frame
+// (default STAGE_FINISH_NEAREST)
+void EPD_set_stage_finish(EPD_type *epd, STAGE_finish finish);
+
+// name of stage 0 .. EPD_STAGE_COUNT - 1
+const char *EPD_stage_name(int stage);
+
+// copy the repeat and overrun counts of every stage
+void EPD_stage_statistics(EPD_type *epd, STAGE_statistics statistics[EPD_STAGE_COUNT]);
+
 // sequence start/end
 void EPD_begin(EPD_type *epd);
 void EPD_end(EPD_type *epd);
@@ -75,6 +92,13 @@ void EPD_end(EPD_type *epd);
 // ok/error status
 EPD_error EPD_status(EPD_type *epd);
 
+// read back the COG ID and breakage status at the current SPI clock,
+// true if both are correct.  Bracketed by probe_begin/probe_end, which
+// only power the COG up enough to answer (use instead of begin/end)
+void EPD_probe_begin(EPD_type *epd);
+bool EPD_probe(EPD_type *epd);
+void EPD_probe_end(EPD_type *epd);
+
 // items below must be bracketed by begin/end
 // ==========================================
 
@@ -20,11 +20,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <err.h>
-#include <time.h>
-#include <signal.h>
 
 #include "gpio.h"
 #include "spi.h"
+#include "stage_timer.h"
 #include "epd.h"
 
 // delays - more consistent naming
@@ -35,6 +34,10 @@
 #define digitalRead(pin) GPIO_read(pin)
 #define digitalWrite(pin, value) GPIO_write(pin, value)
 
+// largest panel (2.7")
+#define MAX_LINES 176
+#define MAX_BYTES_PER_LINE (264 / 8)
+
 // values for border byte
 #define BORDER_BYTE_BLACK 0xff
 #define BORDER_BYTE_WHITE 0xaa
@@ -45,6 +48,11 @@
 #define ARRAY(type, ...) ((type[]){__VA_ARGS__})
 #define CU8(...) (ARRAY(const uint8_t, __VA_ARGS__))
 
+// change several pins together: digitalWritePins({pin, value}, ...)
+#define PIN_VALUES(...) (ARRAY(const GPIO_pin_value, __VA_ARGS__))
+#define digitalWritePins(...) GPIO_write_pins(PIN_VALUES(__VA_ARGS__), \
+					      sizeof(PIN_VALUES(__VA_ARGS__)) / sizeof(GPIO_pin_value))
+
 // types
 typedef enum {           // Image pixel -> Display pixel
 	EPD_compensate,  // B -> W, W -> B (Current Image)
@@ -59,15 +67,28 @@ typedef enum {
 	EPD_BORDER_BYTE_SET,   // border byte needs to be set
 } EPD_border_byte;
 
+// names for EPD_stage_name
+static const char *stage_names[EPD_STAGE_COUNT] = {
+	[EPD_compensate] = "compensate",
+	[EPD_white] = "white",
+	[EPD_inverse] = "inverse",
+	[EPD_normal] = "normal",
+};
+
 // function prototypes
 
+static void power_on(EPD_type *epd);
 static void power_off(EPD_type *epd);
 
 static int temperature_to_factor_10x(int temperature);
-static void frame_fixed(EPD_type *epd, uint8_t fixed_value, EPD_stage stage);
-static void frame_data(EPD_type *epd, const uint8_t *image, const uint8_t *mask, EPD_stage stage);
+static int frame_fixed(EPD_type *epd, uint8_t fixed_value, EPD_stage stage);
+static int frame_data(EPD_type *epd, const uint8_t *image, const uint8_t *mask, const uint8_t *line_map, const uint8_t *column_mask, EPD_stage stage);
+static void frame_send(void *context, int lines);
+static void frame_repeat(EPD_type *epd, int lines, EPD_stage stage);
 static void frame_fixed_repeat(EPD_type *epd, uint8_t fixed_value, EPD_stage stage);
-static void frame_data_repeat(EPD_type *epd, const uint8_t *image, const uint8_t *mask, EPD_stage stage);
+static void frame_data_repeat(EPD_type *epd, const uint8_t *image, const uint8_t *mask, const uint8_t *line_map, EPD_stage stage);
+static size_t encode_line(EPD_type *epd, uint8_t *buffer, uint16_t line, const uint8_t *data, uint8_t fixed_value, const uint8_t *mask, EPD_stage stage);
+static void send_line(EPD_type *epd, const uint8_t *buffer, size_t length);
 static void one_line(EPD_type *epd, uint16_t line, const uint8_t *data, uint8_t fixed_value, const uint8_t *mask, EPD_stage stage);
 static void nothing_frame(EPD_type *epd);
 static void dummy_line(EPD_type *epd);
@@ -102,7 +123,11 @@ struct EPD_struct {
 	uint8_t *line_buffer;
 	size_t line_buffer_size;
 
-	timer_t timer;
+	uint8_t *frame_buffer;         // one stage encoded, line_buffer_size per line
+	size_t frame_line_length;      // bytes used in each line of frame_buffer
+
+	STAGE_type stage_timer;
+	STAGE_statistics statistics[EPD_STAGE_COUNT];  // indexed by EPD_stage
 	SPI_type *spi;
 
 	bool COG_on;
@@ -117,16 +142,6 @@ EPD_type *EPD_create(EPD_size size,
 		     int busy_pin,
 		     SPI_type *spi) {
 
-	// create a polled timer
-	timer_t timer;
-	struct sigevent event;
-	event.sigev_notify = SIGEV_NONE;
-
-	if (-1 == timer_create(CLOCK_REALTIME, &event, &timer)) {
-		warn("falled to create timer");
-		return NULL;
-	}
-
 	// allocate memory
 	EPD_type *epd = malloc(sizeof(EPD_type));
 	if (NULL == epd) {
@@ -136,7 +151,8 @@ EPD_type *EPD_create(EPD_size size,
 
 	epd->status = EPD_UNDEFINED;
 	epd->spi = spi;
-	epd->timer = timer;
+	STAGE_init(&epd->stage_timer, STAGE_FINISH_NEAREST);
+	memset(epd->statistics, 0, sizeof(epd->statistics));
 
 	epd->EPD_Pin_PANEL_ON = panel_on_pin;
 	epd->EPD_Pin_BORDER = border_pin;
@@ -234,7 +250,7 @@ EPD_type *EPD_create(EPD_size size,
 			+ epd->bytes_per_scan
 			+ 3; // command byte, pre_border_byte, border byte
 	} else {
-		epd->line_buffer_size = epd->bytes_per_line
+		epd->line_buffer_size = 2 * epd->bytes_per_line  // all_pixels: two bytes per image byte
 			+ 2 * epd->bytes_per_scan
 			+ 3; // command byte, pre_border_byte, border byte
 	}
@@ -249,6 +265,16 @@ EPD_type *EPD_create(EPD_size size,
 	// ensure zero
 	memset(epd->line_buffer, 0x00, epd->line_buffer_size);
 
+	// buffer for a whole encoded stage
+	epd->frame_buffer = malloc(epd->line_buffer_size * epd->lines_per_display);
+	if (NULL == epd->frame_buffer) {
+		free(epd->line_buffer);
+		free(epd);
+		warn("falled to allocate EPD frame buffer");
+		return NULL;
+	}
+	epd->frame_line_length = 0;
+
 	// ensure I/O is all set to ZERO
 	power_off(epd);
 
@@ -267,6 +293,9 @@ void EPD_destroy(EPD_type *epd) {
 	if (NULL != epd->line_buffer) {
 		free(epd->line_buffer);
 	}
+	if (NULL != epd->frame_buffer) {
+		free(epd->frame_buffer);
+	}
 	free(epd);
 }
 
@@ -288,32 +317,7 @@ void EPD_begin(EPD_type *epd) {
 	// assume OK
 	epd->status = EPD_OK;
 
-	// power up sequence
-	digitalWrite(epd->EPD_Pin_RESET, LOW);
-	digitalWrite(epd->EPD_Pin_PANEL_ON, LOW);
-	digitalWrite(epd->EPD_Pin_DISCHARGE, LOW);
-	digitalWrite(epd->EPD_Pin_BORDER, LOW);
-
-	SPI_on(epd->spi);
-
-	Delay_ms(5);
-	digitalWrite(epd->EPD_Pin_PANEL_ON, HIGH);
-	Delay_ms(10);
-
-	digitalWrite(epd->EPD_Pin_RESET, HIGH);
-	digitalWrite(epd->EPD_Pin_BORDER, HIGH);
-	Delay_ms(5);
-
-	digitalWrite(epd->EPD_Pin_RESET, LOW);
-	Delay_ms(5);
-
-	digitalWrite(epd->EPD_Pin_RESET, HIGH);
-	Delay_ms(5);
-
-	// wait for COG to become ready
-	while (HIGH == digitalRead(epd->EPD_Pin_BUSY)) {
-		Delay_us(10);
-	}
+	power_on(epd);
 
 	// read the COG ID
 	uint8_t receive_buffer[2];
@@ -472,12 +476,82 @@ void EPD_end(EPD_type *epd) {
 }
 
 
+// power the COG up only as far as EPD_begin reads it back
+void EPD_probe_begin(EPD_type *epd) {
+
+	// assume OK
+	epd->status = EPD_OK;
+
+	power_on(epd);
+
+	// Disable OE
+	SPI_send(epd->spi, CU8(0x70, 0x02), 2);
+	SPI_send(epd->spi, CU8(0x72, 0x40), 2);
+}
+
+
+// the COG ID and breakage reads of EPD_begin, without changing the
+// status: a wrong answer here may just mean the SPI clock is too fast
+bool EPD_probe(EPD_type *epd) {
+
+	// read the COG ID
+	uint8_t receive_buffer[2];
+	SPI_read(epd->spi, CU8(0x71, 0x00), receive_buffer, sizeof(receive_buffer));
+	SPI_read(epd->spi, CU8(0x71, 0x00), receive_buffer, sizeof(receive_buffer));
+	int cog_id = receive_buffer[1];
+	if (0x02 != (0x0f & cog_id)) {
+		return false;
+	}
+
+	// check breakage
+	SPI_send(epd->spi, CU8(0x70, 0x0f), 2);
+	SPI_read(epd->spi, CU8(0x73, 0x00), receive_buffer, sizeof(receive_buffer));
+	int broken_panel = receive_buffer[1];
+	return 0x00 != (0x80 & broken_panel);
+}
+
+
+void EPD_probe_end(EPD_type *epd) {
+	power_off(epd);
+}
+
+
+// power up the COG and wait until it is ready for commands
+static void power_on(EPD_type *epd) {
+
+	// power up sequence
+	digitalWritePins({epd->EPD_Pin_RESET, LOW},
+			 {epd->EPD_Pin_PANEL_ON, LOW},
+			 {epd->EPD_Pin_DISCHARGE, LOW},
+			 {epd->EPD_Pin_BORDER, LOW});
+
+	SPI_on(epd->spi);
+
+	Delay_ms(5);
+	digitalWrite(epd->EPD_Pin_PANEL_ON, HIGH);
+	Delay_ms(10);
+
+	digitalWritePins({epd->EPD_Pin_RESET, HIGH},
+			 {epd->EPD_Pin_BORDER, HIGH});
+	Delay_ms(5);
+
+	digitalWrite(epd->EPD_Pin_RESET, LOW);
+	Delay_ms(5);
+
+	digitalWrite(epd->EPD_Pin_RESET, HIGH);
+	Delay_ms(5);
+
+	// wait for COG to become ready
+	GPIO_wait_edge(epd->EPD_Pin_BUSY, LOW, GPIO_WAIT_FOREVER);
+}
+
+
 static void power_off(EPD_type *epd) {
 
 	// turn of power and all signals
-	digitalWrite(epd->EPD_Pin_RESET, LOW);
-	digitalWrite(epd->EPD_Pin_PANEL_ON, LOW);
-	digitalWrite(epd->EPD_Pin_BORDER, LOW);
+	digitalWritePins({epd->EPD_Pin_RESET, LOW},
+			 {epd->EPD_Pin_PANEL_ON, LOW},
+			 {epd->EPD_Pin_BORDER, LOW});
 
 	// ensure SPI MOSI and CLOCK are Low before CS Low
 	SPI_off(epd->spi);
@@ -496,6 +570,18 @@ void EPD_set_factored_stage_time(EPD_type *epd, int pu_stagetime) {
 	epd->factored_stage_time = pu_stagetime;
 }
 
+void EPD_set_stage_finish(EPD_type *epd, STAGE_finish finish) {
+	epd->stage_timer.finish = finish;
+}
+
+const char *EPD_stage_name(int stage) {
+	return stage_names[stage];
+}
+
+void EPD_stage_statistics(EPD_type *epd, STAGE_statistics statistics[EPD_STAGE_COUNT]) {
+	memcpy(statistics, epd->statistics, sizeof(epd->statistics));
+}
+
 
 // clear display (anything -> white)
 void EPD_clear(EPD_type *epd) {
@@ -509,26 +595,70 @@ void EPD_clear(EPD_type *epd) {
 void EPD_image_0(EPD_type *epd, const uint8_t *image) {
 	frame_fixed_repeat(epd, 0xaa, EPD_compensate);
 	frame_fixed_repeat(epd, 0xaa, EPD_white);
-	frame_data_repeat(epd, image, NULL, EPD_inverse);
-	frame_data_repeat(epd, image, NULL, EPD_normal);
+	frame_data_repeat(epd, image, NULL, NULL, EPD_inverse);
+	frame_data_repeat(epd, image, NULL, NULL, EPD_normal);
 }
 
 // change from old image to new image
 void EPD_image(EPD_type *epd, const uint8_t *old_image, const uint8_t *new_image) {
-	frame_data_repeat(epd, old_image, NULL, EPD_compensate);
-	frame_data_repeat(epd, old_image, NULL, EPD_white);
-	frame_data_repeat(epd, new_image, NULL, EPD_inverse);
-	frame_data_repeat(epd, new_image, NULL, EPD_normal);
+	frame_data_repeat(epd, old_image, NULL, NULL, EPD_compensate);
+	frame_data_repeat(epd, old_image, NULL, NULL, EPD_white);
+	frame_data_repeat(epd, new_image, NULL, NULL, EPD_inverse);
+	frame_data_repeat(epd, new_image, NULL, NULL, EPD_normal);
 }
 
 // change from old image to new image
 void EPD_partial_image(EPD_type *epd, const uint8_t *old_image, const uint8_t *new_image) {
+	EPD_partial_image_lines(epd, old_image, new_image, NULL);
+}
+
+// change from old image to new image only scanning the lines in line_map
+void EPD_partial_image_lines(EPD_type *epd, const uint8_t *old_image, const uint8_t *new_image,
+			     const uint8_t *line_map) {
 	// Only need last stage for partial update
 	// See discussion on issue #19 in the repaper/gratis repository on github
-	frame_data_repeat(epd, new_image, old_image, EPD_normal);
+	int lines = frame_data(epd, new_image, old_image, line_map, NULL, EPD_normal);
+	if (lines > 0) {
+		frame_repeat(epd, lines, EPD_normal);
+	}
 }
 
 
+// change from old image to new image only inside a rectangle, the
+// pixels x0 <= x < x1 of the lines y0 <= y < y1
+void EPD_partial_region(EPD_type *epd, const uint8_t *old_image, const uint8_t *new_image,
+			int x0, int y0, int x1, int y1) {
+	if (x0 < 0) {
+		x0 = 0;
+	}
+	if (y0 < 0) {
+		y0 = 0;
+	}
+	if (x1 > epd->dots_per_line) {
+		x1 = epd->dots_per_line;
+	}
+	if (y1 > epd->lines_per_display) {
+		y1 = epd->lines_per_display;
+	}
+	if (x0 >= x1 || y0 >= y1) {
+		return;
+	}
+
+	uint8_t line_map[(MAX_LINES + 7) / 8] = {0};
+	for (int y = y0; y < y1; ++y) {
+		line_map[y >> 3] |= 1 << (y & 7);
+	}
+	uint8_t column_mask[MAX_BYTES_PER_LINE] = {0};
+	for (int x = x0; x < x1; ++x) {
+		column_mask[x >> 3] |= 0x80 >> (x & 7);
+	}
+
+	int lines = frame_data(epd, new_image, old_image, line_map, column_mask, EPD_normal);
+	if (lines > 0) {
+		frame_repeat(epd, lines, EPD_normal);
+	}
+}
+
 // internal functions
 // ==================
 
@@ -562,73 +692,97 @@ static int temperature_to_factor_10x(int temperature) {
 // the image is arranged by line which matches the display size
 // so smallest would have 96 * 32 bytes
 
-static void frame_fixed(EPD_type *epd, uint8_t fixed_value, EPD_stage stage) {
+// every repeat of a stage sends identical bytes, so the stage is
+// encoded once into frame_buffer and the repeats only send it
+
+// encode all lines with a fixed value, returns number of lines
+static int frame_fixed(EPD_type *epd, uint8_t fixed_value, EPD_stage stage) {
+	uint8_t *p = epd->frame_buffer;
 	for (uint8_t l = 0; l < epd->lines_per_display ; ++l) {
-		one_line(epd, l, NULL, fixed_value, NULL, stage);
+		epd->frame_line_length = encode_line(epd, p, l, NULL, fixed_value, NULL, stage);
+		p += epd->line_buffer_size;
 	}
+	return epd->lines_per_display;
 }
 
 
-static void frame_data(EPD_type *epd, const uint8_t *image, const uint8_t *mask, EPD_stage stage) {
-	if (NULL == mask) {
-		for (uint8_t l = 0; l < epd->lines_per_display ; ++l) {
-			one_line(epd, l, &image[l * epd->bytes_per_line], 0, NULL, stage);
+// encode the image lines, returns number of lines
+// lines not set in line_map (if not NULL) are skipped entirely, a line
+// that is not scanned keeps its current pixels just like a masked one.
+// With a mask, lines identical to it have every pixel masked so they
+// are skipped too; the comparison is done once here, not per repeat.
+// column_mask (if not NULL, needs a mask) has a bit set for each pixel
+// column that may change, the others are masked on every line
+static int frame_data(EPD_type *epd, const uint8_t *image, const uint8_t *mask, const uint8_t *line_map, const uint8_t *column_mask, EPD_stage stage) {
+	uint8_t *p = epd->frame_buffer;
+	int lines = 0;
+	for (uint8_t l = 0; l < epd->lines_per_display ; ++l) {
+		if (NULL != line_map && 0 == (line_map[l >> 3] & (1 << (l & 7)))) {
+			continue;
 		}
-	} else {
-		for (uint8_t l = 0; l < epd->lines_per_display ; ++l) {
-			size_t n = l * epd->bytes_per_line;
-			one_line(epd, l, &image[n], 0, &mask[n], stage);
+		size_t n = l * epd->bytes_per_line;
+		const uint8_t *line_mask = (NULL == mask) ? NULL : &mask[n];
+		uint8_t boxed_mask[MAX_BYTES_PER_LINE];
+		if (NULL != line_mask && NULL != column_mask) {
+			// outside the columns the mask is the image itself
+			for (int b = 0; b < epd->bytes_per_line; ++b) {
+				boxed_mask[b] = (line_mask[b] & column_mask[b]) | (image[n + b] & ~column_mask[b]);
+			}
+			line_mask = boxed_mask;
 		}
+		if (NULL != line_mask && 0 == memcmp(&image[n], line_mask, epd->bytes_per_line)) {
+			continue;
+		}
+		epd->frame_line_length = encode_line(epd, p, l, &image[n], 0, line_mask, stage);
+		p += epd->line_buffer_size;
+		++lines;
 	}
+	return lines;
 }
 
 
-static void frame_fixed_repeat(EPD_type *epd, uint8_t fixed_value, EPD_stage stage) {
-	struct itimerspec its;
-	its.it_value.tv_sec = epd->factored_stage_time / 1000;
-	its.it_value.tv_nsec = (epd->factored_stage_time % 1000) * 1000000;
-	its.it_interval.tv_sec = 0;
-	its.it_interval.tv_nsec = 0;
-
-	if (-1 == timer_settime(epd->timer, 0, &its, NULL)) {
-		err(1, "timer_settime failed");
+// send the encoded lines once, batched into as few ioctls as possible
+// and without reconfiguring the SPI mode between lines
+static void frame_send(void *context, int lines) {
+	EPD_type *epd = context;
+	const uint8_t *p = epd->frame_buffer;
+	SPI_session_begin(epd->spi);
+	SPI_batch_begin(epd->spi);
+	for (int l = 0; l < lines; ++l) {
+		send_line(epd, p, epd->frame_line_length);
+		p += epd->line_buffer_size;
 	}
-	do {
-		frame_fixed(epd, fixed_value, stage);
+	SPI_batch_end(epd->spi);
+	SPI_session_end(epd->spi);
+}
 
-		if (-1 == timer_gettime(epd->timer, &its)) {
-			err(1, "timer_gettime failed");
-		}
-	} while (its.it_value.tv_sec > 0 || its.it_value.tv_nsec > 0);
+
+// send the encoded lines for the stage time
+static void frame_repeat(EPD_type *epd, int lines, EPD_stage stage) {
+	STAGE_run(&epd->stage_timer, &epd->statistics[stage], epd->factored_stage_time,
+		  lines, frame_send, epd);
 }
 
 
-static void frame_data_repeat(EPD_type *epd, const uint8_t *image, const uint8_t *mask, EPD_stage stage) {
-	struct itimerspec its;
-	its.it_value.tv_sec = epd->factored_stage_time / 1000;
-	its.it_value.tv_nsec = (epd->factored_stage_time % 1000) * 1000000;
-	its.it_interval.tv_sec = 0;
-	its.it_interval.tv_nsec = 0;
+static void frame_fixed_repeat(EPD_type *epd, uint8_t fixed_value, EPD_stage stage) {
+	frame_repeat(epd, frame_fixed(epd, fixed_value, stage), stage);
+}
 
-	int n = 0;
-	if (-1 == timer_settime(epd->timer, 0, &its, NULL)) {
-		err(1, "timer_settime failed");
-	}
-	do {
-		frame_data(epd, image, mask, stage);
-		if (-1 == timer_gettime(epd->timer, &its)) {
-			err(1, "timer_gettime failed");
-		}
-		++n;
-	} while (its.it_value.tv_sec > 0 || its.it_value.tv_nsec > 0);
+
+static void frame_data_repeat(EPD_type *epd, const uint8_t *image, const uint8_t *mask, const uint8_t *line_map, EPD_stage stage) {
+	frame_repeat(epd, frame_data(epd, image, mask, line_map, NULL, stage), stage);
 }
 
 
 
 static void nothing_frame(EPD_type *epd) {
+	SPI_session_begin(epd->spi);
+	SPI_batch_begin(epd->spi);
 	for (int line = 0; line < epd->lines_per_display; ++line) {
 		one_line(epd, 0x7fffu, NULL, 0x00, NULL, EPD_compensate);
 	}
+	SPI_batch_end(epd->spi);
+	SPI_session_end(epd->spi);
 }
 
 
@@ -728,8 +882,7 @@ static void all_pixels(EPD_type *epd, uint8_t **pp, const uint8_t *data, uint8_t
 
 			uint16_t pixel_mask = 0xffff;
 			if (NULL != mask) {
-				uint16_t pixel_mask = interleave_bits(mask[b - 1]);
-				pixel_mask = (pixel_mask ^ pixels) & 0x5555;
+				pixel_mask = (interleave_bits(mask[b - 1]) ^ pixels) & 0x5555;
 				pixel_mask |= pixel_mask << 1;
 			}
 			switch(stage) {
@@ -758,14 +911,15 @@ static void all_pixels(EPD_type *epd, uint8_t **pp, const uint8_t *data, uint8_t
 
 // output one line of scan and data bytes to the display
 static void one_line(EPD_type *epd, uint16_t line, const uint8_t *data, uint8_t fixed_value, const uint8_t *mask, EPD_stage stage) {
+	size_t length = encode_line(epd, epd->line_buffer, line, data, fixed_value, mask, stage);
+	send_line(epd, epd->line_buffer, length);
+}
 
-	SPI_on(epd->spi);
 
-	// send data
-	SPI_send(epd->spi, CU8(0x70, 0x0a), 2);
+// encode one line of scan and data bytes, returns the number of bytes
+static size_t encode_line(EPD_type *epd, uint8_t *buffer, uint16_t line, const uint8_t *data, uint8_t fixed_value, const uint8_t *mask, EPD_stage stage) {
 
-	// CS low
-	uint8_t *p = epd->line_buffer;
+	uint8_t *p = buffer;
 
 	*p++ = 0x72;
 
@@ -834,8 +988,20 @@ static void one_line(EPD_type *epd, uint16_t line, const uint8_t *data, uint8_t
 		}
 		break;
 	}
-	// send the accumulated line buffer
-	SPI_send(epd->spi, epd->line_buffer, p - epd->line_buffer);
+	return p - buffer;
+}
+
+
+// send one encoded line to the display
+static void send_line(EPD_type *epd, const uint8_t *buffer, size_t length) {
+
+	SPI_on(epd->spi);
+
+	// send data
+	SPI_send(epd->spi, CU8(0x70, 0x0a), 2);
+
+	// CS low
+	SPI_send(epd->spi, buffer, length);
 
 	// output data to panel
 	SPI_send(epd->spi, CU8(0x70, 0x02), 2);
@@ -16,6 +16,7 @@
 #define EPD_H 1
 
 #include "spi.h"
+#include "stage_timer.h"
 
 // compile-time #if configuration
 #define EPD_CHIP_VERSION      2
@@ -24,6 +25,12 @@
 #define EPD_IMAGE_ONE_ARG     0
 #define EPD_IMAGE_TWO_ARG     1
 #define EPD_PARTIAL_AVAILABLE 1
+#define EPD_PARTIAL_LINES_AVAILABLE 1
+#define EPD_PARTIAL_REGION_AVAILABLE 1
+#define EPD_PROBE_AVAILABLE   1
+
+// stages reported by EPD_stage_statistics
+#define EPD_STAGE_COUNT       4
 
 // display panels supported
 #define EPD_1_44_SUPPORT      1
@@ -74,6 +81,16 @@ void EPD_set_temperature(EPD_type *epd, int temperature);
 // set factored_stage_time directly ('F' command)
 void EPD_set_factored_stage_time(EPD_type *epd, int pu_stagetime);
 
+// how a timed stage uses the time after its last whole frame
+// (default STAGE_FINISH_NEAREST)
+void EPD_set_stage_finish(EPD_type *epd, STAGE_finish finish);
+
+// name of stage 0 .. EPD_STAGE_COUNT - 1
+const char *EPD_stage_name(int stage);
+
+// copy the repeat and overrun counts of every stage
+void EPD_stage_statistics(EPD_type *epd, STAGE_statistics statistics[EPD_STAGE_COUNT]);
+
 // sequence start/end
 void EPD_begin(EPD_type *epd);
 void EPD_end(EPD_type *epd);
@@ -81,6 +98,13 @@ void EPD_end(EPD_type *epd);
 // ok/error status
 EPD_error EPD_status(EPD_type *epd);
 
+// read back the COG ID and breakage status at the current SPI clock,
+// true if both are correct.  Bracketed by probe_begin/probe_end, which
+// only power the COG up enough to answer (use instead of begin/end)
+void EPD_probe_begin(EPD_type *epd);
+bool EPD_probe(EPD_type *epd);
+void EPD_probe_end(EPD_type *epd);
+
 // items below must be bracketed by begin/end
 // ==========================================
 
@@ -97,5 +121,16 @@ void EPD_image(EPD_type *epd, const uint8_t *old_image, const uint8_t *new_image
 // only updating changed pixels
 void EPD_partial_image(EPD_type *epd, const uint8_t *old_image, const uint8_t *new_image);
 
+// as EPD_partial_image but only scan the lines set in line_map
+// (line l is bit (l & 7) of line_map[l / 8], NULL => all lines)
+void EPD_partial_image_lines(EPD_type *epd, const uint8_t *old_image, const uint8_t *new_image,
+			     const uint8_t *line_map);
+
+// as EPD_partial_image but only scan the lines y0 <= y < y1 and only
+// change the pixels x0 <= x < x1 of them, the rest of the panel is
+// not touched
+void EPD_partial_region(EPD_type *epd, const uint8_t *old_image, const uint8_t *new_image,
+			int x0, int y0, int x1, int y1);
+
 
 #endif
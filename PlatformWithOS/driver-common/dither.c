@@ -0,0 +1,155 @@
+// Copyright 2013-2015 Pervasive Displays, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at:
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+// express or implied.  See the License for the specific language
+// governing permissions and limitations under the License.
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "dither.h"
+
+
+static const char *names[] = {
+	[DITHER_FLOYD_STEINBERG] = "floyd-steinberg",
+	[DITHER_ATKINSON] = "atkinson",
+	[DITHER_BAYER] = "bayer",
+};
+
+// 8x8 Bayer index matrix (0 .. 63)
+static const uint8_t bayer[8][8] = {
+	{ 0, 32,  8, 40,  2, 34, 10, 42},
+	{48, 16, 56, 24, 50, 18, 58, 26},
+	{12, 44,  4, 36, 14, 46,  6, 38},
+	{60, 28, 52, 20, 62, 30, 54, 22},
+	{ 3, 35, 11, 43,  1, 33,  9, 41},
+	{51, 19, 59, 27, 49, 17, 57, 25},
+	{15, 47,  7, 39, 13, 45,  5, 37},
+	{63, 31, 55, 23, 61, 29, 53, 21}
+};
+
+
+static void error_row(DITHER_type *dither, uint8_t *bits, const uint8_t *gray);
+static void bayer_row(DITHER_type *dither, uint8_t *bits, const uint8_t *gray);
+
+
+// functions
+// =========
+
+void DITHER_begin(DITHER_type *dither, DITHER_method method, int width) {
+	dither->method = method;
+	dither->width = width > DITHER_MAX_WIDTH ? DITHER_MAX_WIDTH : width;
+	dither->row = 0;
+	memset(dither->error, 0, sizeof(dither->error));
+}
+
+
+void DITHER_row(DITHER_type *dither, uint8_t *bits, const uint8_t *gray) {
+	memset(bits, 0, dither->width / 8);
+	if (DITHER_BAYER == dither->method) {
+		bayer_row(dither, bits, gray);
+	} else {
+		error_row(dither, bits, gray);
+	}
+	++dither->row;
+}
+
+
+const char *DITHER_name(DITHER_method method) {
+	return names[method];
+}
+
+
+bool DITHER_parse(const char *text, size_t length, DITHER_method *method) {
+	while (length > 0 && isspace((unsigned char)text[length - 1])) {
+		--length;
+	}
+	for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+		if (strlen(names[i]) == length && 0 == memcmp(names[i], text, length)) {
+			*method = (DITHER_method)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+
+// internal functions
+// ==================
+
+// error diffusion in integer arithmetic; each pixel's error is the
+// difference between its corrected value and the black (0) or white
+// (255) chosen for it and is spread onto pixels not yet processed:
+//
+//   Floyd-Steinberg       Atkinson (1/8 each, 2/8 dropped)
+//         *  7                  *  1  1
+//      3  5  1               1  1  1
+//        (/16)                  1
+static void error_row(DITHER_type *dither, uint8_t *bits, const uint8_t *gray) {
+	int16_t *e0 = &dither->error[dither->row % 3][2];
+	int16_t *e1 = &dither->error[(dither->row + 1) % 3][2];
+	int16_t *e2 = &dither->error[(dither->row + 2) % 3][2];
+	const int width = dither->width;
+
+	if (DITHER_FLOYD_STEINBERG == dither->method) {
+		for (int x = 0; x < width; ++x) {
+			int v = gray[x] + e0[x];
+			int black = v < 128;
+			int e = v - (black ? 0 : 255);
+			bits[x >> 3] |= black << (7 - (x & 7));
+
+			int e7 = (e * 7) >> 4;
+			int e3 = (e * 3) >> 4;
+			int e5 = (e * 5) >> 4;
+			e0[x + 1] += e7;
+			e1[x - 1] += e3;
+			e1[x] += e5;
+			e1[x + 1] += e - e7 - e3 - e5;  // the remainder so no error is lost
+		}
+	} else {
+		for (int x = 0; x < width; ++x) {
+			int v = gray[x] + e0[x];
+			int black = v < 128;
+			int e = (v - (black ? 0 : 255)) >> 3;
+			bits[x >> 3] |= black << (7 - (x & 7));
+
+			e0[x + 1] += e;
+			e0[x + 2] += e;
+			e1[x - 1] += e;
+			e1[x] += e;
+			e1[x + 1] += e;
+			e2[x] += e;
+		}
+	}
+
+	// this row's slot becomes the one two rows ahead
+	memset(dither->error[dither->row % 3], 0, sizeof(dither->error[0]));
+}
+
+
+// threshold against the matrix; no carried state so each group of
+// eight pixels is independent and the inner loop vectorizes
+static void bayer_row(DITHER_type *dither, uint8_t *bits, const uint8_t *gray) {
+	uint8_t threshold[8];
+	for (int i = 0; i < 8; ++i) {
+		threshold[i] = bayer[dither->row & 7][i] * 4 + 2;
+	}
+	for (int x = 0; x < dither->width; x += 8) {
+		uint8_t byte = 0;
+		for (int i = 0; i < 8; ++i) {
+			byte |= (gray[x + i] < threshold[i]) << (7 - i);
+		}
+		bits[x >> 3] = byte;
+	}
+}
@@ -0,0 +1,61 @@
+// Copyright 2013-2015 Pervasive Displays, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at:
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+// express or implied.  See the License for the specific language
+// governing permissions and limitations under the License.
+
+
+#if !defined(DITHER_H)
+#define DITHER_H 1
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+
+// widest panel (2.7")
+#define DITHER_MAX_WIDTH 264
+
+typedef enum {
+	DITHER_FLOYD_STEINBERG,  // error diffusion, Floyd-Steinberg (as PIL's default)
+	DITHER_ATKINSON,         // error diffusion losing 1/4 of the error, higher contrast
+	DITHER_BAYER             // ordered 8x8 threshold matrix, no state between rows
+} DITHER_method;
+
+// state for dithering one image a row at a time: only the errors
+// carried into the next two rows are kept, never a whole image
+typedef struct {
+	DITHER_method method;
+	int width;
+	int row;                                      // rows done so far
+	int16_t error[3][DITHER_MAX_WIDTH + 4];       // error for this and next two rows (2 guard entries each side)
+} DITHER_type;
+
+
+// functions
+// =========
+
+// start a new image of 'width' pixels per row
+void DITHER_begin(DITHER_type *dither, DITHER_method method, int width);
+
+// convert the next row of 8 bit grayscale (0 => black, 255 => white)
+// to 1 bit per pixel in display layout (top left is 0x80 of the
+// first byte, 1 => black); writes width / 8 bytes to 'bits'
+void DITHER_row(DITHER_type *dither, uint8_t *bits, const uint8_t *gray);
+
+// name of a method as used by the dither file
+const char *DITHER_name(DITHER_method method);
+
+// look up a method by name, ignoring trailing white space
+bool DITHER_parse(const char *text, size_t length, DITHER_method *method);
+
+
+#endif
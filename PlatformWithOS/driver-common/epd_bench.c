@@ -0,0 +1,832 @@
+// Copyright 2013-2015 Pervasive Displays, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at:
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+// express or implied.  See the License for the specific language
+// governing permissions and limitations under the License.
+
+// microbenchmark for the frame conversions done by epd_fuse and the
+// line encoding done by the panel driver; needs no panel or SPI device
+// so it can run on any machine
+//
+// The driver source is compiled into this program so that its static
+// line functions can be timed directly.  It talks to a null SPI sink
+// that only counts bytes and to GPIO functions that do nothing.  The
+// sink can also pass everything on to the Raspberry Pi register SPI
+// (spi_mapped.c) running against a model of the SPI0 registers, so
+// that driver can be checked and timed on any machine too.
+
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/utsname.h>
+
+#include "special_memcpy.h"
+#include "gpio.h"
+#include "spi.h"
+#include "stage_timer.h"
+#include "epd.h"
+
+// the null sink does not wait either, so the delays the driver puts
+// between the transfers of a line do not hide the encoding time
+static int null_delay(useconds_t us);
+#define usleep(us) null_delay(us)
+
+#include "epd.c"
+
+#undef usleep
+
+
+#define SIZE_OF_ARRAY(a) (sizeof(a) / sizeof((a)[0]))
+
+// the same sizes as panels[] in epd_fuse.c
+static const struct {
+	const char *key;
+	EPD_size size;
+	int width;
+	int height;
+	int byte_count;
+} sizes[] = {
+#if EPD_1_44_SUPPORT
+	{"1.44", EPD_1_44, 128, 96, 128 * 98 / 8},
+#endif
+#if EPD_1_9_SUPPORT
+	{"1.9", EPD_1_9, 144, 128, 144 * 128 / 8},
+#endif
+#if EPD_2_0_SUPPORT
+	{"2.0", EPD_2_0, 200, 96, 200 * 96 / 8},
+#endif
+#if EPD_2_6_SUPPORT
+	{"2.6", EPD_2_6, 232, 128, 232 * 128 / 8},
+#endif
+#if EPD_2_7_SUPPORT
+	{"2.7", EPD_2_7, 264, 176, 264 * 176 / 8},
+#endif
+};
+
+#define MAX_BYTE_COUNT (264 * 176 / 8)
+
+// the stages the driver encodes lines for
+static const struct {
+	const char *name;
+	EPD_stage stage;
+} stages[] = {
+#if EPD_FILM_VERSION == 230
+	{"inverse", EPD_inverse},
+	{"normal", EPD_normal},
+#else
+	{"compensate", EPD_compensate},
+	{"white", EPD_white},
+	{"inverse", EPD_inverse},
+	{"normal", EPD_normal},
+#endif
+};
+
+#define MAX_RUNS 101
+
+// command line settings
+typedef struct {
+	int iterations;  // timed calls per run
+	int runs;        // runs per benchmark, the median is reported
+	int cpu;         // pinned to this CPU (-1 => not pinned)
+	bool json;       // one JSON document instead of a table
+	int count;       // results reported so far
+} options_type;
+
+// the time for one call of a benchmark
+typedef struct {
+	double ns;      // median of the runs
+	double min_ns;  // fastest run
+} timing_type;
+
+// one call of a benchmark, context holds its arguments
+typedef void bench_function(void *context);
+
+typedef void special_memcpy_function(char *d, const char *s, size_t size, bool bit_reversed, bool inverted);
+
+typedef struct {
+	special_memcpy_function *f;
+	char *d;
+	const char *s;
+	size_t size;
+	bool bit_reversed;
+	bool inverted;
+} copy_context;
+
+// successive calls step through the lines of one frame
+typedef struct {
+	EPD_type *epd;
+	const uint8_t *image;
+	const uint8_t *mask;
+	EPD_stage stage;
+	uint16_t line;
+	uint8_t buffer[4096];
+} line_context;
+
+// spi_mapped.c against the SPI0 model (spi_mapped_model.c)
+typedef struct MODEL_SPI_struct MODEL_SPI_type;
+MODEL_SPI_type *MODEL_SPI_create(const char *spi_path, uint32_t bps);
+bool MODEL_SPI_destroy(MODEL_SPI_type *spi);
+void MODEL_SPI_on(MODEL_SPI_type *spi);
+void MODEL_SPI_off(MODEL_SPI_type *spi);
+void MODEL_SPI_send(MODEL_SPI_type *spi, const void *buffer, size_t length);
+void MODEL_SPI_read(MODEL_SPI_type *spi, const void *buffer, void *received, size_t length);
+void MODEL_SPI_session_begin(MODEL_SPI_type *spi);
+void MODEL_SPI_session_end(MODEL_SPI_type *spi);
+void MODEL_SPI_batch_begin(MODEL_SPI_type *spi);
+void MODEL_SPI_batch_end(MODEL_SPI_type *spi);
+void MODEL_SPI_flush(MODEL_SPI_type *spi);
+void MODEL_SPI_set_speed(MODEL_SPI_type *spi, uint32_t bps);
+void MODEL_SPI_sent(size_t *bytes, uint32_t *hash);
+
+// the null SPI sink
+struct SPI_struct {
+	size_t bytes;            // sent since created
+	uint32_t hash;           // FNV-1a of those bytes if hashing
+	bool hashing;
+	MODEL_SPI_type *mapped;  // also sent to this (NULL => not)
+};
+
+
+// local function prototypes
+static void usage(const char *program_name, const char *message, ...);
+static void pin_cpu(options_type *options, const char *program_name);
+static uint64_t now_ns(void);
+static int compare_double(const void *a, const void *b);
+static timing_type measure(const options_type *options, bench_function *f, void *context);
+static void report_begin(options_type *options);
+static void report(options_type *options, const char *benchmark, const char *panel,
+		   const char *stage, const char *variant, const char *unit,
+		   size_t bytes, timing_type timing);
+static void report_end(options_type *options);
+static int check_copy(void);
+static int check_mapped(void);
+static void bench_copy(options_type *options);
+static void bench_lines(options_type *options);
+
+
+// the benchmark program
+int main(int argc, char *argv[]) {
+
+	options_type options = {
+		.iterations = 20000,
+		.runs = 5,
+		.cpu = -2,  // => the CPU it starts on
+		.json = false,
+		.count = 0,
+	};
+
+	bool have_iterations = false;
+	for (int i = 1; i < argc; ++i) {
+		const char *arg = argv[i];
+		if (0 == strcmp(arg, "--json")) {
+			options.json = true;
+		} else if (0 == strncmp(arg, "--runs=", 7)) {
+			options.runs = atoi(arg + 7);
+			if (options.runs <= 0 || options.runs > MAX_RUNS) {
+				usage(argv[0], "invalid runs: %s (1..%d)", arg + 7, MAX_RUNS);
+			}
+		} else if (0 == strcmp(arg, "--cpu=none")) {
+			options.cpu = -1;
+		} else if (0 == strncmp(arg, "--cpu=", 6)) {
+			char *end;
+			options.cpu = strtol(arg + 6, &end, 10);
+			if (end == arg + 6 || '\0' != *end || options.cpu < 0) {
+				usage(argv[0], "invalid cpu: %s", arg + 6);
+			}
+		} else if ('-' == arg[0]) {
+			usage(argv[0], "unknown option: %s", arg);
+		} else if (have_iterations) {
+			usage(argv[0], "extraneous extra argument(s)");
+		} else {
+			options.iterations = atoi(arg);
+			if (options.iterations <= 0) {
+				usage(argv[0], "invalid iterations: %s", arg);
+			}
+			have_iterations = true;
+		}
+	}
+
+	pin_cpu(&options, argv[0]);
+
+	int rc = check_copy();
+	rc |= check_mapped();
+
+	report_begin(&options);
+	bench_copy(&options);
+	bench_lines(&options);
+	report_end(&options);
+
+	return rc;
+}
+
+
+// private functions
+// =================
+
+// print usage message and exit
+static void usage(const char *program_name, const char *message, ...) {
+
+	if (NULL != message) {
+		va_list ap;
+		va_start(ap, message);
+		fprintf(stderr, "error: ");
+		vfprintf(stderr, message, ap);
+		fprintf(stderr, "\n");
+		va_end(ap);
+	}
+	if (NULL == program_name) {
+		program_name = "epd_bench";
+	}
+
+	fprintf(stderr, "usage: %s [--json] [--runs=N] [--cpu=N|none] [iterations]\n", program_name);
+	exit(1);
+}
+
+
+// keep every run on one CPU so the caches stay warm and a migration
+// does not land in the middle of a run
+static void pin_cpu(options_type *options, const char *program_name) {
+	if (-2 == options->cpu) {
+		options->cpu = sched_getcpu();
+	}
+	if (options->cpu < 0) {
+		options->cpu = -1;
+		return;
+	}
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(options->cpu, &set);
+	if (0 != sched_setaffinity(0, sizeof(set), &set)) {
+		warn("cannot pin to CPU %d", options->cpu);
+		usage(program_name, "invalid cpu: %d", options->cpu);
+	}
+}
+
+
+// monotonic time in nanoseconds
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+
+static int compare_double(const void *a, const void *b) {
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+
+// time one call of f: a tenth of the iterations untimed to warm up
+// the caches and branch predictors, then options->runs timed runs
+static timing_type measure(const options_type *options, bench_function *f, void *context) {
+
+	for (int i = 0; i <= options->iterations / 10; ++i) {
+		f(context);
+	}
+
+	double run_ns[MAX_RUNS];
+	for (int run = 0; run < options->runs; ++run) {
+		uint64_t start = now_ns();
+		for (int i = 0; i < options->iterations; ++i) {
+			f(context);
+		}
+		run_ns[run] = (double)(now_ns() - start) / options->iterations;
+	}
+	qsort(run_ns, options->runs, sizeof(run_ns[0]), compare_double);
+
+	timing_type timing = {
+		.ns = run_ns[options->runs / 2],
+		.min_ns = run_ns[0],
+	};
+	return timing;
+}
+
+
+static void report_begin(options_type *options) {
+
+	struct utsname name;
+	if (0 != uname(&name)) {
+		strcpy(name.machine, "unknown");
+	}
+
+	if (options->json) {
+		printf("{\n");
+		printf("  \"chip\": %d,\n", EPD_CHIP_VERSION);
+		printf("  \"film\": %d,\n", EPD_FILM_VERSION);
+		printf("  \"machine\": \"%s\",\n", name.machine);
+		printf("  \"special_memcpy_kernel\": \"%s\",\n", special_memcpy_kernel());
+		printf("  \"iterations\": %d,\n", options->iterations);
+		printf("  \"runs\": %d,\n", options->runs);
+		printf("  \"cpu\": %d,\n", options->cpu);
+		printf("  \"results\": [");
+	} else {
+		printf("COG %d FILM %d on %s, special_memcpy kernel: %s\n",
+		       EPD_CHIP_VERSION, EPD_FILM_VERSION, name.machine, special_memcpy_kernel());
+		printf("%d iterations, median of %d runs, ", options->iterations, options->runs);
+		if (options->cpu < 0) {
+			printf("not pinned\n");
+		} else {
+			printf("pinned to CPU %d\n", options->cpu);
+		}
+		printf("%-22s %-5s %-10s %-17s %10s %10s %10s\n",
+		       "benchmark", "panel", "stage", "variant", "ns", "min ns", "MB/s");
+	}
+}
+
+
+// bytes is the size of the image data one call converts, MB/s is
+// worked out from the median time
+static void report(options_type *options, const char *benchmark, const char *panel,
+		   const char *stage, const char *variant, const char *unit,
+		   size_t bytes, timing_type timing) {
+
+	double mb_per_s = bytes * 1000.0 / timing.ns;
+
+	if (options->json) {
+		printf("%s\n    {\"benchmark\": \"%s\", \"panel\": \"%s\", ",
+		       0 == options->count ? "" : ",", benchmark, panel);
+		if (NULL == stage) {
+			printf("\"stage\": null, ");
+		} else {
+			printf("\"stage\": \"%s\", ", stage);
+		}
+		printf("\"variant\": \"%s\", \"unit\": \"%s\", \"bytes\": %zu, "
+		       "\"ns\": %.1f, \"min_ns\": %.1f, \"mb_per_s\": %.1f}",
+		       variant, unit, bytes, timing.ns, timing.min_ns, mb_per_s);
+	} else {
+		printf("%-22s %-5s %-10s %-17s %10.1f %10.1f %10.1f\n",
+		       benchmark, panel, NULL == stage ? "-" : stage, variant,
+		       timing.ns, timing.min_ns, mb_per_s);
+	}
+	++options->count;
+	fflush(stdout);
+}
+
+
+static void report_end(options_type *options) {
+	if (options->json) {
+		printf("\n  ]\n}\n");
+	} else {
+		printf("ns is per frame for special_memcpy and per line for the rest\n");
+	}
+}
+
+
+static void copy_call(void *context) {
+	copy_context *c = context;
+	c->f(c->d, c->s, c->size, c->bit_reversed, c->inverted);
+	__asm__ __volatile__("" : : "r"(c->d) : "memory");  // keep every copy
+}
+
+
+static const char *copy_variant(bool bit_reversed, bool inverted) {
+	if (bit_reversed) {
+		return inverted ? "reversed,inverted" : "reversed";
+	}
+	return inverted ? "inverted" : "plain";
+}
+
+
+// check the special_memcpy kernel against the scalar version
+// return 1 if they differ
+static int check_copy(void) {
+
+	static char source[MAX_BYTE_COUNT];
+	static char expected[MAX_BYTE_COUNT];
+	static char result[MAX_BYTE_COUNT + 3];
+	srand(1);
+	for (size_t i = 0; i < sizeof(source); ++i) {
+		source[i] = rand();
+	}
+
+	int rc = 0;
+	for (int combination = 0; combination < 4; ++combination) {
+		bool bit_reversed = 0 != (combination & 2);
+		bool inverted = 0 != (combination & 1);
+
+		// unaligned starts and lengths that leave a scalar tail
+		for (size_t size = 0; size < 100; ++size) {
+			special_memcpy_scalar(expected, source + 1, size, bit_reversed, inverted);
+			special_memcpy(result + 3, source + 1, size, bit_reversed, inverted);
+			if (0 != memcmp(expected, result + 3, size)) {
+				fprintf(stderr, "error: size=%zu bit_reversed=%d inverted=%d: kernel result differs from scalar\n",
+					size, bit_reversed, inverted);
+				rc = 1;
+			}
+		}
+
+		// whole frames
+		for (size_t p = 0; p < SIZE_OF_ARRAY(sizes); ++p) {
+			size_t size = sizes[p].byte_count;
+			special_memcpy_scalar(expected, source, size, bit_reversed, inverted);
+			special_memcpy(result, source, size, bit_reversed, inverted);
+			if (0 != memcmp(expected, result, size)) {
+				fprintf(stderr, "error: %s bit_reversed=%d inverted=%d: kernel result differs from scalar\n",
+					sizes[p].key, bit_reversed, inverted);
+				rc = 1;
+			}
+		}
+	}
+	return rc;
+}
+
+
+// EPD_create for a panel size, sending to spi
+static EPD_type *create_panel(size_t p, SPI_type *spi) {
+#if EPD_PWM_REQUIRED
+	EPD_type *epd = EPD_create(sizes[p].size, 0, 0, 0, 0, 0, 0, spi);
+#else
+	EPD_type *epd = EPD_create(sizes[p].size, 0, 0, 0, 0, 0, spi);
+#endif
+	if (NULL == epd) {
+		err(1, "EPD_create failed");
+	}
+	return epd;
+}
+
+
+// the LE and _inverse conversions of epd_fuse, for every panel size
+static void bench_copy(options_type *options) {
+
+	static char source[MAX_BYTE_COUNT];
+	static char result[MAX_BYTE_COUNT];
+	srand(1);
+	for (size_t i = 0; i < sizeof(source); ++i) {
+		source[i] = rand();
+	}
+
+	for (size_t p = 0; p < SIZE_OF_ARRAY(sizes); ++p) {
+		for (int combination = 0; combination < 4; ++combination) {
+			copy_context c = {
+				.d = result,
+				.s = source,
+				.size = sizes[p].byte_count,
+				.bit_reversed = 0 != (combination & 2),
+				.inverted = 0 != (combination & 1),
+			};
+			const char *variant = copy_variant(c.bit_reversed, c.inverted);
+
+			c.f = special_memcpy_scalar;
+			report(options, "special_memcpy_scalar", sizes[p].key, NULL, variant, "frame",
+			       c.size, measure(options, copy_call, &c));
+
+			c.f = special_memcpy;
+			report(options, "special_memcpy", sizes[p].key, NULL, variant, "frame",
+			       c.size, measure(options, copy_call, &c));
+		}
+	}
+}
+
+
+// the image data and mask of the next line
+static const uint8_t *next_line(line_context *c, const uint8_t **mask) {
+	if (++c->line >= c->epd->lines_per_display) {
+		c->line = 0;
+	}
+	size_t offset = (size_t)(c->line) * c->epd->bytes_per_line;
+	*mask = NULL == c->mask ? NULL : c->mask + offset;
+	return c->image + offset;
+}
+
+
+#if EPD_FILM_VERSION == 231
+static void interleave_call(void *context) {
+	line_context *c = context;
+	const uint8_t *mask;
+	const uint8_t *data = next_line(c, &mask);
+	uint8_t *p = c->buffer;
+	for (uint16_t b = 0; b < c->epd->bytes_per_line; ++b) {
+		uint16_t pixels = interleave_bits(data[b]);
+		*p++ = pixels >> 8;
+		*p++ = pixels;
+	}
+	__asm__ __volatile__("" : : "r"(c->buffer) : "memory");
+}
+
+
+static void odd_call(void *context) {
+	line_context *c = context;
+	const uint8_t *mask;
+	const uint8_t *data = next_line(c, &mask);
+	uint8_t *p = c->buffer;
+	odd_pixels(c->epd, &p, data, 0x00, mask, c->stage);
+	__asm__ __volatile__("" : : "r"(c->buffer) : "memory");
+}
+
+
+static void even_call(void *context) {
+	line_context *c = context;
+	const uint8_t *mask;
+	const uint8_t *data = next_line(c, &mask);
+	uint8_t *p = c->buffer;
+	even_pixels(c->epd, &p, data, 0x00, mask, c->stage);
+	__asm__ __volatile__("" : : "r"(c->buffer) : "memory");
+}
+
+
+static void all_call(void *context) {
+	line_context *c = context;
+	const uint8_t *mask;
+	const uint8_t *data = next_line(c, &mask);
+	uint8_t *p = c->buffer;
+	all_pixels(c->epd, &p, data, 0x00, mask, c->stage);
+	__asm__ __volatile__("" : : "r"(c->buffer) : "memory");
+}
+#endif
+
+
+#if EPD_FILM_VERSION != 230
+static void encode_call(void *context) {
+	line_context *c = context;
+	const uint8_t *mask;
+	const uint8_t *data = next_line(c, &mask);
+	encode_line(c->epd, c->buffer, c->line, data, 0x00, mask, c->stage);
+	__asm__ __volatile__("" : : "r"(c->buffer) : "memory");
+}
+#endif
+
+
+// encode and send to the null sink
+static void one_line_call(void *context) {
+	line_context *c = context;
+	const uint8_t *mask;
+	const uint8_t *data = next_line(c, &mask);
+#if EPD_FILM_VERSION == 231
+	one_line(c->epd, c->line, data, 0x00, mask, c->stage);
+#elif EPD_FILM_VERSION == 230
+	(void)mask;
+	one_line(c->epd, c->line, data, 0x00, c->stage, 0x00);
+#else
+	line(c->epd, c->line, data, 0x00, mask, c->stage);
+#endif
+}
+
+
+// check that the register SPI clocks out the bytes the driver gives
+// it, for a frame of every size and stage
+// return 1 if they differ
+static int check_mapped(void) {
+
+	static uint8_t image[MAX_BYTE_COUNT];
+	srand(3);
+	for (size_t i = 0; i < sizeof(image); ++i) {
+		image[i] = rand();
+	}
+
+	SPI_type *spi = SPI_create("null", 0);
+	spi->mapped = MODEL_SPI_create("/dev/spidev0.0", 8000000);
+	if (NULL == spi->mapped) {
+		errx(1, "cannot create the SPI0 model");
+	}
+	spi->hashing = true;
+
+	int rc = 0;
+	for (size_t p = 0; p < SIZE_OF_ARRAY(sizes); ++p) {
+		EPD_type *epd = create_panel(p, spi);
+		for (size_t s = 0; s < SIZE_OF_ARRAY(stages); ++s) {
+			line_context c = {
+				.epd = epd,
+				.image = image,
+				.stage = stages[s].stage,
+			};
+
+			size_t bytes;
+			uint32_t hash;
+			MODEL_SPI_sent(&bytes, &hash);  // restart the count
+			spi->bytes = 0;
+			spi->hash = 2166136261u;
+
+			for (uint16_t i = 0; i < epd->lines_per_display; ++i) {
+				one_line_call(&c);
+			}
+
+			MODEL_SPI_sent(&bytes, &hash);
+			if (bytes != spi->bytes || hash != spi->hash) {
+				fprintf(stderr, "error: %s %s: SPI0 model clocked out %zu bytes (hash %08x) for %zu (hash %08x)\n",
+					sizes[p].key, stages[s].name, bytes, hash, spi->bytes, spi->hash);
+				rc = 1;
+			}
+		}
+		EPD_destroy(epd);
+	}
+	MODEL_SPI_destroy(spi->mapped);
+	SPI_destroy(spi);
+	return rc;
+}
+
+
+// the line encoding of the driver for every size, stage and with and
+// without a mask (a mask only changes the pixels that differ from it),
+// then sent to the register SPI as well
+static void bench_lines(options_type *options) {
+
+	static uint8_t image[MAX_BYTE_COUNT];
+	static uint8_t mask[MAX_BYTE_COUNT];
+	srand(2);
+	for (size_t i = 0; i < sizeof(image); ++i) {
+		image[i] = rand();
+		mask[i] = rand();
+	}
+
+	SPI_type *spi = SPI_create("null", 0);
+	MODEL_SPI_type *mapped = MODEL_SPI_create("/dev/spidev0.0", 8000000);
+	if (NULL == mapped) {
+		errx(1, "cannot create the SPI0 model");
+	}
+
+	for (size_t p = 0; p < SIZE_OF_ARRAY(sizes); ++p) {
+		EPD_type *epd = create_panel(p, spi);
+		size_t bytes = epd->bytes_per_line;
+		const char *panel = sizes[p].key;
+
+#if EPD_FILM_VERSION == 231
+		line_context c = {.epd = epd, .image = image};
+		report(options, "interleave_bits", panel, NULL, "none", "line",
+		       bytes, measure(options, interleave_call, &c));
+#endif
+
+		for (size_t s = 0; s < SIZE_OF_ARRAY(stages); ++s) {
+			for (int masked = 0; masked < 2; ++masked) {
+#if EPD_FILM_VERSION == 230
+				if (masked) {
+					continue;  // no partial update
+				}
+#endif
+				line_context c = {
+					.epd = epd,
+					.image = image,
+					.mask = masked ? mask : NULL,
+					.stage = stages[s].stage,
+				};
+				const char *stage = stages[s].name;
+				const char *variant = masked ? "mask" : "none";
+
+#if EPD_FILM_VERSION == 231
+				if (epd->middle_scan) {
+					report(options, "odd_pixels", panel, stage, variant, "line",
+					       bytes, measure(options, odd_call, &c));
+					report(options, "even_pixels", panel, stage, variant, "line",
+					       bytes, measure(options, even_call, &c));
+				} else {
+					report(options, "all_pixels", panel, stage, variant, "line",
+					       bytes, measure(options, all_call, &c));
+				}
+#endif
+#if EPD_FILM_VERSION != 230
+				report(options, "encode_line", panel, stage, variant, "line",
+				       bytes, measure(options, encode_call, &c));
+#endif
+				report(options, "one_line", panel, stage, variant, "line",
+				       bytes, measure(options, one_line_call, &c));
+
+				spi->mapped = mapped;
+				report(options, "one_line_spi_mapped", panel, stage, variant, "line",
+				       bytes, measure(options, one_line_call, &c));
+				spi->mapped = NULL;
+			}
+		}
+		EPD_destroy(epd);
+	}
+	MODEL_SPI_destroy(mapped);
+	SPI_destroy(spi);
+}
+
+
+static int null_delay(useconds_t us) {
+	return 0;
+}
+
+
+// null SPI sink
+// =============
+
+SPI_type *SPI_create(const char *spi_path, uint32_t bps) {
+	SPI_type *spi = calloc(1, sizeof(SPI_type));
+	if (NULL == spi) {
+		err(1, "cannot allocate SPI sink");
+	}
+	return spi;
+}
+
+bool SPI_destroy(SPI_type *spi) {
+	free(spi);
+	return true;
+}
+
+// count the bytes, the zero bytes of SPI_on and SPI_off included
+static void sink(SPI_type *spi, const void *buffer, size_t length) {
+	__asm__ __volatile__("" : : "r"(buffer) : "memory");  // the data was read
+	spi->bytes += length;
+	if (spi->hashing) {
+		const uint8_t *p = buffer;
+		for (size_t i = 0; i < length; ++i) {
+			spi->hash = (spi->hash ^ p[i]) * 16777619u;
+		}
+	}
+}
+
+void SPI_on(SPI_type *spi) {
+	sink(spi, CU8(0x00), 1);
+	if (NULL != spi->mapped) {
+		MODEL_SPI_on(spi->mapped);
+	}
+}
+
+void SPI_off(SPI_type *spi) {
+	sink(spi, CU8(0x00), 1);
+	if (NULL != spi->mapped) {
+		MODEL_SPI_off(spi->mapped);
+	}
+}
+
+void SPI_send(SPI_type *spi, const void *buffer, size_t length) {
+	sink(spi, buffer, length);
+	if (NULL != spi->mapped) {
+		MODEL_SPI_send(spi->mapped, buffer, length);
+	}
+}
+
+void SPI_read(SPI_type *spi, const void *buffer, void *received, size_t length) {
+	sink(spi, buffer, length);
+	if (NULL != spi->mapped) {
+		MODEL_SPI_read(spi->mapped, buffer, received, length);
+	} else {
+		memset(received, 0, length);
+	}
+}
+
+void SPI_session_begin(SPI_type *spi) {
+	if (NULL != spi->mapped) {
+		MODEL_SPI_session_begin(spi->mapped);
+	}
+}
+
+void SPI_session_end(SPI_type *spi) {
+	if (NULL != spi->mapped) {
+		MODEL_SPI_session_end(spi->mapped);
+	}
+}
+
+void SPI_batch_begin(SPI_type *spi) {
+	if (NULL != spi->mapped) {
+		MODEL_SPI_batch_begin(spi->mapped);
+	}
+}
+
+void SPI_batch_end(SPI_type *spi) {
+	if (NULL != spi->mapped) {
+		MODEL_SPI_batch_end(spi->mapped);
+	}
+}
+
+void SPI_flush(SPI_type *spi) {
+	if (NULL != spi->mapped) {
+		MODEL_SPI_flush(spi->mapped);
+	}
+}
+
+void SPI_set_speed(SPI_type *spi, uint32_t bps) {
+	if (NULL != spi->mapped) {
+		MODEL_SPI_set_speed(spi->mapped, bps);
+	}
+}
+
+
+// null GPIO
+// =========
+
+void GPIO_write(GPIO_pin_type pin, int value) {
+}
+
+void GPIO_write_pins(const GPIO_pin_value *pins, size_t count) {
+}
+
+int GPIO_read(GPIO_pin_type pin) {
+	return 0;
+}
+
+bool GPIO_wait_edge(GPIO_pin_type pin, int level, int timeout_ms) {
+	return true;
+}
+
+void GPIO_pwm_write(GPIO_pin_type pin, uint32_t value) {
+}
@@ -13,12 +13,12 @@
 // governing permissions and limitations under the License.
 
 
-#define VERSION 4
+#define VERSION 5
 
 #define STR1(x) #x
 #define STR(x) STR1(x)
 
-#define FUSE_USE_VERSION 26
+#define FUSE_USE_VERSION 28
 
 #include <stdint.h>
 #include <fuse.h>
@@ -29,10 +29,22 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <err.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
 
 #include "gpio.h"
 #include "spi.h"
+#include "stage_timer.h"
 #include "epd.h"
+#include "epd_ipc.h"
+#include "special_memcpy.h"
+#include "dither.h"
+#include "spi_speed.h"
 #include EPD_IO
 
 
@@ -47,18 +59,21 @@ static const char *current_path          = "/current";          // the current s
 static const char *current_inverted_path = "/current_inverse";  // the current screen image
 static const char *display_path          = "/display";          // the next image to display
 static const char *display_inverted_path = "/display_inverse";  // the next image to display
+static const char *display_gray_path     = "/display_gray";     // 8 bit grayscale, dithered into display
+static const char *dither_path           = "/dither";           // dithering method for display_gray
+static const char *region_path           = "/region";           // rectangle changed by 'P' and 'F'
+static const char *frame_path            = "/frame";            // whole image, queued on close
+static const char *frame_inverted_path   = "/frame_inverse";    // whole image, queued on close
 static const char *command_path          = "/command";          // any write transfers display -> EPD and updates current
 static const char *temperature_path      = "/temperature";      // read/write temperature compensation setting
 static const char *pu_stagetime_path     = "/pu_stagetime";     // stagetime to use for 'F' command,
                                                                 // bypassing temperature compensation.
 static const char *error_path            = "/error";            // error text
-static const char *spi_device = SPI_DEVICE;        // default SPI device path
-static const uint32_t spi_bps = SPI_BPS;           // default SPI device speed
-
-// expect that external process changes this just before update command
-// by sending text string e.g. shell:  echo 19 > /dev/epd/temperature
-static int temperature = 25;                       // for external temperature compensation
-static int pu_stagetime = 500;                     // stagetime to use in 'F' command
+static const char *sequence_path         = "/sequence";         // queued, running and completed command numbers
+static const char *statistics_path       = "/statistics";       // counters for merged and dropped frames
+static const char *status_path           = "/status";           // update thread state, pollable for completion
+static const char *spi_speed_path        = "/spi_speed";        // SPI clock in bps, "auto" to calibrate
+static const char *socket_path = NULL;             // control socket (NULL => disabled)
 
 #define MAKE_STRING_HELPER(s) #s
 #define MAKE_STRING(s) MAKE_STRING_HELPER(s)
@@ -106,20 +121,191 @@ static const char *error_texts[] = {
 };
 
 // need to sync size with above (max of all sizes)
-// this will be the next display
-static char display_buffer[264 * 176 / 8];
+#define DISPLAY_BUFFER_SIZE (264 * 176 / 8)
+
+#if DISPLAY_BUFFER_SIZE != EPD_IPC_FRAME_SIZE
+#error "EPD_IPC_FRAME_SIZE must match DISPLAY_BUFFER_SIZE"
+#endif
 
-// this is the current display
-static char current_buffer[sizeof(display_buffer)];
 
-static const struct panel_struct *panel = NULL;
-static EPD_type *epd = NULL;
-static SPI_type *spi = NULL;
+// commands are run by a separate update thread so that a write to
+// /command returns immediately; each queued command carries a copy
+// of the display buffer and settings taken when it was written.
+// an update queued behind another update that has not started yet
+// replaces it, since only the newest frame needs to be displayed
+#define COMMAND_QUEUE_SIZE 8
+
+// one bit per display line (line l is bit (l & 7) of byte l / 8).
+// writes to the display buffer mark the lines they touch and each
+// queued update takes the marks collected since the previous one; a
+// partial update then only scans the marked lines that differ from
+// the current image
+#define LINE_MAP_SIZE ((176 + 7) / 8)
+
+// the statistics file: the queue counters then six per stage
+#define STATISTICS_TEXT_SIZE 1024
+
+// a rectangle of pixels x0 <= x < x1 of the lines y0 <= y < y1.  'P'
+// and 'F' only change the pixels inside the region set when they were
+// queued, the rest of the panel is not touched; merged updates use the
+// rectangle covering both regions
+typedef struct {
+	int x0;
+	int y0;
+	int x1;
+	int y1;
+} region_type;
+
+typedef struct {
+	char command;
+	unsigned long sequence;
+	unsigned long merged;          // number of older updates replaced by this one
+	int temperature;
+	int pu_stagetime;
+	uint8_t line_map[LINE_MAP_SIZE];  // lines written for this update
+	region_type region;            // pixels a partial update may change
+	char frame[DISPLAY_BUFFER_SIZE];
+} command_type;
+
+typedef struct {
+	pthread_mutex_t lock;          // protects queue and the device display and current buffers
+	pthread_cond_t not_empty;      // signalled when a command is queued or on stop
+	pthread_cond_t not_full;       // signalled when the update thread takes a command
+	command_type entry[COMMAND_QUEUE_SIZE];
+	command_type current;          // copy of the command being run
+	size_t head;                   // index of oldest queued command
+	size_t count;                  // number of queued commands
+	unsigned long queued;          // sequence number of most recently queued command
+	unsigned long running;         // sequence number of the command in progress (0 => idle)
+	unsigned long completed;       // sequence number of most recently completed command
+	unsigned long merged_frames;   // updates that replaced one or more older updates
+	unsigned long dropped_frames;  // updates that were replaced before being displayed
+	unsigned long scanned_lines;   // lines sent by partial updates
+	unsigned long skipped_lines;   // lines not sent by partial updates as unchanged
+	STAGE_statistics stages[EPD_STAGE_COUNT];  // stage timing as of the last completed command
+	struct status_reader_struct *readers;  // open handles of the status file
+	bool started;
+	bool stop;
+	pthread_t thread;
+} queue_type;
+
+
+// each open of the status file remembers the last completion it has
+// seen; poll reports it readable once a later command has completed
+typedef struct status_reader_struct {
+	struct status_reader_struct *next;
+	unsigned long seen;            // completed sequence number at open or last read
+	struct fuse_pollhandle *poll_handle;  // pending poll to be notified (or NULL)
+} status_reader_type;
+
+
+// one process can drive several panels, each with its own SPI device,
+// control pins, buffers and update thread.  Panel N appears as the
+// subdirectory /N and the root directory is the same as /0
+#define MAX_DEVICES 4
+
+typedef struct {
+	int panel_on;
+	int border;
+	int discharge;
+#if EPD_PWM_REQUIRED
+	int pwm;
+#endif
+	int reset;
+	int busy;
+} pins_type;
+
+typedef struct {
+	const struct panel_struct *panel;
+	const char *spi_device;
+	pins_type pins;
+	bool pins_set;                 // pins given on command line
+
+	EPD_type *epd;
+	SPI_type *spi;
+
+	// expect that external process changes this just before update command
+	// by sending text string e.g. shell:  echo 19 > /dev/epd/temperature
+	int temperature;               // for external temperature compensation
+	int pu_stagetime;              // stagetime to use in 'F' command
+	DITHER_method dither;          // method used by display_gray
+	STAGE_finish finish;           // end of timed stages (--finish)
+	region_type region;            // copied by each queued update
+
+	// the update thread owns the SPI, so a new clock is left for it
+	// to set before the next command (protected by queue.lock)
+	uint32_t spi_bps;              // SPI clock in use (--spi-speed)
+	uint32_t spi_request;          // clock to set (0 => none)
+	bool spi_calibrate;            // find the fastest clock that reads back
+
+	char display_buffer[DISPLAY_BUFFER_SIZE];  // this will be the next display
+	char current_buffer[DISPLAY_BUFFER_SIZE];  // this is the current display
+	uint8_t dirty_lines[LINE_MAP_SIZE];        // lines of display written since the last queued update
+
+	queue_type queue;
+
+	// shared frame buffer and doorbell (only with --socket)
+	EPD_shm_type *shm;
+	int shm_fd;
+	int doorbell_fd;
+} device_type;
+
+static device_type devices[MAX_DEVICES];
+static int device_count = 1;
+
+
+// a writer of the frame file collects a whole image in its own buffer
+// which is queued in one step when the file is closed.  The image may
+// be preceded by a header of "EPD" and the command character, without
+// it the command is 'U'
+#define FRAME_HEADER "EPD"
+#define FRAME_HEADER_SIZE 4
+
+typedef struct {
+	size_t length;                 // highest offset written
+	bool bit_reversed;
+	bool inverted;
+	char data[FRAME_HEADER_SIZE + DISPLAY_BUFFER_SIZE];
+} frame_writer_type;
+
+
+// a writer of the display_gray file sends 8 bit pixels, one byte per
+// pixel row by row.  Each row is dithered into display as soon as it
+// is complete, so only one row and the diffusion error are kept; the
+// writes must be sequential and a write at offset zero starts again
+typedef struct {
+	size_t offset;                 // next offset expected
+	size_t fill;                   // bytes of the current row received
+	DITHER_type dither;
+	uint8_t row[DITHER_MAX_WIDTH];
+} gray_writer_type;
 
 
 // function prototypes
-static void special_memcpy(char *d, const char *s, size_t size, bool bit_reversed, bool inverted);
-static void run_command(const char c);
+static device_type *path_device(const char **path);
+static bool is_frame_path(const char *path, bool *bit_reversed, bool *inverted);
+static int frame_commit(device_type *device, frame_writer_type *writer);
+static int gray_write(device_type *device, gray_writer_type *writer,
+		      const char *buffer, size_t size, off_t offset);
+static int queue_command(device_type *device, char c, const char *frame,
+			 int temperature, int pu_stagetime, bool wait, unsigned long *sequence);
+static void *update_thread(void *arg);
+static size_t sequence_text(device_type *device, char *buffer, size_t size);
+static size_t statistics_text(device_type *device, char *buffer, size_t size);
+static size_t status_text(device_type *device, char *buffer, size_t size);
+static void notify_status_readers(device_type *device);
+static void mark_lines(device_type *device, size_t offset, size_t size);
+static bool is_region_path(const char *path);
+static size_t region_text(device_type *device, char *buffer, size_t size);
+static int region_parse(device_type *device, const char *buffer, size_t size);
+static bool full_region(device_type *device, const region_type *region);
+static void region_union(region_type *region, const region_type *other);
+static void run_command(device_type *device, const command_type *command);
+static void set_spi_speed(device_type *device, uint32_t bps, bool calibrate);
+static bool ipc_start(void);
+static void ipc_stop(void);
+static void ipc_close(void);
+static void ipc_signal_complete(void);
 
 
 // fuse callbacks
@@ -130,20 +316,25 @@ static int display_access(const char *path, int mode) {
 }
 
 
-static int display_subdir_getattr(const char *path, struct stat *stbuf) {
+static int display_subdir_getattr(device_type *device, const char *path, struct stat *stbuf) {
 	if (strcmp(path, current_path) == 0 ||
 	    strcmp(path, current_inverted_path) == 0) {
 		stbuf->st_mode = S_IFREG | 0444;
 		stbuf->st_nlink = 1;
-		stbuf->st_size = panel->byte_count;
+		stbuf->st_size = device->panel->byte_count;
 	} else if (strcmp(path, display_path) == 0 ||
 		   strcmp(path, display_inverted_path) == 0) {
 		stbuf->st_mode = S_IFREG | 0666;
 		stbuf->st_nlink = 1;
-		stbuf->st_size = panel->byte_count;
+		stbuf->st_size = device->panel->byte_count;
 		//stbuf->st_atim.tv_sec = 100000;
 		//stbuf->st_mtim.tv_sec = 200000;
 		//stbuf->st_ctim.tv_sec = 300000;
+	} else if (strcmp(path, frame_path) == 0 ||
+		   strcmp(path, frame_inverted_path) == 0) {
+		stbuf->st_mode = S_IFREG | 0222;
+		stbuf->st_nlink = 1;
+		stbuf->st_size = 0;
 	} else {
 		return -ENOENT;
 	}
@@ -152,6 +343,7 @@ static int display_subdir_getattr(const char *path, struct stat *stbuf) {
 
 
 static int display_getattr(const char *path, struct stat *stbuf) {
+	device_type *device = path_device(&path);
 
 	memset(stbuf, 0, sizeof(struct stat));
 	if (strcmp(path, "/") == 0) {
@@ -165,7 +357,7 @@ static int display_getattr(const char *path, struct stat *stbuf) {
 
 	} else if (strncmp(path, "/BE/", 4) == 0 ||
 		   strncmp(path, "/LE/", 4) == 0) {
-		return display_subdir_getattr(path + 3, stbuf);
+		return display_subdir_getattr(device, path + 3, stbuf);
 
 	} else if (strcmp(path, version_path) == 0) {
 		stbuf->st_mode = S_IFREG | 0444;
@@ -175,7 +367,7 @@ static int display_getattr(const char *path, struct stat *stbuf) {
 	} else if (strcmp(path, panel_path) == 0) {
 		stbuf->st_mode = S_IFREG | 0444;
 		stbuf->st_nlink = 1;
-		stbuf->st_size = strlen(panel->description);
+		stbuf->st_size = strlen(device->panel->description);
 
 	} else if (strcmp(path, command_path) == 0) {
 		stbuf->st_mode = S_IFREG | 0222;
@@ -192,13 +384,54 @@ static int display_getattr(const char *path, struct stat *stbuf) {
 		stbuf->st_nlink = 1;
 		stbuf->st_size = 5;
 
+	} else if (strcmp(path, dither_path) == 0) {
+		stbuf->st_mode = S_IFREG | 0666;
+		stbuf->st_nlink = 1;
+		stbuf->st_size = strlen(DITHER_name(device->dither)) + 1;
+
+	} else if (strcmp(path, spi_speed_path) == 0) {
+		stbuf->st_mode = S_IFREG | 0666;
+		stbuf->st_nlink = 1;
+		stbuf->st_size = 9;
+
+	} else if (is_region_path(path)) {
+		char r_buffer[64];
+		stbuf->st_mode = S_IFREG | 0666;
+		stbuf->st_nlink = 1;
+		stbuf->st_size = region_text(device, r_buffer, sizeof(r_buffer));
+
+	} else if (strcmp(path, display_gray_path) == 0) {
+		stbuf->st_mode = S_IFREG | 0222;
+		stbuf->st_nlink = 1;
+		stbuf->st_size = 0;
+
 	} else if (strcmp(path, error_path) == 0) {
 		stbuf->st_mode = S_IFREG | 0444;
 		stbuf->st_nlink = 1;
-		stbuf->st_size = (epd ? strlen(error_texts[EPD_status(epd)]) : 0);
+		stbuf->st_size = (device->epd ? strlen(error_texts[EPD_status(device->epd)]) : 0);
+
+	} else if (strcmp(path, sequence_path) == 0) {
+		char s_buffer[64];
+		stbuf->st_mode = S_IFREG | 0444;
+		stbuf->st_nlink = 1;
+		stbuf->st_size = sequence_text(device, s_buffer, sizeof(s_buffer));
+
+	} else if (strcmp(path, statistics_path) == 0) {
+		char s_buffer[STATISTICS_TEXT_SIZE];
+		stbuf->st_mode = S_IFREG | 0444;
+		stbuf->st_nlink = 1;
+		stbuf->st_size = statistics_text(device, s_buffer, sizeof(s_buffer));
+
+	} else if (strcmp(path, status_path) == 0) {
+		char s_buffer[64];
+		stbuf->st_mode = S_IFREG | 0444;
+		stbuf->st_nlink = 1;
+		pthread_mutex_lock(&device->queue.lock);
+		stbuf->st_size = status_text(device, s_buffer, sizeof(s_buffer));
+		pthread_mutex_unlock(&device->queue.lock);
 
 	} else {
-		return display_subdir_getattr(path, stbuf);
+		return display_subdir_getattr(device, path, stbuf);
 	}
 	return 0;
 }
@@ -208,21 +441,42 @@ static int display_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
 	(void) offset;
 	(void) fi;
 
+	// only the root lists the panel subdirectories
+	bool root = strcmp(path, "/") == 0;
+	path_device(&path);
+
 	if (strcmp(path, "/") == 0) {
 		filler(buf, ".", NULL, 0);
 		filler(buf, "..", NULL, 0);
+		if (root) {
+			for (int i = 0; i < device_count; ++i) {
+				char name[2] = {'0' + i, '\0'};
+				filler(buf, name, NULL, 0);
+			}
+		}
 		filler(buf, "BE", NULL, 0);
 		filler(buf, "LE", NULL, 0);
 		filler(buf, current_path + 1, NULL, 0);
 		filler(buf, current_inverted_path + 1, NULL, 0);
 		filler(buf, display_path + 1, NULL, 0);
 		filler(buf, display_inverted_path + 1, NULL, 0);
+		filler(buf, display_gray_path + 1, NULL, 0);
+		filler(buf, frame_path + 1, NULL, 0);
+		filler(buf, frame_inverted_path + 1, NULL, 0);
 		filler(buf, panel_path + 1, NULL, 0);
 		filler(buf, command_path + 1, NULL, 0);
 		filler(buf, temperature_path + 1, NULL, 0);
 		filler(buf, pu_stagetime_path + 1, NULL, 0);
+		filler(buf, dither_path + 1, NULL, 0);
+		filler(buf, spi_speed_path + 1, NULL, 0);
+		if (EPD_PARTIAL_REGION_AVAILABLE) {
+			filler(buf, region_path + 1, NULL, 0);
+		}
 		filler(buf, version_path + 1, NULL, 0);
 		filler(buf, error_path + 1, NULL, 0);
+		filler(buf, sequence_path + 1, NULL, 0);
+		filler(buf, statistics_path + 1, NULL, 0);
+		filler(buf, status_path + 1, NULL, 0);
 		return 0;
 	} else if (strcmp(path, "/BE") == 0 ||
 		   strcmp(path, "/LE") == 0) {
@@ -232,23 +486,79 @@ static int display_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
 		filler(buf, current_inverted_path + 1, NULL, 0);
 		filler(buf, display_path + 1, NULL, 0);
 		filler(buf, display_inverted_path + 1, NULL, 0);
+		filler(buf, frame_path + 1, NULL, 0);
+		filler(buf, frame_inverted_path + 1, NULL, 0);
 		return 0;
 	}
 	return -ENOENT;
 }
 
 static int display_open(const char *path, struct fuse_file_info *fi) {
+	device_type *device = path_device(&path);
 	bool write_allowed = false;
 
 	// read-write items
 	if (strcmp(path, command_path) == 0 ||
 	    strcmp(path, temperature_path) == 0 ||
-	    strcmp(path, pu_stagetime_path) == 0) {
+	    strcmp(path, pu_stagetime_path) == 0 ||
+	    strcmp(path, dither_path) == 0 ||
+	    strcmp(path, spi_speed_path) == 0 ||
+	    is_region_path(path)) {
 		write_allowed = true;
 	} else if (strcmp(path, panel_path) == 0 ||
 		   strcmp(path, version_path) == 0 ||
 		   strcmp(path, error_path) == 0) {
 		write_allowed = false;
+	} else if (strcmp(path, sequence_path) == 0 ||
+		   strcmp(path, statistics_path) == 0) {
+		// contents change as commands run, so bypass the page cache
+		fi->direct_io = 1;
+		write_allowed = false;
+	} else if (strcmp(path, status_path) == 0) {
+		if ((fi->flags & 3) != O_RDONLY) {
+			return -EACCES;
+		}
+		status_reader_type *reader = malloc(sizeof(status_reader_type));
+		if (NULL == reader) {
+			return -ENOMEM;
+		}
+		reader->poll_handle = NULL;
+		pthread_mutex_lock(&device->queue.lock);
+		reader->seen = device->queue.completed;
+		reader->next = device->queue.readers;
+		device->queue.readers = reader;
+		pthread_mutex_unlock(&device->queue.lock);
+		fi->fh = (uint64_t)(uintptr_t)reader;
+		fi->direct_io = 1;
+		return 0;
+	} else if (is_frame_path(path, NULL, NULL)) {
+		if ((fi->flags & 3) != O_WRONLY) {
+			return -EACCES;
+		}
+		frame_writer_type *writer = malloc(sizeof(frame_writer_type));
+		if (NULL == writer) {
+			return -ENOMEM;
+		}
+		writer->length = 0;
+		is_frame_path(path, &writer->bit_reversed, &writer->inverted);
+		memset(writer->data, 0, sizeof(writer->data));
+		fi->fh = (uint64_t)(uintptr_t)writer;
+		fi->direct_io = 1;
+		return 0;
+	} else if (strcmp(path, display_gray_path) == 0) {
+		if ((fi->flags & 3) != O_WRONLY) {
+			return -EACCES;
+		}
+		gray_writer_type *writer = malloc(sizeof(gray_writer_type));
+		if (NULL == writer) {
+			return -ENOMEM;
+		}
+		writer->offset = 0;
+		writer->fill = 0;
+		DITHER_begin(&writer->dither, device->dither, device->panel->width);
+		fi->fh = (uint64_t)(uintptr_t)writer;
+		fi->direct_io = 1;
+		return 0;
 	} else {
 		if (strncmp(path, "/BE/", 4) == 0) {
 			path += 3;
@@ -295,9 +605,19 @@ static int display_create(const char *path, mode_t mode, struct fuse_file_info *
 	(void) mode;
 	(void) fi;
 
+	const char *full_path = path;
+	path_device(&path);
+	if (is_frame_path(path, NULL, NULL) ||
+	    strcmp(path, display_gray_path) == 0) {
+		return display_open(full_path, fi);
+	}
+
 	if (strcmp(path, command_path) == 0 ||
 	    strcmp(path, temperature_path) == 0 ||
-	    strcmp(path, pu_stagetime_path) == 0) {
+	    strcmp(path, pu_stagetime_path) == 0 ||
+	    strcmp(path, dither_path) == 0 ||
+	    strcmp(path, spi_speed_path) == 0 ||
+	    is_region_path(path)) {
 		return 0;
 	}
 
@@ -318,9 +638,19 @@ static int display_create(const char *path, mode_t mode, struct fuse_file_info *
 
 static int display_truncate(const char *path, off_t offset) {
 	(void) offset;
+
+	path_device(&path);
+	if (is_frame_path(path, NULL, NULL) ||
+	    strcmp(path, display_gray_path) == 0) {
+		return 0;  // always starts empty
+	}
+
 	if (strcmp(path, command_path) == 0 ||
 	    strcmp(path, temperature_path) == 0 ||
-	    strcmp(path, pu_stagetime_path) == 0) {
+	    strcmp(path, pu_stagetime_path) == 0 ||
+	    strcmp(path, dither_path) == 0 ||
+	    strcmp(path, spi_speed_path) == 0 ||
+	    is_region_path(path)) {
 		return 0;
 	}
 
@@ -358,14 +688,14 @@ static int buffer_read(char *buffer, size_t size, off_t offset,
 
 static int display_read(const char *path, char *buffer, size_t size, off_t offset,
 			struct fuse_file_info *fi) {
-	(void) fi;
+	device_type *device = path_device(&path);
 
 	if (strcmp(path, version_path) == 0) {
 		return buffer_read(buffer, size, offset, version_buffer, VERSION_SIZE, false, false);
 	} else if (strcmp(path, panel_path) == 0) {
-		return buffer_read(buffer, size, offset, panel->description, strlen(panel->description), false, false);
+		return buffer_read(buffer, size, offset, device->panel->description, strlen(device->panel->description), false, false);
 	} else if (strcmp(path, temperature_path) == 0) {
-		int t = temperature;
+		int t = device->temperature;
 		if (t < -99) {
 			t = -99;
 		} else if  (t > 99) {
@@ -375,7 +705,7 @@ static int display_read(const char *path, char *buffer, size_t size, off_t offse
 		int length = snprintf(t_buffer, sizeof(t_buffer), "%3d\n", t);
 		return buffer_read(buffer, size, offset, t_buffer, length, false, false);
 	} else if (strcmp(path, pu_stagetime_path) == 0) {
-		int s = pu_stagetime;
+		int s = device->pu_stagetime;
 		if (s < 50) {
 			s = 50;
 		} else if (s > 2000) {
@@ -384,9 +714,40 @@ static int display_read(const char *path, char *buffer, size_t size, off_t offse
 		char s_buffer[16];
 		int length = snprintf(s_buffer, sizeof(s_buffer), "%4d\n", s);
 		return buffer_read(buffer, size, offset, s_buffer, length, false, false);
+	} else if (strcmp(path, dither_path) == 0) {
+		char d_buffer[32];
+		int length = snprintf(d_buffer, sizeof(d_buffer), "%s\n", DITHER_name(device->dither));
+		return buffer_read(buffer, size, offset, d_buffer, length, false, false);
+	} else if (strcmp(path, spi_speed_path) == 0) {
+		pthread_mutex_lock(&device->queue.lock);
+		uint32_t bps = device->spi_bps;
+		pthread_mutex_unlock(&device->queue.lock);
+		char s_buffer[16];
+		int length = snprintf(s_buffer, sizeof(s_buffer), "%u\n", bps);
+		return buffer_read(buffer, size, offset, s_buffer, length, false, false);
+	} else if (is_region_path(path)) {
+		char r_buffer[64];
+		size_t length = region_text(device, r_buffer, sizeof(r_buffer));
+		return buffer_read(buffer, size, offset, r_buffer, length, false, false);
 	} else if (strcmp(path, error_path) == 0) {
-		const char *t_buf = error_texts[EPD_status(epd)];
+		const char *t_buf = (device->epd ? error_texts[EPD_status(device->epd)] : "");
 		return buffer_read(buffer, size, offset, t_buf, strlen(t_buf), false, false);
+	} else if (strcmp(path, sequence_path) == 0) {
+		char s_buffer[64];
+		size_t length = sequence_text(device, s_buffer, sizeof(s_buffer));
+		return buffer_read(buffer, size, offset, s_buffer, length, false, false);
+	} else if (strcmp(path, statistics_path) == 0) {
+		char s_buffer[STATISTICS_TEXT_SIZE];
+		size_t length = statistics_text(device, s_buffer, sizeof(s_buffer));
+		return buffer_read(buffer, size, offset, s_buffer, length, false, false);
+	} else if (strcmp(path, status_path) == 0) {
+		char s_buffer[64];
+		status_reader_type *reader = (status_reader_type *)(uintptr_t)fi->fh;
+		pthread_mutex_lock(&device->queue.lock);
+		size_t length = status_text(device, s_buffer, sizeof(s_buffer));
+		reader->seen = device->queue.completed;
+		pthread_mutex_unlock(&device->queue.lock);
+		return buffer_read(buffer, size, offset, s_buffer, length, false, false);
 	}
 
 	// test big/little endian
@@ -398,17 +759,26 @@ static int display_read(const char *path, char *buffer, size_t size, off_t offse
 		bit_reversed = true;
 	}
 
+	const char *source = NULL;
+	bool inverted = false;
 	if (strcmp(path, current_path) == 0) {
-		return buffer_read(buffer, size, offset, current_buffer, panel->byte_count, bit_reversed, false);
+		source = device->current_buffer;
 	} else if (strcmp(path, current_inverted_path) == 0) {
-		return buffer_read(buffer, size, offset, current_buffer, panel->byte_count, bit_reversed, true);
+		source = device->current_buffer;
+		inverted = true;
 	} else if (strcmp(path, display_path) == 0) {
-		return buffer_read(buffer, size, offset, display_buffer, panel->byte_count, bit_reversed, false);
+		source = device->display_buffer;
 	} else if (strcmp(path, display_inverted_path) == 0) {
-		return buffer_read(buffer, size, offset, display_buffer, panel->byte_count, bit_reversed, true);
+		source = device->display_buffer;
+		inverted = true;
+	} else {
+		return -ENOENT;
 	}
 
-	return -ENOENT;
+	pthread_mutex_lock(&device->queue.lock);
+	int n = buffer_read(buffer, size, offset, source, device->panel->byte_count, bit_reversed, inverted);
+	pthread_mutex_unlock(&device->queue.lock);
+	return n;
 }
 
 
@@ -418,10 +788,27 @@ static int display_write(const char *path, const char *buffer, size_t size, off_
 	(void) fi;
 	bool inverted = false;
 	bool bit_reversed = false;
+	device_type *device = path_device(&path);
 
-	if (strcmp(path, command_path) == 0) {
+	if (is_frame_path(path, NULL, NULL)) {
+		frame_writer_type *writer = (frame_writer_type *)(uintptr_t)fi->fh;
+		if (offset + size > sizeof(writer->data)) {
+			return -EFBIG;
+		}
+		memcpy(writer->data + offset, buffer, size);
+		if (offset + size > writer->length) {
+			writer->length = offset + size;
+		}
+		return size;
+	} else if (strcmp(path, display_gray_path) == 0) {
+		return gray_write(device, (gray_writer_type *)(uintptr_t)fi->fh, buffer, size, offset);
+	} else if (strcmp(path, command_path) == 0) {
 		if (size > 0) {
-			run_command(buffer[0]);
+			int rc = queue_command(device, buffer[0], NULL,
+					       device->temperature, device->pu_stagetime, true, NULL);
+			if (rc < 0) {
+				return rc;
+			}
 		}
 		return size;
 	} else if (strcmp(path, temperature_path) == 0) {
@@ -429,7 +816,7 @@ static int display_write(const char *path, const char *buffer, size_t size, off_
 			char *end = NULL;
 			long int n = strtol(buffer, &end, 0);
 			if (buffer != end && n >= -99 && n <= 99) {
-				temperature = (int)n;
+				device->temperature = (int)n;
 			}
 		}
 		return size;
@@ -438,10 +825,33 @@ static int display_write(const char *path, const char *buffer, size_t size, off_
 			char *end = NULL;
 			long int s = strtol(buffer, &end, 0);
 			if (buffer != end && s >= 50 && s <= 2000) {
-				pu_stagetime = (int)s;
+				device->pu_stagetime = (int)s;
 			}
 		}
 		return size;
+	} else if (strcmp(path, dither_path) == 0) {
+		DITHER_method method;
+		if (!DITHER_parse(buffer, size, &method)) {
+			return -EINVAL;
+		}
+		device->dither = method;
+		return size;
+	} else if (strcmp(path, spi_speed_path) == 0) {
+		uint32_t bps = 0;
+		bool calibrate = false;
+		if (!SPI_SPEED_parse(buffer, size, &bps, &calibrate) ||
+		    (calibrate && !EPD_PROBE_AVAILABLE)) {
+			return -EINVAL;
+		}
+		pthread_mutex_lock(&device->queue.lock);
+		device->spi_request = bps;
+		device->spi_calibrate = calibrate;
+		pthread_cond_signal(&device->queue.not_empty);
+		pthread_mutex_unlock(&device->queue.lock);
+		return size;
+	} else if (is_region_path(path)) {
+		int rc = region_parse(device, buffer, size);
+		return rc < 0 ? rc : size;
 	}
 
 	// test big/little endian
@@ -458,12 +868,15 @@ static int display_write(const char *path, const char *buffer, size_t size, off_
 		return -ENOENT;
 	}
 
-	len = sizeof(display_buffer);
+	len = sizeof(device->display_buffer);
 	if (offset < len) {
 		if (offset + size > len) {
 			size = len - offset;
 		}
-		special_memcpy(display_buffer + offset, buffer, size, bit_reversed, inverted);
+		pthread_mutex_lock(&device->queue.lock);
+		special_memcpy(device->display_buffer + offset, buffer, size, bit_reversed, inverted);
+		mark_lines(device, offset, size);
+		pthread_mutex_unlock(&device->queue.lock);
 	} else {
 		size = 0;
 	}
@@ -471,52 +884,138 @@ static int display_write(const char *path, const char *buffer, size_t size, off_
 }
 
 
-static void *display_init(struct fuse_conn_info *conn) {
+// set the modes of one panel's pins; done for every panel before any
+// update thread starts, as setting a mode may briefly release the other
+// pins on the same GPIO chip (GPIO_BACKEND=cdev)
+static void device_pins(device_type *device) {
+	GPIO_mode(device->pins.panel_on, GPIO_OUTPUT);
+	GPIO_mode(device->pins.border, GPIO_OUTPUT);
+	GPIO_mode(device->pins.discharge, GPIO_OUTPUT);
+#if EPD_PWM_REQUIRED
+	GPIO_mode(device->pins.pwm, GPIO_PWM);
+#endif
+	GPIO_mode(device->pins.reset, GPIO_OUTPUT);
+	GPIO_mode(device->pins.busy, GPIO_INPUT);
+}
 
-	if (!GPIO_setup()) {
-		warn("GPIO_setup failed");
-		goto done;
-	}
 
-	spi = SPI_create(spi_device, spi_bps);
-	if (NULL == spi) {
-		warn("SPI_setup failed");
-		goto done_gpio;
+// set up one panel and start its update thread
+static bool device_start(device_type *device) {
+
+	device->region.x0 = 0;
+	device->region.y0 = 0;
+	device->region.x1 = device->panel->width;
+	device->region.y1 = device->panel->height;
+
+	// --spi-speed, else the calibrated clock, else the default
+	if (0 == device->spi_bps) {
+		device->spi_bps = SPI_SPEED_load(device->spi_device);
+	}
+	if (0 == device->spi_bps) {
+		device->spi_bps = SPI_BPS;
 	}
 
-	GPIO_mode(panel_on_pin, GPIO_OUTPUT);
-	GPIO_mode(border_pin, GPIO_OUTPUT);
-	GPIO_mode(discharge_pin, GPIO_OUTPUT);
-#if EPD_PWM_REQUIRED
-	GPIO_mode(pwm_pin, GPIO_PWM);
-#endif
-	GPIO_mode(reset_pin, GPIO_OUTPUT);
-	GPIO_mode(busy_pin, GPIO_INPUT);
+	device->spi = SPI_create(device->spi_device, device->spi_bps);
+	if (NULL == device->spi) {
+		warn("SPI_setup failed: %s", device->spi_device);
+		goto done;
+	}
 
-	epd = EPD_create(panel->size,
-			 panel_on_pin,
-			 border_pin,
-			 discharge_pin,
+	device->epd = EPD_create(device->panel->size,
+				 device->pins.panel_on,
+				 device->pins.border,
+				 device->pins.discharge,
 #if EPD_PWM_REQUIRED
-			 pwm_pin,
+				 device->pins.pwm,
 #endif
-			 reset_pin,
-			 busy_pin,
-			 spi);
+				 device->pins.reset,
+				 device->pins.busy,
+				 device->spi);
 
-	if (NULL == epd) {
+	if (NULL == device->epd) {
 		warn("EPD_setup failed");
 		goto done_spi;
 	}
+	EPD_set_stage_finish(device->epd, device->finish);
+
+	// start the update thread
+	device->queue.stop = false;
+	if (0 != pthread_create(&device->queue.thread, NULL, update_thread, device)) {
+		warn("update thread failed");
+		goto done_epd;
+	}
+	device->queue.started = true;
 
-	return (void *)epd;
+	return true;
 
 	// release resources
-//done_epd:
-//        EPD_destroy(epd);
+done_epd:
+	EPD_destroy(device->epd);
+	device->epd = NULL;
 done_spi:
-	SPI_destroy(spi);
-done_gpio:
+	SPI_destroy(device->spi);
+	device->spi = NULL;
+done:
+	return false;
+}
+
+
+// let the update thread finish any queued commands, then release the panel
+static void device_stop(device_type *device) {
+	if (!device->queue.started) {
+		return;
+	}
+	pthread_mutex_lock(&device->queue.lock);
+	device->queue.stop = true;
+	pthread_cond_broadcast(&device->queue.not_empty);
+	pthread_mutex_unlock(&device->queue.lock);
+	pthread_join(device->queue.thread, NULL);
+	device->queue.started = false;
+
+	EPD_destroy(device->epd);
+	device->epd = NULL;
+	SPI_destroy(device->spi);
+	device->spi = NULL;
+
+	if (NULL != device->shm) {
+		munmap(device->shm, sizeof(EPD_shm_type));
+		device->shm = NULL;
+		close(device->shm_fd);
+		close(device->doorbell_fd);
+	}
+}
+
+
+static void *display_init(struct fuse_conn_info *conn) {
+
+	if (!GPIO_setup()) {
+		warn("GPIO_setup failed");
+		goto done;
+	}
+
+	for (int i = 0; i < device_count; ++i) {
+		device_pins(&devices[i]);
+	}
+
+	int started = 0;
+	for (started = 0; started < device_count; ++started) {
+		if (!device_start(&devices[started])) {
+			goto done_devices;
+		}
+	}
+
+	if (NULL != socket_path && !ipc_start()) {
+		goto done_devices;
+	}
+
+	return (void *)devices;
+
+	// release resources
+done_devices:
+	while (--started >= 0) {
+		device_stop(&devices[started]);
+	}
+	ipc_close();
 	GPIO_teardown();
 done:
 	return NULL;
@@ -525,13 +1024,87 @@ done:
 
 static void display_destroy(void *param) {
 	if (NULL != param) {
-		EPD_destroy(epd);
-		SPI_destroy(spi);
+		if (NULL != socket_path) {
+			ipc_stop();
+		}
+		for (int i = 0; i < device_count; ++i) {
+			device_stop(&devices[i]);
+		}
+		ipc_close();
 		GPIO_teardown();
 	}
 }
 
 
+// a frame is queued on the first close, so that any error is
+// returned to the writer; later closes of a dup'ed descriptor see
+// an empty frame and do nothing
+static int display_flush(const char *path, struct fuse_file_info *fi) {
+	device_type *device = path_device(&path);
+	if (!is_frame_path(path, NULL, NULL)) {
+		return 0;
+	}
+	return frame_commit(device, (frame_writer_type *)(uintptr_t)fi->fh);
+}
+
+
+static int display_release(const char *path, struct fuse_file_info *fi) {
+	device_type *device = path_device(&path);
+	if (is_frame_path(path, NULL, NULL)) {
+		free((frame_writer_type *)(uintptr_t)fi->fh);
+		return 0;
+	} else if (strcmp(path, display_gray_path) == 0) {
+		free((gray_writer_type *)(uintptr_t)fi->fh);
+		return 0;
+	} else if (strcmp(path, status_path) != 0) {
+		return 0;
+	}
+
+	status_reader_type *reader = (status_reader_type *)(uintptr_t)fi->fh;
+	pthread_mutex_lock(&device->queue.lock);
+	for (status_reader_type **p = &device->queue.readers; NULL != *p; p = &(*p)->next) {
+		if (reader == *p) {
+			*p = reader->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&device->queue.lock);
+
+	if (NULL != reader->poll_handle) {
+		fuse_pollhandle_destroy(reader->poll_handle);
+	}
+	free(reader);
+	return 0;
+}
+
+
+// only the status file can be polled, it becomes readable when a
+// command completes after the file was opened or last read
+static int display_poll(const char *path, struct fuse_file_info *fi,
+			struct fuse_pollhandle *ph, unsigned *reventsp) {
+	device_type *device = path_device(&path);
+	if (strcmp(path, status_path) != 0) {
+		if (NULL != ph) {
+			fuse_pollhandle_destroy(ph);
+		}
+		*reventsp = POLLIN | POLLRDNORM;
+		return 0;
+	}
+
+	status_reader_type *reader = (status_reader_type *)(uintptr_t)fi->fh;
+	pthread_mutex_lock(&device->queue.lock);
+	if (NULL != ph) {
+		if (NULL != reader->poll_handle) {
+			fuse_pollhandle_destroy(reader->poll_handle);
+		}
+		reader->poll_handle = ph;
+	}
+	*reventsp = (reader->seen != device->queue.completed) ? POLLIN | POLLRDNORM : 0;
+	pthread_mutex_unlock(&device->queue.lock);
+	return 0;
+}
+
+
 static struct fuse_operations display_operations = {
 	.access   = display_access,
 	.getattr  = display_getattr,
@@ -541,173 +1114,1249 @@ static struct fuse_operations display_operations = {
 	.create   = display_create,
 	.read     = display_read,
 	.write    = display_write,
+	.flush    = display_flush,
+	.release  = display_release,
+	.poll     = display_poll,
 	.init     = display_init,
 	.destroy  = display_destroy
 };
 
 
-// bit reversed table
-static const char reverse[256] = {
-//	__00____01____02____03____04____05____06____07____08____09____0a____0b____0c____0d____0e____0f
-	0x00, 0x80, 0x40, 0xc0, 0x20, 0xa0, 0x60, 0xe0, 0x10, 0x90, 0x50, 0xd0, 0x30, 0xb0, 0x70, 0xf0,
-//	__10____11____12____13____14____15____16____17____18____19____1a____1b____1c____1d____1e____1f
-	0x08, 0x88, 0x48, 0xc8, 0x28, 0xa8, 0x68, 0xe8, 0x18, 0x98, 0x58, 0xd8, 0x38, 0xb8, 0x78, 0xf8,
-//	__20____21____22____23____24____25____26____27____28____29____2a____2b____2c____2d____2e____2f
-	0x04, 0x84, 0x44, 0xc4, 0x24, 0xa4, 0x64, 0xe4, 0x14, 0x94, 0x54, 0xd4, 0x34, 0xb4, 0x74, 0xf4,
-//	__30____31____32____33____34____35____36____37____38____39____3a____3b____3c____3d____3e____3f
-	0x0c, 0x8c, 0x4c, 0xcc, 0x2c, 0xac, 0x6c, 0xec, 0x1c, 0x9c, 0x5c, 0xdc, 0x3c, 0xbc, 0x7c, 0xfc,
-//	__40____41____42____43____44____45____46____47____48____49____4a____4b____4c____4d____4e____4f
-	0x02, 0x82, 0x42, 0xc2, 0x22, 0xa2, 0x62, 0xe2, 0x12, 0x92, 0x52, 0xd2, 0x32, 0xb2, 0x72, 0xf2,
-//	__50____51____52____53____54____55____56____57____58____59____5a____5b____5c____5d____5e____5f
-	0x0a, 0x8a, 0x4a, 0xca, 0x2a, 0xaa, 0x6a, 0xea, 0x1a, 0x9a, 0x5a, 0xda, 0x3a, 0xba, 0x7a, 0xfa,
-//	__60____61____62____63____64____65____66____67____68____69____6a____6b____6c____6d____6e____6f
-	0x06, 0x86, 0x46, 0xc6, 0x26, 0xa6, 0x66, 0xe6, 0x16, 0x96, 0x56, 0xd6, 0x36, 0xb6, 0x76, 0xf6,
-//	__70____71____72____73____74____75____76____77____78____79____7a____7b____7c____7d____7e____7f
-	0x0e, 0x8e, 0x4e, 0xce, 0x2e, 0xae, 0x6e, 0xee, 0x1e, 0x9e, 0x5e, 0xde, 0x3e, 0xbe, 0x7e, 0xfe,
-//	__80____81____82____83____84____85____86____87____88____89____8a____8b____8c____8d____8e____8f
-	0x01, 0x81, 0x41, 0xc1, 0x21, 0xa1, 0x61, 0xe1, 0x11, 0x91, 0x51, 0xd1, 0x31, 0xb1, 0x71, 0xf1,
-//	__90____91____92____93____94____95____96____97____98____99____9a____9b____9c____9d____9e____9f
-	0x09, 0x89, 0x49, 0xc9, 0x29, 0xa9, 0x69, 0xe9, 0x19, 0x99, 0x59, 0xd9, 0x39, 0xb9, 0x79, 0xf9,
-//	__a0____a1____a2____a3____a4____a5____a6____a7____a8____a9____aa____ab____ac____ad____ae____af
-	0x05, 0x85, 0x45, 0xc5, 0x25, 0xa5, 0x65, 0xe5, 0x15, 0x95, 0x55, 0xd5, 0x35, 0xb5, 0x75, 0xf5,
-//	__b0____b1____b2____b3____b4____b5____b6____b7____b8____b9____ba____bb____bc____bd____be____bf
-	0x0d, 0x8d, 0x4d, 0xcd, 0x2d, 0xad, 0x6d, 0xed, 0x1d, 0x9d, 0x5d, 0xdd, 0x3d, 0xbd, 0x7d, 0xfd,
-//	__c0____c1____c2____c3____c4____c5____c6____c7____c8____c9____ca____cb____cc____cd____ce____cf
-	0x03, 0x83, 0x43, 0xc3, 0x23, 0xa3, 0x63, 0xe3, 0x13, 0x93, 0x53, 0xd3, 0x33, 0xb3, 0x73, 0xf3,
-//	__d0____d1____d2____d3____d4____d5____d6____d7____d8____d9____da____db____dc____dd____de____df
-	0x0b, 0x8b, 0x4b, 0xcb, 0x2b, 0xab, 0x6b, 0xeb, 0x1b, 0x9b, 0x5b, 0xdb, 0x3b, 0xbb, 0x7b, 0xfb,
-//	__e0____e1____e2____e3____e4____e5____e6____e7____e8____e9____ea____eb____ec____ed____ee____ef
-	0x07, 0x87, 0x47, 0xc7, 0x27, 0xa7, 0x67, 0xe7, 0x17, 0x97, 0x57, 0xd7, 0x37, 0xb7, 0x77, 0xf7,
-//	__f0____f1____f2____f3____f4____f5____f6____f7____f8____f9____fa____fb____fc____fd____fe____ff
-	0x0f, 0x8f, 0x4f, 0xcf, 0x2f, 0xaf, 0x6f, 0xef, 0x1f, 0x9f, 0x5f, 0xdf, 0x3f, 0xbf, 0x7f, 0xff
-};
+// select the panel for a path: "/N" and "/N/..." are panel N and any
+// other path is panel 0; the "/N" prefix is removed from the path
+static device_type *path_device(const char **path) {
+	const char *p = *path;
+	if ('/' == p[0] && p[1] >= '0' && p[1] < '0' + device_count &&
+	    ('/' == p[2] || '\0' == p[2])) {
+		*path = ('\0' == p[2]) ? "/" : p + 2;
+		return &devices[p[1] - '0'];
+	}
+	return &devices[0];
+}
 
 
-// copy buffer
-static void special_memcpy(char *d, const char *s, size_t size, bool bit_reversed, bool inverted) {
-	if (bit_reversed) {
-		if (inverted) {
-			for (size_t n = 0; n < size; ++n) {
-				*d++ = reverse[(unsigned)(*s++)] ^ 0xff;
-			}
-		} else {
-			for (size_t n = 0; n < size; ++n) {
-				*d++ = reverse[(unsigned)(*s++)];
-			}
-		}
-	} else if (inverted) {
-		for (size_t n = 0; n < size; ++n) {
-			*d++ = *s++ ^ 0xff;
-		}
-	} else {
-		memcpy(d, s, size);
+// check for one of the frame files and return its conversion flags
+// (flag pointers may be NULL)
+static bool is_frame_path(const char *path, bool *bit_reversed, bool *inverted) {
+	bool reversed = false;
+	if (strncmp(path, "/BE/", 4) == 0) {
+		path += 3;
+	} else if (strncmp(path, "/LE/", 4) == 0) {
+		path += 3;
+		reversed = true;
+	}
+
+	bool frame_inverted = false;
+	if (strcmp(path, frame_inverted_path) == 0) {
+		frame_inverted = true;
+	} else if (strcmp(path, frame_path) != 0) {
+		return false;
+	}
+
+	if (NULL != bit_reversed) {
+		*bit_reversed = reversed;
+	}
+	if (NULL != inverted) {
+		*inverted = frame_inverted;
 	}
+	return true;
 }
 
-// run a command
-static void run_command(const char c) {
+
+// queue the image collected by a frame writer
+static int frame_commit(device_type *device, frame_writer_type *writer) {
+	const size_t length = writer->length;
+	if (0 == length) {
+		return 0;  // nothing written, or already committed
+	}
+	writer->length = 0;
+
+	const char *image = writer->data;
+	char c = 'U';
+	if (FRAME_HEADER_SIZE + device->panel->byte_count == length &&
+	    0 == memcmp(writer->data, FRAME_HEADER, FRAME_HEADER_SIZE - 1)) {
+		c = writer->data[FRAME_HEADER_SIZE - 1];
+		image += FRAME_HEADER_SIZE;
+	} else if (device->panel->byte_count != length) {
+		return -EINVAL;
+	}
+
 	switch(c) {
-	case 'C':  // clear the display
-		EPD_set_temperature(epd, temperature);
-		EPD_begin(epd);
-		if (EPD_OK != EPD_status(epd)) {
-			warn("EPD_begin failed");
+	case 'U':
+	case 'P':
+	case 'F':
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	char frame[DISPLAY_BUFFER_SIZE];
+	special_memcpy(frame, image, device->panel->byte_count, writer->bit_reversed, writer->inverted);
+	int rc = queue_command(device, c, frame, device->temperature, device->pu_stagetime, true, NULL);
+	return rc < 0 ? rc : 0;
+}
+
+
+// accept grayscale pixels for display_gray, dithering each completed
+// row straight into the display buffer
+static int gray_write(device_type *device, gray_writer_type *writer,
+		      const char *buffer, size_t size, off_t offset) {
+	const size_t width = device->panel->width;
+	const size_t bytes_per_line = width / 8;
+	const size_t length = width * device->panel->height;
+
+	if (0 == offset) {
+		writer->offset = 0;
+		writer->fill = 0;
+		DITHER_begin(&writer->dither, device->dither, width);
+	} else if (offset != writer->offset) {
+		return -ESPIPE;
+	}
+	if (offset >= length) {
+		return -EFBIG;
+	}
+	if (offset + size > length) {
+		size = length - offset;
+	}
+
+	for (size_t n = 0; n < size; ) {
+		size_t k = width - writer->fill;
+		if (k > size - n) {
+			k = size - n;
+		}
+		memcpy(writer->row + writer->fill, buffer + n, k);
+		writer->fill += k;
+		n += k;
+		if (width == writer->fill) {
+			uint8_t bits[DITHER_MAX_WIDTH / 8];
+			size_t line_offset = writer->dither.row * bytes_per_line;
+			DITHER_row(&writer->dither, bits, writer->row);
+			pthread_mutex_lock(&device->queue.lock);
+			memcpy(device->display_buffer + line_offset, bits, bytes_per_line);
+			mark_lines(device, line_offset, bytes_per_line);
+			pthread_mutex_unlock(&device->queue.lock);
+			writer->fill = 0;
 		}
-		EPD_clear(epd);
-		EPD_end(epd);
+	}
+	writer->offset += size;
+	return size;
+}
+
 
-		memset(current_buffer, 0, sizeof(current_buffer));
+// add a command to the queue, waiting if the queue is full, or with
+// wait false returning -EAGAIN (the control socket thread must not
+// block behind a panel that is busy clearing)
+// the display buffer is copied at this point so the next frame can
+// be written while this one is being displayed.
+// if 'frame' is not NULL it replaces the display buffer first.
+// the command's sequence number is stored in 'sequence' (if not NULL)
+static int queue_command(device_type *device, char c, const char *frame,
+			 int temperature, int pu_stagetime, bool wait, unsigned long *sequence) {
+	switch(c) {
+	case 'C':
+	case 'U':
+	case 'P':
+	case 'F':
 		break;
+	default:
+		return 0;  // ignore unknown commands
+	}
 
-	case 'U':  // update with contents of display
-		EPD_set_temperature(epd, temperature);
-		EPD_begin(epd);
-		if (EPD_OK != EPD_status(epd)) {
-			warn("EPD_begin failed");
+	pthread_mutex_lock(&device->queue.lock);
+	if (!device->queue.started) {
+		pthread_mutex_unlock(&device->queue.lock);
+		return -EIO;
+	}
+
+	// last writer wins: replace a waiting update with this one
+	command_type *last = NULL;
+	if ('C' != c && device->queue.count > 0) {
+		last = &device->queue.entry[(device->queue.head + device->queue.count - 1) % COMMAND_QUEUE_SIZE];
+		if ('C' == last->command) {
+			last = NULL;
 		}
-#if EPD_IMAGE_ONE_ARG
-		EPD_image(epd, (const uint8_t *)display_buffer);
-#elif EPD_IMAGE_TWO_ARG
-		EPD_image(epd, (const uint8_t *)current_buffer, (const uint8_t *)display_buffer);
-#else
-#error "unsupported EPD_image() function"
-#endif
-		EPD_end(epd);
+	}
 
-		memcpy(current_buffer, display_buffer, sizeof(display_buffer));
-		break;
+	// refuse before the display buffer is changed
+	if (!wait && NULL == last && COMMAND_QUEUE_SIZE == device->queue.count) {
+		pthread_mutex_unlock(&device->queue.lock);
+		return -EAGAIN;
+	}
 
-	case 'P':  // partial update with contents of display
-	case 'F':  // partial update bypassing temperature compensation for stagetime
-		if (c == 'P') {
-			EPD_set_temperature(epd, temperature);
+	if (NULL != frame && 'C' != c) {
+		memcpy(device->display_buffer, frame, device->panel->byte_count);
+		mark_lines(device, 0, device->panel->byte_count);
+	}
+
+	if (NULL != last) {
+		if ('U' == last->command) {
+			c = 'U';  // a full update also covers any partial change
 		}
-#if EPD_PARTIAL_AVAILABLE
-		else {
-			EPD_set_factored_stage_time(epd, pu_stagetime);
+		last->command = c;
+		last->sequence = ++device->queue.queued;
+		last->merged += 1;
+		last->temperature = temperature;
+		last->pu_stagetime = pu_stagetime;
+		memcpy(last->frame, device->display_buffer, sizeof(device->display_buffer));
+		for (size_t i = 0; i < LINE_MAP_SIZE; ++i) {
+			last->line_map[i] |= device->dirty_lines[i];
 		}
-#endif 
-		EPD_begin(epd);
-		if (EPD_OK != EPD_status(epd)) {
-			warn("EPD_begin failed");
+		region_union(&last->region, &device->region);
+		memset(device->dirty_lines, 0, sizeof(device->dirty_lines));
+		++device->queue.dropped_frames;
+		if (NULL != sequence) {
+			*sequence = last->sequence;
 		}
-#if EPD_PARTIAL_AVAILABLE
-		// use partial update
-		EPD_partial_image(epd, (const uint8_t *)current_buffer, (const uint8_t *)display_buffer);
-#elif EPD_IMAGE_ONE_ARG
-		// no partial so just normal display
-		EPD_image(epd, (const uint8_t *)display_buffer);
-#elif EPD_IMAGE_TWO_ARG
-		// no partial so just normal display
-		EPD_image(epd, (const uint8_t *)current_buffer, (const uint8_t *)display_buffer);
-#else
-#error "unsupported EPD_image() function"
-#endif
 
-#ifndef EPD_PARTIAL_AVAILABLE
-		// Do not switch off COG when doing a partial update.
-		EPD_end(epd);
-#endif
+		pthread_mutex_unlock(&device->queue.lock);
+		return 0;
+	}
 
-		memcpy(current_buffer, display_buffer, sizeof(display_buffer));
-		break;
+	while (COMMAND_QUEUE_SIZE == device->queue.count) {
+		pthread_cond_wait(&device->queue.not_full, &device->queue.lock);
+	}
 
-	default:
-		break;
+	command_type *command = &device->queue.entry[(device->queue.head + device->queue.count) % COMMAND_QUEUE_SIZE];
+	command->command = c;
+	command->sequence = ++device->queue.queued;
+	command->merged = 0;
+	command->temperature = temperature;
+	command->pu_stagetime = pu_stagetime;
+	command->region = device->region;
+	if ('C' != c) {
+		memcpy(command->frame, device->display_buffer, sizeof(device->display_buffer));
+		memcpy(command->line_map, device->dirty_lines, sizeof(command->line_map));
+		memset(device->dirty_lines, 0, sizeof(device->dirty_lines));
+	} else {
+		// after a clear every line of the display buffer differs
+		memset(device->dirty_lines, 0xff, sizeof(device->dirty_lines));
+	}
+	++device->queue.count;
+	if (NULL != sequence) {
+		*sequence = command->sequence;
 	}
+
+	pthread_cond_signal(&device->queue.not_empty);
+	pthread_mutex_unlock(&device->queue.lock);
+	return 0;
 }
 
 
-// values for setting options
-enum {
-     KEY_HELP,
-     KEY_VERSION,
-     KEY_PANEL,
-     KEY_SPI
-};
+// run queued commands until stopped and the queue is empty
+static void *update_thread(void *arg) {
+	device_type *device = arg;
+	command_type *command = &device->queue.current;
 
+	pthread_mutex_lock(&device->queue.lock);
+	for (;;) {
+		while (0 == device->queue.count && !device->queue.stop &&
+		       0 == device->spi_request && !device->spi_calibrate) {
+			pthread_cond_wait(&device->queue.not_empty, &device->queue.lock);
+		}
 
-static struct fuse_opt display_options[] = {
-	FUSE_OPT_KEY("--panel=%s",  KEY_PANEL),
-	FUSE_OPT_KEY("panel=%s",    KEY_PANEL),
+		// a new SPI clock is set between commands
+		if (0 != device->spi_request || device->spi_calibrate) {
+			uint32_t bps = device->spi_request;
+			bool calibrate = device->spi_calibrate;
+			device->spi_request = 0;
+			device->spi_calibrate = false;
+			pthread_mutex_unlock(&device->queue.lock);
 
-	FUSE_OPT_KEY("--spi=%s",    KEY_SPI),
-	FUSE_OPT_KEY("spi=%s",      KEY_SPI),
+			set_spi_speed(device, bps, calibrate);
 
-	FUSE_OPT_KEY("-V",          KEY_VERSION),
-	FUSE_OPT_KEY("--version",   KEY_VERSION),
-	FUSE_OPT_KEY("-h",          KEY_HELP),
-	FUSE_OPT_KEY("--help",      KEY_HELP),
-	FUSE_OPT_END
-};
+			pthread_mutex_lock(&device->queue.lock);
+			continue;
+		}
 
+		if (0 == device->queue.count) {
+			break;  // stopped
+		}
 
-static int option_processor(void *data, const char *arg, int key, struct fuse_args *outargs)
-{
-     switch (key) {
-     case KEY_HELP:
-	     fprintf(stderr,
-		     "usage: %s mountpoint [options]\n"
+		memcpy(command, &device->queue.entry[device->queue.head], sizeof(command_type));
+		device->queue.head = (device->queue.head + 1) % COMMAND_QUEUE_SIZE;
+		--device->queue.count;
+		device->queue.running = command->sequence;
+		if (command->merged > 0) {
+			++device->queue.merged_frames;
+		}
+		pthread_cond_signal(&device->queue.not_full);
+		pthread_mutex_unlock(&device->queue.lock);
+
+		run_command(device, command);
+
+		pthread_mutex_lock(&device->queue.lock);
+		EPD_stage_statistics(device->epd, device->queue.stages);
+		device->queue.running = 0;
+		device->queue.completed = command->sequence;
+		if (NULL != device->shm) {
+			__atomic_store_n(&device->shm->completed, (uint32_t)command->sequence, __ATOMIC_RELEASE);
+			ipc_signal_complete();
+		}
+		notify_status_readers(device);
+	}
+	pthread_mutex_unlock(&device->queue.lock);
+	return NULL;
+}
+
+
+// text for the sequence file: "queued running completed\n"
+static size_t sequence_text(device_type *device, char *buffer, size_t size) {
+	pthread_mutex_lock(&device->queue.lock);
+	int length = snprintf(buffer, size, "%lu %lu %lu\n", device->queue.queued, device->queue.running, device->queue.completed);
+	pthread_mutex_unlock(&device->queue.lock);
+	if (length < 0) {
+		return 0;
+	} else if (length >= size) {
+		return size - 1;
+	}
+	return length;
+}
+
+
+// text for the statistics file: one "name value" pair per line
+static size_t statistics_text(device_type *device, char *buffer, size_t size) {
+	pthread_mutex_lock(&device->queue.lock);
+	int length = snprintf(buffer, size,
+			      "merged %lu\n"
+			      "dropped %lu\n"
+			      "scanned_lines %lu\n"
+			      "skipped_lines %lu\n",
+			      device->queue.merged_frames,
+			      device->queue.dropped_frames,
+			      device->queue.scanned_lines,
+			      device->queue.skipped_lines);
+	for (int i = 0; i < EPD_STAGE_COUNT && length >= 0 && length < size; ++i) {
+		const STAGE_statistics *stage = &device->queue.stages[i];
+		const char *name = EPD_stage_name(i);
+		int n = snprintf(buffer + length, size - length,
+				 "%s_runs %lu\n"
+				 "%s_frames %lu\n"
+				 "%s_last_frames %lu\n"
+				 "%s_partial_lines %lu\n"
+				 "%s_overruns %lu\n"
+				 "%s_overrun_us %lu\n",
+				 name, stage->runs,
+				 name, stage->frames,
+				 name, stage->last_frames,
+				 name, stage->partial_lines,
+				 name, stage->overruns,
+				 name, stage->overrun_us);
+		length = (n < 0) ? n : length + n;
+	}
+	pthread_mutex_unlock(&device->queue.lock);
+	if (length < 0) {
+		return 0;
+	} else if (length >= size) {
+		return size - 1;
+	}
+	return length;
+}
+
+
+// text for the status file: "idle|busy completed\n"
+// (called with the queue lock held)
+static size_t status_text(device_type *device, char *buffer, size_t size) {
+	const char *state = (0 != device->queue.running || 0 != device->queue.count) ? "busy" : "idle";
+	int length = snprintf(buffer, size, "%s %lu\n", state, device->queue.completed);
+	if (length < 0) {
+		return 0;
+	} else if (length >= size) {
+		return size - 1;
+	}
+	return length;
+}
+
+
+// wake any poll waiting on the status file
+// (called with the queue lock held)
+static void notify_status_readers(device_type *device) {
+	for (status_reader_type *reader = device->queue.readers; NULL != reader; reader = reader->next) {
+		if (NULL != reader->poll_handle) {
+			fuse_notify_poll(reader->poll_handle);
+			fuse_pollhandle_destroy(reader->poll_handle);
+			reader->poll_handle = NULL;
+		}
+	}
+}
+
+
+// mark the lines covering bytes offset .. offset + size - 1 as written
+// (called with the queue lock held)
+static void mark_lines(device_type *device, size_t offset, size_t size) {
+	const size_t bytes_per_line = device->panel->width / 8;
+	if (0 == size) {
+		return;
+	}
+	size_t last = (offset + size - 1) / bytes_per_line;
+	if (last >= device->panel->height) {
+		last = device->panel->height - 1;
+	}
+	for (size_t l = offset / bytes_per_line; l <= last; ++l) {
+		device->dirty_lines[l >> 3] |= 1 << (l & 7);
+	}
+}
+
+
+// the region file only exists for panels with region updates
+static bool is_region_path(const char *path) {
+	return EPD_PARTIAL_REGION_AVAILABLE && strcmp(path, region_path) == 0;
+}
+
+
+// text for the region file: "x0 y0 x1 y1\n"
+static size_t region_text(device_type *device, char *buffer, size_t size) {
+	pthread_mutex_lock(&device->queue.lock);
+	int length = snprintf(buffer, size, "%d %d %d %d\n",
+			      device->region.x0, device->region.y0,
+			      device->region.x1, device->region.y1);
+	pthread_mutex_unlock(&device->queue.lock);
+	if (length < 0) {
+		return 0;
+	} else if (length >= size) {
+		return size - 1;
+	}
+	return length;
+}
+
+
+// set the region from "x0 y0 x1 y1", which must lie within the panel
+static int region_parse(device_type *device, const char *buffer, size_t size) {
+	char text[64];
+	if (size >= sizeof(text)) {
+		return -EINVAL;
+	}
+	memcpy(text, buffer, size);
+	text[size] = '\0';
+
+	region_type region;
+	if (4 != sscanf(text, "%d %d %d %d", &region.x0, &region.y0, &region.x1, &region.y1) ||
+	    region.x0 < 0 || region.x0 >= region.x1 || region.x1 > device->panel->width ||
+	    region.y0 < 0 || region.y0 >= region.y1 || region.y1 > device->panel->height) {
+		return -EINVAL;
+	}
+	pthread_mutex_lock(&device->queue.lock);
+	device->region = region;
+	pthread_mutex_unlock(&device->queue.lock);
+	return 0;
+}
+
+
+static bool full_region(device_type *device, const region_type *region) {
+	return 0 == region->x0 && 0 == region->y0 &&
+		device->panel->width == region->x1 && device->panel->height == region->y1;
+}
+
+
+// grow region to the rectangle covering both
+static void region_union(region_type *region, const region_type *other) {
+	if (other->x0 < region->x0) {
+		region->x0 = other->x0;
+	}
+	if (other->y0 < region->y0) {
+		region->y0 = other->y0;
+	}
+	if (other->x1 > region->x1) {
+		region->x1 = other->x1;
+	}
+	if (other->y1 > region->y1) {
+		region->y1 = other->y1;
+	}
+}
+
+
+// bits of display byte b (pixels 8b .. 8b + 7, left pixel 0x80) inside the region
+static uint8_t column_bits(const region_type *region, int b) {
+	int first = region->x0 - 8 * b;
+	int end = region->x1 - 8 * b;
+	if (first < 0) {
+		first = 0;
+	}
+	if (end > 8) {
+		end = 8;
+	}
+	if (first >= end) {
+		return 0;
+	}
+	return (uint8_t)((0xff >> first) & (0xff << (8 - end)));
+}
+
+
+#if EPD_PARTIAL_LINES_AVAILABLE
+// lines of a partial update to scan: those written for this update
+// that differ from the current image inside the region, returns the
+// number of lines
+// (called only from the update thread, the only writer of current_buffer)
+static int changed_lines(device_type *device, const command_type *command, uint8_t *line_map) {
+	const int bytes_per_line = device->panel->width / 8;
+	const region_type *region = &command->region;
+	int count = 0;
+	memset(line_map, 0, LINE_MAP_SIZE);
+	for (int l = region->y0; l < region->y1; ++l) {
+		if (0 == (command->line_map[l >> 3] & (1 << (l & 7)))) {
+			continue;
+		}
+		const size_t n = l * bytes_per_line;
+		for (int b = 0; b < bytes_per_line; ++b) {
+			if (0 != ((command->frame[n + b] ^ device->current_buffer[n + b]) & column_bits(region, b))) {
+				line_map[l >> 3] |= 1 << (l & 7);
+				++count;
+				break;
+			}
+		}
+	}
+	return count;
+}
+#endif
+
+
+// update current buffer after a command completes
+static void set_current(device_type *device, const char *frame) {
+	pthread_mutex_lock(&device->queue.lock);
+	if (NULL == frame) {
+		memset(device->current_buffer, 0, sizeof(device->current_buffer));
+	} else {
+		memcpy(device->current_buffer, frame, sizeof(device->current_buffer));
+	}
+	pthread_mutex_unlock(&device->queue.lock);
+}
+
+
+// update current buffer after a partial update, which only changed
+// the pixels inside the command's region
+static void set_current_region(device_type *device, const command_type *command) {
+	const region_type *region = &command->region;
+	if (full_region(device, region)) {
+		set_current(device, command->frame);
+		return;
+	}
+
+	const int bytes_per_line = device->panel->width / 8;
+	pthread_mutex_lock(&device->queue.lock);
+	for (int l = region->y0; l < region->y1; ++l) {
+		const size_t n = l * bytes_per_line;
+		for (int b = 0; b < bytes_per_line; ++b) {
+			uint8_t bits = column_bits(region, b);
+			device->current_buffer[n + b] = (device->current_buffer[n + b] & ~bits) | (command->frame[n + b] & bits);
+		}
+	}
+
+	// written lines may still differ outside the region, so they stay
+	// marked for the next update and any already queued behind this one
+	for (size_t i = 0; i < LINE_MAP_SIZE; ++i) {
+		device->dirty_lines[i] |= command->line_map[i];
+	}
+	for (size_t k = 0; k < device->queue.count; ++k) {
+		command_type *queued = &device->queue.entry[(device->queue.head + k) % COMMAND_QUEUE_SIZE];
+		if ('C' != queued->command) {
+			for (size_t i = 0; i < LINE_MAP_SIZE; ++i) {
+				queued->line_map[i] |= command->line_map[i];
+			}
+		}
+	}
+	pthread_mutex_unlock(&device->queue.lock);
+}
+
+
+// run a command (called only from the update thread)
+static void run_command(device_type *device, const command_type *command) {
+	const char c = command->command;
+	const uint8_t *frame = (const uint8_t *)command->frame;
+
+	switch(c) {
+	case 'C':  // clear the display
+		EPD_set_temperature(device->epd, command->temperature);
+		EPD_begin(device->epd);
+		if (EPD_OK != EPD_status(device->epd)) {
+			warn("EPD_begin failed");
+		}
+		EPD_clear(device->epd);
+		EPD_end(device->epd);
+
+		set_current(device, NULL);
+		break;
+
+	case 'U':  // update with contents of display
+		EPD_set_temperature(device->epd, command->temperature);
+		EPD_begin(device->epd);
+		if (EPD_OK != EPD_status(device->epd)) {
+			warn("EPD_begin failed");
+		}
+#if EPD_IMAGE_ONE_ARG
+		EPD_image(device->epd, frame);
+#elif EPD_IMAGE_TWO_ARG
+		EPD_image(device->epd, (const uint8_t *)device->current_buffer, frame);
+#else
+#error "unsupported EPD_image() function"
+#endif
+		EPD_end(device->epd);
+
+		set_current(device, command->frame);
+		break;
+
+	case 'P':  // partial update with contents of display
+	case 'F':  // partial update bypassing temperature compensation for stagetime
+	{
+#if EPD_PARTIAL_LINES_AVAILABLE
+		uint8_t line_map[LINE_MAP_SIZE];
+		int lines = changed_lines(device, command, line_map);
+		pthread_mutex_lock(&device->queue.lock);
+		device->queue.scanned_lines += lines;
+		device->queue.skipped_lines += device->panel->height - lines;
+		pthread_mutex_unlock(&device->queue.lock);
+		if (0 == lines) {
+			set_current_region(device, command);
+			break;  // nothing changed so the panel need not be powered
+		}
+#endif
+		if (c == 'P') {
+			EPD_set_temperature(device->epd, command->temperature);
+		}
+#if EPD_PARTIAL_AVAILABLE
+		else {
+			EPD_set_factored_stage_time(device->epd, command->pu_stagetime);
+		}
+#endif 
+		EPD_begin(device->epd);
+		if (EPD_OK != EPD_status(device->epd)) {
+			warn("EPD_begin failed");
+		}
+#if EPD_PARTIAL_REGION_AVAILABLE
+		if (!full_region(device, &command->region)) {
+			// only touch the pixels inside the region
+			EPD_partial_region(device->epd, (const uint8_t *)device->current_buffer, frame,
+					   command->region.x0, command->region.y0,
+					   command->region.x1, command->region.y1);
+		} else {
+			EPD_partial_image_lines(device->epd, (const uint8_t *)device->current_buffer, frame, line_map);
+		}
+#elif EPD_PARTIAL_LINES_AVAILABLE
+		// use partial update only scanning the changed lines
+		EPD_partial_image_lines(device->epd, (const uint8_t *)device->current_buffer, frame, line_map);
+#elif EPD_PARTIAL_AVAILABLE
+		// use partial update
+		EPD_partial_image(device->epd, (const uint8_t *)device->current_buffer, frame);
+#elif EPD_IMAGE_ONE_ARG
+		// no partial so just normal display
+		EPD_image(device->epd, frame);
+#elif EPD_IMAGE_TWO_ARG
+		// no partial so just normal display
+		EPD_image(device->epd, (const uint8_t *)device->current_buffer, frame);
+#else
+#error "unsupported EPD_image() function"
+#endif
+
+#ifndef EPD_PARTIAL_AVAILABLE
+		// Do not switch off COG when doing a partial update.
+		EPD_end(device->epd);
+#endif
+
+		set_current_region(device, command);
+		break;
+	}
+
+	default:
+		break;
+	}
+}
+
+
+// set a new SPI clock or calibrate one (called only from the update
+// thread); a calibrated clock is saved for the next start
+static void set_spi_speed(device_type *device, uint32_t bps, bool calibrate) {
+#if EPD_PROBE_AVAILABLE
+	if (calibrate) {
+		pthread_mutex_lock(&device->queue.lock);
+		uint32_t fallback = device->spi_bps;
+		pthread_mutex_unlock(&device->queue.lock);
+
+		bps = SPI_SPEED_calibrate(device->epd, device->spi, fallback);
+		if (0 == bps) {
+			warnx("SPI speed calibration failed: %s", device->spi_device);
+			return;
+		}
+		SPI_SPEED_save(device->spi_device, bps);
+	}
+#endif
+	SPI_set_speed(device->spi, bps);
+
+	pthread_mutex_lock(&device->queue.lock);
+	device->spi_bps = bps;
+	pthread_mutex_unlock(&device->queue.lock);
+}
+
+
+// control socket
+// ==============
+
+// with --socket=PATH a thread serves a Unix domain socket (protocol in
+// epd_ipc.h) that hands out a shared memory frame buffer and eventfd
+// doorbell for each panel, so a client can render in place and commit
+// a frame without any FUSE round trips.  It also accepts a frame with
+// its command and settings in a single message, which is queued
+// atomically with respect to other clients
+
+#define IPC_MAX_CLIENTS 8
+
+typedef struct {
+	bool waiting;                  // reply deferred until the command completes
+	device_type *device;
+	unsigned long sequence;
+	EPD_IPC_reply_type reply;
+} ipc_wait_type;
+
+static struct {
+	int listen_fd;
+	int stop_fd;                   // eventfd to wake the thread for shutdown
+	int complete_fd;               // eventfd signalled when any command completes
+	int client_fd[IPC_MAX_CLIENTS];
+	ipc_wait_type wait[IPC_MAX_CLIENTS];
+	pthread_t thread;
+} ipc = {
+	.complete_fd = -1
+};
+
+
+// create the shared frame buffer and doorbell of a panel
+static bool ipc_device_setup(device_type *device) {
+	char name[64];
+	snprintf(name, sizeof(name), "/epd_fuse.%d.%d", (int)getpid(), (int)(device - devices));
+
+	int shm_fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+	if (shm_fd < 0) {
+		warn("shm_open failed: %s", name);
+		return false;
+	}
+	shm_unlink(name);  // only reachable by passing the descriptor
+
+	if (ftruncate(shm_fd, sizeof(EPD_shm_type)) < 0) {
+		warn("cannot size shared memory: %s", name);
+		goto done_shm;
+	}
+
+	EPD_shm_type *shm = mmap(NULL, sizeof(EPD_shm_type), PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+	if (MAP_FAILED == shm) {
+		warn("cannot map shared memory: %s", name);
+		goto done_shm;
+	}
+
+	int doorbell_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (doorbell_fd < 0) {
+		warn("eventfd failed");
+		goto done_map;
+	}
+
+	shm->magic = EPD_SHM_MAGIC;
+	shm->version = EPD_IPC_VERSION;
+	shm->width = device->panel->width;
+	shm->height = device->panel->height;
+	shm->byte_count = device->panel->byte_count;
+	shm->command = 'U';
+	pthread_mutex_lock(&device->queue.lock);
+	shm->queued = device->queue.queued;
+	shm->completed = device->queue.completed;
+	shm->status = 0;
+	shm->answered = 0;
+	memcpy(shm->frame, device->display_buffer, sizeof(shm->frame));
+	pthread_mutex_unlock(&device->queue.lock);
+
+	device->shm_fd = shm_fd;
+	device->doorbell_fd = doorbell_fd;
+	device->shm = shm;  // released by device_stop
+	return true;
+
+	// release resources
+done_map:
+	munmap(shm, sizeof(EPD_shm_type));
+done_shm:
+	close(shm_fd);
+	return false;
+}
+
+
+// send a reply, optionally passing descriptors
+static void ipc_reply(int fd, const void *reply, size_t size, const int *fds, size_t fd_count) {
+	struct iovec iov = {
+		.iov_base = (void *)reply,
+		.iov_len = size
+	};
+	char control[CMSG_SPACE(2 * sizeof(int))];
+	struct msghdr message;
+	memset(&message, 0, sizeof(message));
+	message.msg_iov = &iov;
+	message.msg_iovlen = 1;
+
+	if (fd_count > 0) {
+		memset(control, 0, sizeof(control));
+		message.msg_control = control;
+		message.msg_controllen = CMSG_SPACE(fd_count * sizeof(int));
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(fd_count * sizeof(int));
+		memcpy(CMSG_DATA(cmsg), fds, fd_count * sizeof(int));
+	}
+
+	if (sendmsg(fd, &message, MSG_NOSIGNAL) < 0) {
+		warn("control socket reply failed");
+	}
+}
+
+
+// queue a frame sent in a single message; returns false if the reply is deferred
+static bool ipc_frame(int client, device_type *device, const char *buffer, size_t size, EPD_IPC_reply_type *reply) {
+	EPD_IPC_frame_type message;
+	if (size < sizeof(message)) {
+		reply->status = -EINVAL;
+		return true;
+	}
+	memcpy(&message, buffer, sizeof(message));
+	buffer += sizeof(message);
+	size -= sizeof(message);
+
+	int temperature = device->temperature;
+	if (0 != (message.flags & EPD_IPC_TEMPERATURE)) {
+		if (message.temperature < -99 || message.temperature > 99) {
+			reply->status = -EINVAL;
+			return true;
+		}
+		temperature = message.temperature;
+	}
+
+	int pu_stagetime = device->pu_stagetime;
+	if (0 != (message.flags & EPD_IPC_STAGE_TIME)) {
+		if (message.stage_time < 50 || message.stage_time > 2000) {
+			reply->status = -EINVAL;
+			return true;
+		}
+		pu_stagetime = message.stage_time;
+	}
+
+	// only the socket thread uses this
+	static char frame[DISPLAY_BUFFER_SIZE];
+	bool have_frame = false;
+	if (0 != size) {
+		if (size != device->panel->byte_count) {
+			reply->status = -EINVAL;
+			return true;
+		}
+		special_memcpy(frame, buffer, size,
+			       0 != (message.flags & EPD_IPC_BIT_REVERSED),
+			       0 != (message.flags & EPD_IPC_INVERTED));
+		have_frame = true;
+	}
+
+	unsigned long sequence = 0;
+	int rc = queue_command(device, (char)message.command, have_frame ? frame : NULL,
+			       temperature, pu_stagetime, false, &sequence);
+	if (rc < 0) {
+		reply->status = rc;
+		return true;
+	} else if (0 == sequence) {
+		reply->status = -EINVAL;  // unknown command
+		return true;
+	}
+	reply->sequence = sequence;
+
+	if (0 != (message.flags & EPD_IPC_WAIT)) {
+		ipc_wait_type *wait = &ipc.wait[client];
+		wait->waiting = true;
+		wait->device = device;
+		wait->sequence = sequence;
+		wait->reply = *reply;
+		return false;
+	}
+	return true;
+}
+
+
+// handle one request; returns false if the client has gone
+static bool ipc_request(int client) {
+	static char buffer[sizeof(EPD_IPC_frame_type) + EPD_IPC_FRAME_SIZE + 1];
+	const int fd = ipc.client_fd[client];
+	ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+	if (n <= 0) {
+		return false;
+	}
+
+	EPD_IPC_request_type request;
+	EPD_IPC_reply_type reply;
+	memset(&reply, 0, sizeof(reply));
+	if (n < sizeof(request)) {
+		reply.status = -EINVAL;
+		ipc_reply(fd, &reply, sizeof(reply), NULL, 0);
+		return true;
+	}
+	memcpy(&request, buffer, sizeof(request));
+	reply.request = request.request;
+
+	if (request.panel >= device_count) {
+		reply.status = -ENODEV;
+		ipc_reply(fd, &reply, sizeof(reply), NULL, 0);
+		return true;
+	}
+	device_type *device = &devices[request.panel];
+
+	switch (request.request) {
+	case EPD_IPC_MAP: {
+		int fds[2] = {device->shm_fd, device->doorbell_fd};
+		reply.width = device->panel->width;
+		reply.height = device->panel->height;
+		reply.byte_count = device->panel->byte_count;
+		reply.size = sizeof(EPD_shm_type);
+		ipc_reply(fd, &reply, sizeof(reply), fds, 2);
+		break;
+	}
+
+	case EPD_IPC_FRAME:
+		if (ipc_frame(client, device, buffer, n, &reply)) {
+			ipc_reply(fd, &reply, sizeof(reply), NULL, 0);
+		}
+		break;
+
+	default:
+		reply.status = -EINVAL;
+		ipc_reply(fd, &reply, sizeof(reply), NULL, 0);
+		break;
+	}
+	return true;
+}
+
+
+// send the deferred replies of commands that have completed
+static void ipc_complete(void) {
+	uint64_t count = 0;
+	if (read(ipc.complete_fd, &count, sizeof(count)) != sizeof(count)) {
+		return;
+	}
+
+	for (int i = 0; i < IPC_MAX_CLIENTS; ++i) {
+		ipc_wait_type *wait = &ipc.wait[i];
+		if (!wait->waiting) {
+			continue;
+		}
+		pthread_mutex_lock(&wait->device->queue.lock);
+		bool done = wait->device->queue.completed >= wait->sequence;
+		pthread_mutex_unlock(&wait->device->queue.lock);
+		if (done) {
+			wait->waiting = false;
+			ipc_reply(ipc.client_fd[i], &wait->reply, sizeof(wait->reply), NULL, 0);
+		}
+	}
+}
+
+
+// a client rang the doorbell: queue the frame in shared memory, or
+// report -EAGAIN if the queue is full rather than stop serving the
+// other panels and clients
+static void ipc_doorbell(device_type *device) {
+	uint64_t count = 0;
+	if (read(device->doorbell_fd, &count, sizeof(count)) != sizeof(count)) {
+		return;
+	}
+
+	const char c = (char)__atomic_load_n(&device->shm->command, __ATOMIC_ACQUIRE);
+	unsigned long sequence = 0;
+	int rc = queue_command(device, c, (const char *)device->shm->frame,
+			       device->temperature, device->pu_stagetime, false, &sequence);
+	if (0 == rc && 0 == sequence) {
+		rc = -EINVAL;  // unknown command
+	}
+	if (0 == rc) {
+		__atomic_store_n(&device->shm->queued, (uint32_t)sequence, __ATOMIC_RELEASE);
+	}
+	__atomic_store_n(&device->shm->status, (int32_t)rc, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&device->shm->answered, 1, __ATOMIC_RELEASE);
+}
+
+
+static void *ipc_thread(void *arg) {
+	(void)arg;
+
+	// layout of the poll array
+	enum {
+		STOP_INDEX,
+		COMPLETE_INDEX,
+		LISTEN_INDEX,
+		DOORBELL_INDEX
+	};
+	const size_t client_index = DOORBELL_INDEX + device_count;
+	struct pollfd fds[DOORBELL_INDEX + MAX_DEVICES + IPC_MAX_CLIENTS];
+
+	for (;;) {
+		fds[STOP_INDEX].fd = ipc.stop_fd;
+		fds[COMPLETE_INDEX].fd = ipc.complete_fd;
+		fds[LISTEN_INDEX].fd = ipc.listen_fd;
+		for (int i = 0; i < device_count; ++i) {
+			fds[DOORBELL_INDEX + i].fd = devices[i].doorbell_fd;
+		}
+		for (int i = 0; i < IPC_MAX_CLIENTS; ++i) {
+			// negative => ignored; a client waiting for a reply
+			// is not read so that replies stay in order
+			fds[client_index + i].fd = ipc.wait[i].waiting ? -1 : ipc.client_fd[i];
+		}
+		const size_t count = client_index + IPC_MAX_CLIENTS;
+		for (size_t i = 0; i < count; ++i) {
+			fds[i].events = POLLIN;
+		}
+
+		if (poll(fds, count, -1) < 0) {
+			if (EINTR == errno) {
+				continue;
+			}
+			warn("control socket poll failed");
+			break;
+		}
+
+		if (0 != fds[STOP_INDEX].revents) {
+			break;  // stopped
+		}
+
+		if (0 != (fds[COMPLETE_INDEX].revents & POLLIN)) {
+			ipc_complete();
+		}
+
+		for (int i = 0; i < device_count; ++i) {
+			if (0 != (fds[DOORBELL_INDEX + i].revents & POLLIN)) {
+				ipc_doorbell(&devices[i]);
+			}
+		}
+
+		for (int i = 0; i < IPC_MAX_CLIENTS; ++i) {
+			if (0 != fds[client_index + i].revents && !ipc_request(i)) {
+				close(ipc.client_fd[i]);
+				ipc.client_fd[i] = -1;
+				ipc.wait[i].waiting = false;
+			}
+		}
+
+		if (0 != (fds[LISTEN_INDEX].revents & POLLIN)) {
+			int fd = accept(ipc.listen_fd, NULL, NULL);
+			if (fd >= 0) {
+				int i = 0;
+				while (i < IPC_MAX_CLIENTS && ipc.client_fd[i] >= 0) {
+					++i;
+				}
+				if (i < IPC_MAX_CLIENTS) {
+					ipc.client_fd[i] = fd;
+					ipc.wait[i].waiting = false;
+				} else {
+					warn("control socket: too many clients");
+					close(fd);
+				}
+			}
+		}
+	}
+
+	for (int i = 0; i < IPC_MAX_CLIENTS; ++i) {
+		if (ipc.client_fd[i] >= 0) {
+			close(ipc.client_fd[i]);
+			ipc.client_fd[i] = -1;
+		}
+	}
+	return NULL;
+}
+
+
+// create the shared buffers, open the socket and start its thread
+static bool ipc_start(void) {
+	for (int i = 0; i < IPC_MAX_CLIENTS; ++i) {
+		ipc.client_fd[i] = -1;
+		ipc.wait[i].waiting = false;
+	}
+
+	// update threads signal this once a panel has shared memory
+	ipc.complete_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (ipc.complete_fd < 0) {
+		warn("eventfd failed");
+		return false;
+	}
+
+	for (int i = 0; i < device_count; ++i) {
+		if (!ipc_device_setup(&devices[i])) {
+			return false;  // device_stop releases any that were set up
+		}
+	}
+
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (strlen(socket_path) >= sizeof(address.sun_path)) {
+		warnx("socket path too long: %s", socket_path);
+		return false;
+	}
+	strcpy(address.sun_path, socket_path);
+
+	ipc.listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (ipc.listen_fd < 0) {
+		warn("cannot create control socket");
+		goto done;
+	}
+
+	unlink(socket_path);  // stale socket from a previous run
+	if (bind(ipc.listen_fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+		warn("cannot bind control socket: %s", socket_path);
+		goto done_socket;
+	}
+	chmod(socket_path, 0666);  // same access as the files of the mount
+
+	if (listen(ipc.listen_fd, IPC_MAX_CLIENTS) < 0) {
+		warn("cannot listen on control socket: %s", socket_path);
+		goto done_bind;
+	}
+
+	ipc.stop_fd = eventfd(0, EFD_CLOEXEC);
+	if (ipc.stop_fd < 0) {
+		warn("eventfd failed");
+		goto done_bind;
+	}
+
+	if (0 != pthread_create(&ipc.thread, NULL, ipc_thread, NULL)) {
+		warn("control socket thread failed");
+		goto done_stop;
+	}
+	return true;
+
+	// release resources
+done_stop:
+	close(ipc.stop_fd);
+done_bind:
+	unlink(socket_path);
+done_socket:
+	close(ipc.listen_fd);
+done:
+	return false;
+}
+
+
+static void ipc_stop(void) {
+	uint64_t one = 1;
+	if (write(ipc.stop_fd, &one, sizeof(one)) != sizeof(one)) {
+		warn("cannot stop control socket thread");
+	}
+	pthread_join(ipc.thread, NULL);
+	close(ipc.stop_fd);
+	close(ipc.listen_fd);
+	unlink(socket_path);
+	// complete_fd stays open until the update threads have stopped
+}
+
+
+// release what is left once the update threads have stopped
+static void ipc_close(void) {
+	if (ipc.complete_fd >= 0) {
+		close(ipc.complete_fd);
+		ipc.complete_fd = -1;
+	}
+}
+
+
+// wake the socket thread to send replies waiting for completion
+static void ipc_signal_complete(void) {
+	uint64_t one = 1;
+	if (write(ipc.complete_fd, &one, sizeof(one)) != sizeof(one)) {
+		warn("cannot signal command completion");
+	}
+}
+
+
+// values for setting options
+enum {
+     KEY_HELP,
+     KEY_VERSION,
+     KEY_PANEL,
+     KEY_SPI,
+     KEY_PINS,
+     KEY_SOCKET,
+     KEY_FINISH,
+     KEY_SPI_SPEED
+};
+
+
+static struct fuse_opt display_options[] = {
+	FUSE_OPT_KEY("--panel=%s",  KEY_PANEL),
+	FUSE_OPT_KEY("panel=%s",    KEY_PANEL),
+
+	FUSE_OPT_KEY("--spi=%s",    KEY_SPI),
+	FUSE_OPT_KEY("spi=%s",      KEY_SPI),
+
+	FUSE_OPT_KEY("--pins=%s",   KEY_PINS),
+	FUSE_OPT_KEY("pins=%s",     KEY_PINS),
+
+	FUSE_OPT_KEY("--socket=%s", KEY_SOCKET),
+	FUSE_OPT_KEY("socket=%s",   KEY_SOCKET),
+
+	FUSE_OPT_KEY("--finish=%s", KEY_FINISH),
+	FUSE_OPT_KEY("finish=%s",   KEY_FINISH),
+
+	FUSE_OPT_KEY("--spi-speed=%s", KEY_SPI_SPEED),
+	FUSE_OPT_KEY("spi-speed=%s",   KEY_SPI_SPEED),
+
+	FUSE_OPT_KEY("-V",          KEY_VERSION),
+	FUSE_OPT_KEY("--version",   KEY_VERSION),
+	FUSE_OPT_KEY("-h",          KEY_HELP),
+	FUSE_OPT_KEY("--help",      KEY_HELP),
+	FUSE_OPT_END
+};
+
+
+// split the value of "key=A,B,..." into one item per panel
+// returns the number of items or -1 if there are too many
+static int option_list(const char *arg, char *items[MAX_DEVICES])
+{
+     char *copy = strdup(strchr(arg, '=') + 1);  // items point into this, never freed
+     char *save = NULL;
+     int count = 0;
+     for (char *item = strtok_r(copy, ",", &save); NULL != item; item = strtok_r(NULL, ",", &save)) {
+	     if (count >= MAX_DEVICES) {
+		     return -1;
+	     }
+	     items[count++] = item;
+     }
+     return count;
+}
+
+
+// parse "ON:BORDER:DISCHARGE:RESET:BUSY[:PWM]" pin numbers
+static bool option_pins(const char *text, pins_type *pins)
+{
+     int *order[] = {
+	     &pins->panel_on,
+	     &pins->border,
+	     &pins->discharge,
+	     &pins->reset,
+	     &pins->busy,
+#if EPD_PWM_REQUIRED
+	     &pins->pwm,
+#endif
+     };
+     const size_t count = sizeof(order) / sizeof(order[0]);
+
+     for (size_t i = 0; i < count; ++i) {
+	     char *end = NULL;
+	     long int n = strtol(text, &end, 0);
+	     if (text == end || n < 0) {
+		     return false;
+	     }
+	     *order[i] = (int)n;
+	     if (i + 1 < count) {
+		     if (':' != *end) {
+			     return false;
+		     }
+		     text = end + 1;
+	     } else if ('\0' != *end) {
+		     return false;
+	     }
+     }
+     return true;
+}
+
+
+static int option_processor(void *data, const char *arg, int key, struct fuse_args *outargs)
+{
+     switch (key) {
+     case KEY_HELP:
+	     fprintf(stderr,
+		     "usage: %s mountpoint [options]\n"
 		     "\n"
 		     "general options:\n"
 		     "    -o opt,[opt...]  mount options\n"
@@ -717,9 +2366,28 @@ static int option_processor(void *data, const char *arg, int key, struct fuse_ar
 		     "Myfs options:\n"
 		     "    -o panel=SIZE     set panel size\n"
 		     "    -o spi=DEVICE     override default SPI device [%s]\n"
+		     "    -o pins=PINS      override default control pins\n"
+		     "    -o socket=PATH    enable the shared memory control socket\n"
+		     "    -o finish=MODE    end of timed stages: nearest, partial or idle\n"
+		     "    -o spi-speed=BPS  SPI clock or 'auto' to calibrate [saved or %d]\n"
 		     "    --panel=NUM       same as '-opanel=SIZE'\n"
 		     "    --spi=DEVICE      same as '-ospi=DEVICE'\n"
-		     , outargs->argv[0], spi_device);
+		     "    --pins=PINS       same as '-opins=PINS'\n"
+		     "    --socket=PATH     same as '-osocket=PATH'\n"
+		     "    --finish=MODE     same as '-ofinish=MODE'\n"
+		     "    --spi-speed=BPS   same as '-ospi-speed=BPS'\n"
+		     "\n"
+		     "  several panels are driven by giving comma separated lists to the\n"
+		     "  '--' forms e.g. --panel=2.0,2.7 --spi=/dev/spidev0.0,/dev/spidev0.1\n"
+		     "  PINS is ON:BORDER:DISCHARGE:RESET:BUSY%s using GPIO numbers\n"
+		     "  and is required for each panel after the first\n"
+		     , outargs->argv[0], SPI_DEVICE, SPI_BPS,
+#if EPD_PWM_REQUIRED
+		     ":PWM"
+#else
+		     ""
+#endif
+		     );
 	     fuse_opt_add_arg(outargs, "-ho");
 	     fuse_main(outargs->argc, outargs->argv, &display_operations, NULL);
 	     exit(1);
@@ -731,24 +2399,95 @@ static int option_processor(void *data, const char *arg, int key, struct fuse_ar
 	     exit(0);
 
      case KEY_PANEL: {
-	     const char *p = strchr(arg, '=');
-	     ++p;
-	     panel = panels;
-	     for (panel = panels; NULL != panel->key; ++panel) {
-		     if (strcmp(panel->key, p) == 0) {
-			     return 0;
+	     char *items[MAX_DEVICES];
+	     int count = option_list(arg, items);
+	     if (count < 1) {
+		     return 1;
+	     }
+	     for (int i = 0; i < count; ++i) {
+		     const struct panel_struct *panel;
+		     for (panel = panels; NULL != panel->key; ++panel) {
+			     if (strcmp(panel->key, items[i]) == 0) {
+				     break;
+			     }
+		     }
+		     if (NULL == panel->key) {
+			     return 1;
 		     }
+		     devices[i].panel = panel;
 	     }
-	     return 1;
+	     device_count = count;
+	     return 0;
      }
 
      case KEY_SPI: {
+	     char *items[MAX_DEVICES];
+	     int count = option_list(arg, items);
+	     if (count < 1) {
+		     return 1;
+	     }
+	     for (int i = 0; i < count; ++i) {
+		     devices[i].spi_device = items[i];
+	     }
+	     return 0;
+     }
+
+     case KEY_PINS: {
+	     char *items[MAX_DEVICES];
+	     int count = option_list(arg, items);
+	     if (count < 1) {
+		     return 1;
+	     }
+	     for (int i = 0; i < count; ++i) {
+		     if (!option_pins(items[i], &devices[i].pins)) {
+			     return 1;
+		     }
+		     devices[i].pins_set = true;
+	     }
+	     return 0;
+     }
+
+     case KEY_SOCKET: {
 	     const char *p = strchr(arg, '=');
-	     spi_device = strdup(p);
-	     if (1) {    // test for spi path exists
-		     return 0;
+	     ++p;
+	     if ('/' != *p) {
+		     return 1;  // must be absolute as fuse changes directory
 	     }
-	     return 1;
+	     socket_path = strdup(p);
+	     return 0;
+     }
+
+     case KEY_FINISH: {
+	     char *items[MAX_DEVICES];
+	     int count = option_list(arg, items);
+	     if (count < 1) {
+		     return 1;
+	     }
+	     for (int i = 0; i < count; ++i) {
+		     if (!STAGE_finish_parse(items[i], &devices[i].finish)) {
+			     return 1;
+		     }
+	     }
+	     return 0;
+     }
+
+     case KEY_SPI_SPEED: {
+	     char *items[MAX_DEVICES];
+	     int count = option_list(arg, items);
+	     if (count < 1) {
+		     return 1;
+	     }
+	     for (int i = 0; i < count; ++i) {
+		     uint32_t bps = 0;
+		     bool calibrate = false;
+		     if (!SPI_SPEED_parse(items[i], strlen(items[i]), &bps, &calibrate) ||
+			 (calibrate && !EPD_PROBE_AVAILABLE)) {
+			     return 1;
+		     }
+		     devices[i].spi_bps = bps;
+		     devices[i].spi_calibrate = calibrate;
+	     }
+	     return 0;
      }
      }
      return 1;
@@ -759,11 +2498,39 @@ int main(int argc, char *argv[])
 {
      struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
 
-     memset(current_buffer, 0, sizeof(current_buffer));
-     memset(display_buffer, 0, sizeof(display_buffer));
+     for (int i = 0; i < MAX_DEVICES; ++i) {
+	     device_type *device = &devices[i];
+	     memset(device, 0, sizeof(device_type));
+	     device->temperature = 25;
+	     device->pu_stagetime = 500;
+	     device->dither = DITHER_FLOYD_STEINBERG;
+	     pthread_mutex_init(&device->queue.lock, NULL);
+	     pthread_cond_init(&device->queue.not_empty, NULL);
+	     pthread_cond_init(&device->queue.not_full, NULL);
+     }
+
+     // first panel defaults to the wiring in epd_io.h
+     devices[0].spi_device = SPI_DEVICE;
+     devices[0].pins.panel_on = panel_on_pin;
+     devices[0].pins.border = border_pin;
+     devices[0].pins.discharge = discharge_pin;
+#if EPD_PWM_REQUIRED
+     devices[0].pins.pwm = pwm_pin;
+#endif
+     devices[0].pins.reset = reset_pin;
+     devices[0].pins.busy = busy_pin;
 
      fuse_opt_parse(&args, NULL, display_options, option_processor);
 
+     for (int i = 0; i < device_count; ++i) {
+	     if (NULL == devices[i].panel) {
+		     errx(1, "panel %d: missing --panel", i);
+	     }
+	     if (i > 0 && (NULL == devices[i].spi_device || !devices[i].pins_set)) {
+		     errx(1, "panel %d: missing --spi or --pins", i);
+	     }
+     }
+
      // run fuse
      return fuse_main(args.argc, args.argv, &display_operations, NULL);
 }
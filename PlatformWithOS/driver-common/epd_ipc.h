@@ -0,0 +1,112 @@
+// Copyright 2013-2015 Pervasive Displays, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at:
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+// express or implied.  See the License for the specific language
+// governing permissions and limitations under the License.
+
+// messages for the epd_fuse control socket (enabled by --socket=PATH)
+//
+// the socket is a Unix domain SOCK_SEQPACKET socket; each request is
+// one message starting with EPD_IPC_request_type and is answered by
+// one message starting with EPD_IPC_reply_type
+
+#if !defined(EPD_IPC_H)
+#define EPD_IPC_H 1
+
+#include <stdint.h>
+
+#define EPD_IPC_VERSION 2
+
+// large enough for the biggest panel (2.7")
+#define EPD_IPC_FRAME_SIZE (264 * 176 / 8)
+
+typedef enum {
+	EPD_IPC_MAP = 1,        // get the shared frame buffer of a panel
+	EPD_IPC_FRAME = 2,      // send a frame and command in one message
+} EPD_IPC_request;
+
+typedef struct {
+	uint32_t request;       // EPD_IPC_request
+	uint32_t panel;         // panel number, same as the /N directory
+} EPD_IPC_request_type;
+
+typedef struct {
+	uint32_t request;       // copied from the request
+	int32_t status;         // zero or a negative errno value
+	uint32_t width;         // panel size in pixels
+	uint32_t height;
+	uint32_t byte_count;    // bytes of frame used by this panel
+	uint32_t size;          // size of the shared segment to map
+	uint32_t sequence;      // sequence number of a queued command
+} EPD_IPC_reply_type;
+
+
+// EPD_IPC_FRAME
+// -------------
+//
+// the request is followed by either no data (display the current
+// /display contents, or 'C') or exactly byte_count bytes of frame.
+// the flags select the same conversions as the /LE and _inverse files
+// and whether the reply waits for the update to finish; the
+// temperature and stage time apply to this command only.  The reply
+// has the sequence number of the command; with EPD_IPC_WAIT it is not
+// sent until the third field of /sequence reaches that number.  If
+// the panel's queue is full of clears the status is -EAGAIN and
+// nothing is queued
+
+typedef enum {
+	EPD_IPC_BIT_REVERSED = 0x01,  // top left pixel is 0x01 of the first byte
+	EPD_IPC_INVERTED     = 0x02,  // 0 => black and 1 => white
+	EPD_IPC_TEMPERATURE  = 0x04,  // use temperature from this message
+	EPD_IPC_STAGE_TIME   = 0x08,  // use stage_time from this message
+	EPD_IPC_WAIT         = 0x10,  // reply when finished instead of when queued
+} EPD_IPC_flags;
+
+typedef struct {
+	EPD_IPC_request_type header;  // request is EPD_IPC_FRAME
+	uint32_t flags;               // EPD_IPC_flags
+	int32_t temperature;          // Celsius, -99 .. 99
+	int32_t stage_time;           // milliseconds for 'F', 50 .. 2000
+	uint32_t command;             // 'C', 'U', 'P' or 'F'
+} EPD_IPC_frame_type;
+
+
+// EPD_IPC_MAP
+// -----------
+//
+// the reply carries two descriptors (SCM_RIGHTS): the shared memory
+// segment, to be mapped read/write with MAP_SHARED, and an eventfd
+// used as a doorbell.  To display a frame: draw it into 'frame' (same
+// bit layout as /display), store the command character ('U', 'P', 'F'
+// or 'C') in 'command' and write a 1 to the doorbell.  'queued' is set
+// once the daemon has copied the frame, after which it is safe to draw
+// the next one, and 'completed' follows the third field of /sequence.
+// 'answered' counts the doorbells handled and 'status' is the result
+// of the last one: zero, or -EAGAIN if the queue was full (ring again
+// later) and the frame was not taken
+
+#define EPD_SHM_MAGIC 0x44455045  // "EPED" little endian
+
+typedef struct {
+	uint32_t magic;         // EPD_SHM_MAGIC
+	uint32_t version;       // EPD_IPC_VERSION
+	uint32_t width;         // panel size in pixels
+	uint32_t height;
+	uint32_t byte_count;    // bytes of frame used by this panel
+	uint32_t command;       // client: command to run on the next doorbell
+	uint32_t queued;        // daemon: sequence number of the last doorbell's command
+	uint32_t completed;     // daemon: sequence number of the last completed command
+	int32_t status;         // daemon: zero or a negative errno value for the last doorbell
+	uint32_t answered;      // daemon: doorbells handled, set after status
+	uint8_t frame[EPD_IPC_FRAME_SIZE];
+} EPD_shm_type;
+
+#endif
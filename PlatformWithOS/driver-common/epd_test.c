@@ -25,6 +25,7 @@
 #include "gpio.h"
 #include "spi.h"
 #include "epd.h"
+#include "spi_speed.h"
 #include EPD_IO
 
 // 1.44" test images
@@ -139,7 +140,11 @@ static void usage(const char *program_name, const char *message, ...) {
 		program_name = "epd_test";
 	}
 
-	printf("usage: %s [ 1.44 "
+	printf("usage: %s [--spi-speed=BPS"
+#if EPD_PROBE_AVAILABLE
+	       "|auto"
+#endif
+	       "] [ 1.44 "
 #if EPD_1_9_SUPPORT
 	       "| 1.9 "
 #endif
@@ -160,10 +165,31 @@ int main(int argc, char *argv[]) {
 	const uint8_t *const *images = images_1_44;
 	int image_count = SIZE_OF_ARRAY(images_1_44);
 
+	// the SPI clock: as given, else as saved by calibration
+	const char *program_name = argv[0];
+	uint32_t spi_bps = SPI_SPEED_load(SPI_DEVICE);
+	bool calibrate = false;
+	if (0 == spi_bps) {
+		spi_bps = SPI_BPS;
+	}
+	if (argc > 1 && 0 == strncmp("--spi-speed=", argv[1], 12)) {
+		const char *speed = argv[1] + 12;
+		if (!SPI_SPEED_parse(speed, strlen(speed), &spi_bps, &calibrate)) {
+			usage(program_name, "invalid SPI speed: %s", speed);
+		}
+#if !EPD_PROBE_AVAILABLE
+		if (calibrate) {
+			usage(program_name, "this panel cannot be read back to calibrate the SPI speed");
+		}
+#endif
+		--argc;
+		++argv;
+	}
+
 	if (argc < 2) {
-		usage(argv[0], "missing argument(s)");
+		usage(program_name, "missing argument(s)");
 	} else if (argc > 3) {
-		usage(argv[0], "extraneous extra argument(s)");
+		usage(program_name, "extraneous extra argument(s)");
 	}
 
 	if (0 == strcmp("1.44", argv[1]) || 0 == strcmp("1_44", argv[1])) {
@@ -191,15 +217,15 @@ int main(int argc, char *argv[]) {
 		images = images_2_7;
 		image_count = SIZE_OF_ARRAY(images_2_7);
 	} else {
-		usage(argv[0], "unknown display size: %s", argv[1]);
+		usage(program_name, "unknown display size: %s", argv[1]);
 	}
 
 	if (argc > 2) {
 		int n = atoi(argv[2]);
 		if (n < 0) {
-			usage(argv[0], "image-count cannot be negative");
+			usage(program_name, "image-count cannot be negative");
 		} else if (n > image_count) {
-			usage(argv[0], "image-count: %d, cannot be greater than: %d", n, image_count);
+			usage(program_name, "image-count: %d, cannot be greater than: %d", n, image_count);
 		}
 		image_count = n;
 	}
@@ -210,7 +236,7 @@ int main(int argc, char *argv[]) {
 		goto done;
 	}
 
-	SPI_type *spi = SPI_create(SPI_DEVICE, SPI_BPS);
+	SPI_type *spi = SPI_create(SPI_DEVICE, calibrate ? SPI_BPS : spi_bps);
 	if (NULL == spi) {
 		rc = 1;
 		warn("SPI_setup failed");
@@ -243,6 +269,19 @@ int main(int argc, char *argv[]) {
 		goto done_spi;
 	}
 
+#if EPD_PROBE_AVAILABLE
+	if (calibrate) {
+		printf("calibrate SPI speed\n");
+		spi_bps = SPI_SPEED_calibrate(epd, spi, SPI_BPS);
+		if (0 == spi_bps) {
+			warnx("SPI speed calibration failed, using: %u", SPI_BPS);
+		} else {
+			printf("SPI speed = %u\n", spi_bps);
+			SPI_SPEED_save(SPI_DEVICE, spi_bps);
+		}
+	}
+#endif
+
 	// EPD display
 	printf("clear display\n");
 	EPD_begin(epd);
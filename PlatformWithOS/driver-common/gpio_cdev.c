@@ -0,0 +1,487 @@
+// Copyright 2013-2015 Pervasive Displays, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at:
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+// express or implied.  See the License for the specific language
+// governing permissions and limitations under the License.
+
+// GPIO through the Linux GPIO character device (gpiochip v2 uAPI,
+// Linux 5.10 or later) for any platform; build with GPIO_BACKEND=cdev
+//
+// The platform gpio.h is used unchanged.  Pin numbers count the lines
+// of /dev/gpiochip0, /dev/gpiochip1, ... in that order, so the first
+// line of each chip follows the last line of the one before.  That is
+// the BCM number on a Raspberry Pi (all on gpiochip0) and, with the
+// banks as gpiochip0 to gpiochip3 of 32 lines, bank * 32 + bit on a
+// BeagleBone.  These are not the kernel's global GPIO numbers, whose
+// bases are assigned dynamically (512 and up on current kernels).
+//
+// The outputs used on one chip are held by a single line request, so
+// GPIO_write is one ioctl and GPIO_write_pins one per chip.  Each call
+// of GPIO_mode for a new output requests them again with that pin
+// added.  Every input has a request of its own, whose edge events
+// wake GPIO_wait_edge: with a shared one, a thread waiting for one
+// panel's BUSY would discard the edge another panel's thread is
+// waiting for.  Requesting again releases the chip's outputs for a
+// moment, so all the pins should be set up before any are driven.
+// There is no PWM, so this cannot drive the COG 1 panels.
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <err.h>
+
+#include <linux/gpio.h>
+
+#include "gpio.h"
+
+
+// chips probed and the highest GPIO number accepted
+#define GPIO_CDEV_MAX_CHIPS 16
+#define GPIO_CDEV_MAX_PINS 512
+
+#define GPIO_CDEV_CONSUMER "epd"
+
+// one /dev/gpiochipN and the request holding its outputs
+typedef struct {
+	int fd;                        // the chip (-1 => not present)
+	unsigned int first;            // GPIO number of line 0
+	unsigned int lines;
+
+	int request_fd;                // -1 => no outputs requested yet
+	unsigned int count;            // lines in the request
+	uint32_t offsets[GPIO_V2_LINES_MAX];
+	uint64_t values;               // output values, bit per request index
+} chip_type;
+
+static chip_type chips[GPIO_CDEV_MAX_CHIPS];
+static int chip_count;
+
+// where each GPIO number is requested
+static struct {
+	int8_t chip;                   // -1 => not requested
+	int8_t index;                  // in the chip's output request (-1 => input)
+	int event_fd;                  // the input's own request
+} pin_map[GPIO_CDEV_MAX_PINS];
+
+// panels on different threads share the requests and output values
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+// local function prototypes
+static bool find_pin(int pin, int *chip, unsigned int *offset);
+static void set_mode(GPIO_pin_type pin, GPIO_mode_type mode);
+static void write_pin(GPIO_pin_type pin, int value);
+static bool request_lines(chip_type *chip);
+static int request_input(chip_type *chip, unsigned int offset);
+static void remove_output(int c, GPIO_pin_type pin);
+static void drain_events(int fd);
+static int64_t now_ms(void);
+
+
+// open every GPIO chip and find which GPIO numbers it holds
+// return false if there is none
+bool GPIO_setup() {
+
+	for (int i = 0; i < GPIO_CDEV_MAX_PINS; ++i) {
+		pin_map[i].chip = -1;
+		pin_map[i].event_fd = -1;
+	}
+
+	chip_count = 0;
+	unsigned int first = 0;
+	for (int i = 0; i < GPIO_CDEV_MAX_CHIPS; ++i) {
+		char path[32];
+		snprintf(path, sizeof(path), "/dev/gpiochip%d", i);
+		int fd = open(path, O_RDWR | O_CLOEXEC);
+		if (fd < 0) {
+			break;
+		}
+		struct gpiochip_info info;
+		memset(&info, 0, sizeof(info));
+		if (-1 == ioctl(fd, GPIO_GET_CHIPINFO_IOCTL, &info)) {
+			warn("GPIO_setup: cannot read %s", path);
+			close(fd);
+			break;
+		}
+		chip_type *chip = &chips[chip_count++];
+		memset(chip, 0, sizeof(*chip));
+		chip->fd = fd;
+		chip->first = first;
+		chip->lines = info.lines;
+		chip->request_fd = -1;
+		first += info.lines;
+	}
+
+	if (0 == chip_count) {
+		warn("GPIO_setup: no /dev/gpiochip0");
+		return false;
+	}
+	return true;
+}
+
+
+// release all lines and close the chips
+bool GPIO_teardown() {
+	for (int i = 0; i < GPIO_CDEV_MAX_PINS; ++i) {
+		if (pin_map[i].event_fd >= 0) {
+			close(pin_map[i].event_fd);
+			pin_map[i].event_fd = -1;
+		}
+		pin_map[i].chip = -1;
+	}
+	for (int i = 0; i < chip_count; ++i) {
+		if (chips[i].request_fd >= 0) {
+			close(chips[i].request_fd);
+		}
+		close(chips[i].fd);
+	}
+	chip_count = 0;
+	return true;
+}
+
+
+// set a mode for a given GPIO pin: an output is added to its chip's
+// request, an input gets a request of its own
+void GPIO_mode(GPIO_pin_type pin, GPIO_mode_type mode) {
+	pthread_mutex_lock(&lock);
+	set_mode(pin, mode);
+	pthread_mutex_unlock(&lock);
+}
+
+
+// return a value (0/1) for a given pin
+int GPIO_read(GPIO_pin_type pin) {
+	if ((unsigned)(pin) >= GPIO_CDEV_MAX_PINS) {
+		return 0;
+	}
+	pthread_mutex_lock(&lock);
+	if (pin_map[pin].chip < 0) {
+		pthread_mutex_unlock(&lock);
+		return 0;
+	}
+	int fd = pin_map[pin].event_fd;
+	uint64_t bit = 1;
+	if (pin_map[pin].index >= 0) {
+		fd = chips[pin_map[pin].chip].request_fd;
+		bit = 1ull << pin_map[pin].index;
+	}
+	struct gpio_v2_line_values values = {
+		.bits = 0,
+		.mask = bit,
+	};
+	int rc = ioctl(fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values);
+	pthread_mutex_unlock(&lock);
+	if (-1 == rc) {
+		warn("GPIO_read: failed for pin: %d", pin);
+		return 0;
+	}
+	return 0 != (values.bits & bit);
+}
+
+
+// set or clear a given output pin
+void GPIO_write(GPIO_pin_type pin, int value) {
+	pthread_mutex_lock(&lock);
+	write_pin(pin, value);
+	pthread_mutex_unlock(&lock);
+}
+
+
+// one ioctl for each chip the pins are on
+void GPIO_write_pins(const GPIO_pin_value *pins, size_t count) {
+	uint64_t masks[GPIO_CDEV_MAX_CHIPS];
+	memset(masks, 0, sizeof(masks));
+	pthread_mutex_lock(&lock);
+	for (size_t i = 0; i < count; ++i) {
+		int pin = pins[i].pin;
+		if ((unsigned)(pin) >= GPIO_CDEV_MAX_PINS || pin_map[pin].chip < 0 || pin_map[pin].index < 0) {
+			continue;
+		}
+		chip_type *chip = &chips[pin_map[pin].chip];
+		uint64_t bit = 1ull << pin_map[pin].index;
+		if (0 == pins[i].value) {
+			chip->values &= ~bit;
+		} else {
+			chip->values |= bit;
+		}
+		masks[pin_map[pin].chip] |= bit;
+	}
+	for (int c = 0; c < chip_count; ++c) {
+		if (0 == masks[c]) {
+			continue;
+		}
+		struct gpio_v2_line_values values = {
+			.bits = chips[c].values & masks[c],
+			.mask = masks[c],
+		};
+		if (-1 == ioctl(chips[c].request_fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &values)) {
+			warn("GPIO_write_pins: failed");
+		}
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+
+// block until an input pin reads level (0/1) or timeout_ms
+// milliseconds pass (GPIO_WAIT_FOREVER => no timeout)
+// return false on timeout
+bool GPIO_wait_edge(GPIO_pin_type pin, int level, int timeout_ms) {
+	if ((unsigned)(pin) >= GPIO_CDEV_MAX_PINS || pin_map[pin].chip < 0) {
+		return false;
+	}
+	int fd = pin_map[pin].index < 0 ? pin_map[pin].event_fd : -1;
+	level = (0 != level);
+
+	int64_t deadline = now_ms() + timeout_ms;
+	for (;;) {
+		// events from before the read are stale, any later one
+		// wakes the poll; only this pin's edges are on its request
+		if (fd >= 0) {
+			drain_events(fd);
+		}
+		if (level == GPIO_read(pin)) {
+			return true;
+		}
+		int wait = -1;
+		if (timeout_ms >= 0) {
+			int64_t remaining = deadline - now_ms();
+			if (remaining <= 0) {
+				return false;
+			}
+			wait = remaining;
+		}
+		if (fd < 0) {
+			usleep(10);  // an output has no edge events
+			continue;
+		}
+		struct pollfd fds = {
+			.fd = fd,
+			.events = POLLIN,
+		};
+		if (-1 == poll(&fds, 1, wait) && EINTR != errno) {
+			warn("GPIO_wait_edge: poll failed for pin: %d", pin);
+			return false;
+		}
+	}
+}
+
+
+// PWM is not available
+void GPIO_pwm_write(GPIO_pin_type pin, uint32_t value) {
+}
+
+
+// private functions
+// =================
+
+// the chip and line offset of a GPIO number
+static bool find_pin(int pin, int *chip, unsigned int *offset) {
+	if (pin < 0 || pin >= GPIO_CDEV_MAX_PINS) {
+		return false;
+	}
+	for (int i = 0; i < chip_count; ++i) {
+		if ((unsigned)(pin) >= chips[i].first && (unsigned)(pin) < chips[i].first + chips[i].lines) {
+			*chip = i;
+			*offset = pin - chips[i].first;
+			return true;
+		}
+	}
+	return false;
+}
+
+
+// GPIO_mode with the lock held
+static void set_mode(GPIO_pin_type pin, GPIO_mode_type mode) {
+
+	int c;
+	unsigned int offset;
+	if (!find_pin(pin, &c, &offset)) {
+		warn("GPIO_mode: no such pin: %d", pin);
+		return;
+	}
+	chip_type *chip = &chips[c];
+
+	bool input = GPIO_INPUT == mode;
+	if (GPIO_PWM == mode) {
+		warn("GPIO_mode: no PWM on the GPIO character device, pin: %d is an output", pin);
+	}
+
+	// a pin that keeps its direction only goes low, as the other backends
+	if (pin_map[pin].chip >= 0) {
+		if (pin_map[pin].index >= 0) {
+			if (!input) {
+				write_pin(pin, 0);
+				return;
+			}
+			remove_output(c, pin);
+		} else {
+			if (input) {
+				return;
+			}
+			close(pin_map[pin].event_fd);
+			pin_map[pin].event_fd = -1;
+		}
+		pin_map[pin].chip = -1;
+	}
+
+	if (input) {
+		int fd = request_input(chip, offset);
+		if (fd >= 0) {
+			pin_map[pin].chip = c;
+			pin_map[pin].index = -1;
+			pin_map[pin].event_fd = fd;
+		}
+		return;
+	}
+
+	if (GPIO_V2_LINES_MAX == chip->count) {
+		warn("GPIO_mode: too many lines on one chip for pin: %d", pin);
+		return;
+	}
+	pin_map[pin].chip = c;
+	pin_map[pin].index = chip->count;
+	chip->offsets[chip->count] = offset;
+	chip->values &= ~(1ull << chip->count);
+	++chip->count;
+
+	if (!request_lines(chip)) {
+		// get the other lines back without the new one
+		--chip->count;
+		pin_map[pin].chip = -1;
+		if (chip->count > 0) {
+			request_lines(chip);
+		}
+	}
+}
+
+
+// GPIO_write with the lock held
+static void write_pin(GPIO_pin_type pin, int value) {
+	if ((unsigned)(pin) >= GPIO_CDEV_MAX_PINS || pin_map[pin].chip < 0 || pin_map[pin].index < 0) {
+		return;
+	}
+	chip_type *chip = &chips[pin_map[pin].chip];
+	uint64_t bit = 1ull << pin_map[pin].index;
+	if (0 == value) {
+		chip->values &= ~bit;
+	} else {
+		chip->values |= bit;
+	}
+	struct gpio_v2_line_values values = {
+		.bits = chip->values & bit,
+		.mask = bit,
+	};
+	if (-1 == ioctl(chip->request_fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &values)) {
+		warn("GPIO_write: failed for pin: %d", pin);
+	}
+}
+
+
+// request the chip's outputs, replacing the previous request
+static bool request_lines(chip_type *chip) {
+
+	struct gpio_v2_line_request request;
+	memset(&request, 0, sizeof(request));
+	memcpy(request.offsets, chip->offsets, chip->count * sizeof(chip->offsets[0]));
+	strncpy(request.consumer, GPIO_CDEV_CONSUMER, sizeof(request.consumer) - 1);
+	request.config.flags = GPIO_V2_LINE_FLAG_OUTPUT;
+	request.config.num_attrs = 1;
+	request.config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+	request.config.attrs[0].attr.values = chip->values;
+	request.config.attrs[0].mask = (GPIO_V2_LINES_MAX == chip->count) ? ~0ull : (1ull << chip->count) - 1;
+	request.num_lines = chip->count;
+
+	// the old request has to go first as it holds the same lines
+	if (chip->request_fd >= 0) {
+		close(chip->request_fd);
+		chip->request_fd = -1;
+	}
+	if (-1 == ioctl(chip->fd, GPIO_V2_GET_LINE_IOCTL, &request)) {
+		warn("GPIO_mode: cannot request lines");
+		return false;
+	}
+	chip->request_fd = request.fd;
+	return true;
+}
+
+
+// request one input with edge events, returns its fd or -1
+static int request_input(chip_type *chip, unsigned int offset) {
+
+	struct gpio_v2_line_request request;
+	memset(&request, 0, sizeof(request));
+	request.offsets[0] = offset;
+	strncpy(request.consumer, GPIO_CDEV_CONSUMER, sizeof(request.consumer) - 1);
+	request.config.flags = GPIO_V2_LINE_FLAG_INPUT
+		| GPIO_V2_LINE_FLAG_EDGE_RISING
+		| GPIO_V2_LINE_FLAG_EDGE_FALLING;
+	request.num_lines = 1;
+
+	if (-1 == ioctl(chip->fd, GPIO_V2_GET_LINE_IOCTL, &request)) {
+		warn("GPIO_mode: cannot request input line: %u", offset);
+		return -1;
+	}
+	fcntl(request.fd, F_SETFL, fcntl(request.fd, F_GETFL) | O_NONBLOCK);
+	return request.fd;
+}
+
+
+// take an output out of its chip's request, moving the ones after it
+// down an index
+static void remove_output(int c, GPIO_pin_type pin) {
+	chip_type *chip = &chips[c];
+	int index = pin_map[pin].index;
+
+	for (unsigned int i = index + 1; i < chip->count; ++i) {
+		chip->offsets[i - 1] = chip->offsets[i];
+	}
+	uint64_t below = (1ull << index) - 1;
+	chip->values = (chip->values & below) | ((chip->values >> 1) & ~below);
+	--chip->count;
+
+	for (int p = 0; p < GPIO_CDEV_MAX_PINS; ++p) {
+		if (c == pin_map[p].chip && pin_map[p].index > index) {
+			--pin_map[p].index;
+		}
+	}
+	pin_map[pin].index = -1;
+
+	if (chip->count > 0) {
+		request_lines(chip);
+	} else if (chip->request_fd >= 0) {
+		close(chip->request_fd);
+		chip->request_fd = -1;
+	}
+}
+
+
+// discard queued edge events
+static void drain_events(int fd) {
+	struct gpio_v2_line_event events[16];
+	while (read(fd, events, sizeof(events)) > 0) {
+	}
+}
+
+
+static int64_t now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
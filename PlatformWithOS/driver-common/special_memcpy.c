@@ -0,0 +1,232 @@
+// Copyright 2013-2015 Pervasive Displays, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at:
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+// express or implied.  See the License for the specific language
+// governing permissions and limitations under the License.
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SPECIAL_MEMCPY_X86 1
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define SPECIAL_MEMCPY_NEON 1
+#include <arm_neon.h>
+#endif
+
+#include "special_memcpy.h"
+
+
+// the vector kernels reverse the bits of each byte by looking up each
+// nibble in a 16 entry table and swapping the two halves over
+static const uint8_t reverse_nibble[16] = {
+	0x0, 0x8, 0x4, 0xc, 0x2, 0xa, 0x6, 0xe, 0x1, 0x9, 0x5, 0xd, 0x3, 0xb, 0x7, 0xf
+};
+
+
+// bit reversed table
+static const uint8_t reverse[256] = {
+//	__00____01____02____03____04____05____06____07____08____09____0a____0b____0c____0d____0e____0f
+	0x00, 0x80, 0x40, 0xc0, 0x20, 0xa0, 0x60, 0xe0, 0x10, 0x90, 0x50, 0xd0, 0x30, 0xb0, 0x70, 0xf0,
+//	__10____11____12____13____14____15____16____17____18____19____1a____1b____1c____1d____1e____1f
+	0x08, 0x88, 0x48, 0xc8, 0x28, 0xa8, 0x68, 0xe8, 0x18, 0x98, 0x58, 0xd8, 0x38, 0xb8, 0x78, 0xf8,
+//	__20____21____22____23____24____25____26____27____28____29____2a____2b____2c____2d____2e____2f
+	0x04, 0x84, 0x44, 0xc4, 0x24, 0xa4, 0x64, 0xe4, 0x14, 0x94, 0x54, 0xd4, 0x34, 0xb4, 0x74, 0xf4,
+//	__30____31____32____33____34____35____36____37____38____39____3a____3b____3c____3d____3e____3f
+	0x0c, 0x8c, 0x4c, 0xcc, 0x2c, 0xac, 0x6c, 0xec, 0x1c, 0x9c, 0x5c, 0xdc, 0x3c, 0xbc, 0x7c, 0xfc,
+//	__40____41____42____43____44____45____46____47____48____49____4a____4b____4c____4d____4e____4f
+	0x02, 0x82, 0x42, 0xc2, 0x22, 0xa2, 0x62, 0xe2, 0x12, 0x92, 0x52, 0xd2, 0x32, 0xb2, 0x72, 0xf2,
+//	__50____51____52____53____54____55____56____57____58____59____5a____5b____5c____5d____5e____5f
+	0x0a, 0x8a, 0x4a, 0xca, 0x2a, 0xaa, 0x6a, 0xea, 0x1a, 0x9a, 0x5a, 0xda, 0x3a, 0xba, 0x7a, 0xfa,
+//	__60____61____62____63____64____65____66____67____68____69____6a____6b____6c____6d____6e____6f
+	0x06, 0x86, 0x46, 0xc6, 0x26, 0xa6, 0x66, 0xe6, 0x16, 0x96, 0x56, 0xd6, 0x36, 0xb6, 0x76, 0xf6,
+//	__70____71____72____73____74____75____76____77____78____79____7a____7b____7c____7d____7e____7f
+	0x0e, 0x8e, 0x4e, 0xce, 0x2e, 0xae, 0x6e, 0xee, 0x1e, 0x9e, 0x5e, 0xde, 0x3e, 0xbe, 0x7e, 0xfe,
+//	__80____81____82____83____84____85____86____87____88____89____8a____8b____8c____8d____8e____8f
+	0x01, 0x81, 0x41, 0xc1, 0x21, 0xa1, 0x61, 0xe1, 0x11, 0x91, 0x51, 0xd1, 0x31, 0xb1, 0x71, 0xf1,
+//	__90____91____92____93____94____95____96____97____98____99____9a____9b____9c____9d____9e____9f
+	0x09, 0x89, 0x49, 0xc9, 0x29, 0xa9, 0x69, 0xe9, 0x19, 0x99, 0x59, 0xd9, 0x39, 0xb9, 0x79, 0xf9,
+//	__a0____a1____a2____a3____a4____a5____a6____a7____a8____a9____aa____ab____ac____ad____ae____af
+	0x05, 0x85, 0x45, 0xc5, 0x25, 0xa5, 0x65, 0xe5, 0x15, 0x95, 0x55, 0xd5, 0x35, 0xb5, 0x75, 0xf5,
+//	__b0____b1____b2____b3____b4____b5____b6____b7____b8____b9____ba____bb____bc____bd____be____bf
+	0x0d, 0x8d, 0x4d, 0xcd, 0x2d, 0xad, 0x6d, 0xed, 0x1d, 0x9d, 0x5d, 0xdd, 0x3d, 0xbd, 0x7d, 0xfd,
+//	__c0____c1____c2____c3____c4____c5____c6____c7____c8____c9____ca____cb____cc____cd____ce____cf
+	0x03, 0x83, 0x43, 0xc3, 0x23, 0xa3, 0x63, 0xe3, 0x13, 0x93, 0x53, 0xd3, 0x33, 0xb3, 0x73, 0xf3,
+//	__d0____d1____d2____d3____d4____d5____d6____d7____d8____d9____da____db____dc____dd____de____df
+	0x0b, 0x8b, 0x4b, 0xcb, 0x2b, 0xab, 0x6b, 0xeb, 0x1b, 0x9b, 0x5b, 0xdb, 0x3b, 0xbb, 0x7b, 0xfb,
+//	__e0____e1____e2____e3____e4____e5____e6____e7____e8____e9____ea____eb____ec____ed____ee____ef
+	0x07, 0x87, 0x47, 0xc7, 0x27, 0xa7, 0x67, 0xe7, 0x17, 0x97, 0x57, 0xd7, 0x37, 0xb7, 0x77, 0xf7,
+//	__f0____f1____f2____f3____f4____f5____f6____f7____f8____f9____fa____fb____fc____fd____fe____ff
+	0x0f, 0x8f, 0x4f, 0xcf, 0x2f, 0xaf, 0x6f, 0xef, 0x1f, 0x9f, 0x5f, 0xdf, 0x3f, 0xbf, 0x7f, 0xff
+};
+
+
+// a kernel converts as many whole vectors as it can and returns the
+// number of bytes done, the remainder is finished by the scalar code
+typedef size_t kernel_function(uint8_t *d, const uint8_t *s, size_t size, bool bit_reversed, uint8_t invert);
+
+static kernel_function *select_kernel(const char **name);
+static void scalar(uint8_t *d, const uint8_t *s, size_t size, bool bit_reversed, uint8_t invert);
+
+
+// functions
+// =========
+
+void special_memcpy(char *d, const char *s, size_t size, bool bit_reversed, bool inverted) {
+	if (!bit_reversed && !inverted) {
+		memcpy(d, s, size);
+		return;
+	}
+	const uint8_t invert = inverted ? 0xff : 0x00;
+	size_t n = 0;
+	kernel_function *kernel = select_kernel(NULL);
+	if (NULL != kernel) {
+		n = kernel((uint8_t *)d, (const uint8_t *)s, size, bit_reversed, invert);
+	}
+	scalar((uint8_t *)d + n, (const uint8_t *)s + n, size - n, bit_reversed, invert);
+}
+
+
+void special_memcpy_scalar(char *d, const char *s, size_t size, bool bit_reversed, bool inverted) {
+	if (!bit_reversed && !inverted) {
+		memcpy(d, s, size);
+		return;
+	}
+	scalar((uint8_t *)d, (const uint8_t *)s, size, bit_reversed, inverted ? 0xff : 0x00);
+}
+
+
+const char *special_memcpy_kernel(void) {
+	const char *name = "scalar";
+	select_kernel(&name);
+	return name;
+}
+
+
+// internal functions
+// ==================
+
+static void scalar(uint8_t *d, const uint8_t *s, size_t size, bool bit_reversed, uint8_t invert) {
+	if (bit_reversed) {
+		for (size_t n = 0; n < size; ++n) {
+			d[n] = reverse[s[n]] ^ invert;
+		}
+	} else {
+		for (size_t n = 0; n < size; ++n) {
+			d[n] = s[n] ^ invert;
+		}
+	}
+}
+
+
+#if SPECIAL_MEMCPY_X86
+
+__attribute__((target("ssse3")))
+static size_t kernel_ssse3(uint8_t *d, const uint8_t *s, size_t size, bool bit_reversed, uint8_t invert) {
+	const __m128i table = _mm_loadu_si128((const __m128i *)reverse_nibble);
+	const __m128i low_nibble = _mm_set1_epi8(0x0f);
+	const __m128i x = _mm_set1_epi8((char)invert);
+	size_t n = 0;
+	for (; n + 16 <= size; n += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)&s[n]);
+		if (bit_reversed) {
+			__m128i lo = _mm_shuffle_epi8(table, _mm_and_si128(v, low_nibble));
+			__m128i hi = _mm_shuffle_epi8(table, _mm_and_si128(_mm_srli_epi16(v, 4), low_nibble));
+			v = _mm_or_si128(_mm_slli_epi16(lo, 4), hi);
+		}
+		_mm_storeu_si128((__m128i *)&d[n], _mm_xor_si128(v, x));
+	}
+	return n;
+}
+
+
+__attribute__((target("avx2")))
+static size_t kernel_avx2(uint8_t *d, const uint8_t *s, size_t size, bool bit_reversed, uint8_t invert) {
+	const __m256i table = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)reverse_nibble));
+	const __m256i low_nibble = _mm256_set1_epi8(0x0f);
+	const __m256i x = _mm256_set1_epi8((char)invert);
+	size_t n = 0;
+	for (; n + 32 <= size; n += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)&s[n]);
+		if (bit_reversed) {
+			__m256i lo = _mm256_shuffle_epi8(table, _mm256_and_si256(v, low_nibble));
+			__m256i hi = _mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(v, 4), low_nibble));
+			v = _mm256_or_si256(_mm256_slli_epi16(lo, 4), hi);
+		}
+		_mm256_storeu_si256((__m256i *)&d[n], _mm256_xor_si256(v, x));
+	}
+	return n + kernel_ssse3(d + n, s + n, size - n, bit_reversed, invert);
+}
+
+#elif SPECIAL_MEMCPY_NEON
+
+static size_t kernel_neon(uint8_t *d, const uint8_t *s, size_t size, bool bit_reversed, uint8_t invert) {
+	const uint8x16_t x = vdupq_n_u8(invert);
+#if !defined(__aarch64__)
+	const uint8x8x2_t table = {{vld1_u8(reverse_nibble), vld1_u8(reverse_nibble + 8)}};
+	const uint8x8_t low_nibble = vdup_n_u8(0x0f);
+#endif
+	size_t n = 0;
+	for (; n + 16 <= size; n += 16) {
+		uint8x16_t v = vld1q_u8(&s[n]);
+		if (bit_reversed) {
+#if defined(__aarch64__)
+			v = vrbitq_u8(v);
+#else
+			// ARMv7 has no byte bit reverse, use the nibble table
+			uint8x8_t a = vget_low_u8(v);
+			uint8x8_t b = vget_high_u8(v);
+			a = vorr_u8(vshl_n_u8(vtbl2_u8(table, vand_u8(a, low_nibble)), 4), vtbl2_u8(table, vshr_n_u8(a, 4)));
+			b = vorr_u8(vshl_n_u8(vtbl2_u8(table, vand_u8(b, low_nibble)), 4), vtbl2_u8(table, vshr_n_u8(b, 4)));
+			v = vcombine_u8(a, b);
+#endif
+		}
+		vst1q_u8(&d[n], veorq_u8(v, x));
+	}
+	return n;
+}
+
+#endif
+
+
+// choose the kernel once; the result is the same in every thread so
+// a race between two first callers is harmless
+static kernel_function *select_kernel(const char **name) {
+	static kernel_function *selected = NULL;
+	static const char *selected_name = NULL;
+
+	if (NULL == __atomic_load_n(&selected_name, __ATOMIC_ACQUIRE)) {
+		kernel_function *kernel = NULL;
+		const char *kernel_name = "scalar";
+#if SPECIAL_MEMCPY_X86
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2")) {
+			kernel = kernel_avx2;
+			kernel_name = "avx2";
+		} else if (__builtin_cpu_supports("ssse3")) {
+			kernel = kernel_ssse3;
+			kernel_name = "ssse3";
+		}
+#elif SPECIAL_MEMCPY_NEON
+		kernel = kernel_neon;
+		kernel_name = "neon";
+#endif
+		selected = kernel;
+		__atomic_store_n(&selected_name, kernel_name, __ATOMIC_RELEASE);
+	}
+	if (NULL != name) {
+		*name = selected_name;
+	}
+	return selected;
+}
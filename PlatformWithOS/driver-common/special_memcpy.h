@@ -0,0 +1,39 @@
+// Copyright 2013-2015 Pervasive Displays, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at:
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+// express or implied.  See the License for the specific language
+// governing permissions and limitations under the License.
+
+
+#if !defined(SPECIAL_MEMCPY_H)
+#define SPECIAL_MEMCPY_H 1
+
+#include <stddef.h>
+#include <stdbool.h>
+
+
+// functions
+// =========
+
+// copy buffer converting between the big endian, non-inverted layout
+// of the display and the LE and _inverse views of it.
+// uses the fastest kernel the CPU supports (SSSE3/AVX2 chosen at run
+// time on x86, NEON when the compiler targets it on ARM)
+void special_memcpy(char *d, const char *s, size_t size, bool bit_reversed, bool inverted);
+
+// same result as special_memcpy, always one byte at a time
+void special_memcpy_scalar(char *d, const char *s, size_t size, bool bit_reversed, bool inverted);
+
+// name of the kernel used by special_memcpy: "avx2", "ssse3", "neon" or "scalar"
+const char *special_memcpy_kernel(void);
+
+
+#endif
@@ -20,21 +20,84 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <err.h>
+#include <errno.h>
+#include <string.h>
+#include <pthread.h>
+#include <semaphore.h>
 #include <sys/ioctl.h>
 #include <linux/spi/spidev.h>
 
 #include "spi.h"
+#include "epd.h"
 
 
+// the most transfers in one SPI_IOC_MESSAGE; the ioctl size field
+// limits this to 511, but a few hundred already covers several lines
+#define SPI_MAX_TRANSFERS 256
+
+// spidev rejects a message with more data than its bufsiz parameter
+#define SPIDEV_BUFSIZ_PATH "/sys/module/spidev/parameters/bufsiz"
+#define SPIDEV_DEFAULT_BUFSIZ 4096
+
+// batches in the ring between the caller and the sender thread; with
+// two the caller fills one while the other is being sent
+#define SPI_BATCHES 2
+
+// mode used between SPI_on and SPI_off
+#if EPD_CHIP_VERSION == 1
+#define SPI_ON_MODE SPI_MODE_2
+#else
+#define SPI_ON_MODE SPI_MODE_0
+#endif
+
+// transfers for one SPI_IOC_MESSAGE, the data is copied so callers
+// may reuse their buffers at once
+typedef struct {
+	size_t transfer_count;
+	size_t data_length;
+	struct spi_ioc_transfer transfers[SPI_MAX_TRANSFERS];
+	uint8_t *data;                 // bufsiz bytes
+} batch_type;
+
 // spi information
 struct SPI_struct {
 	int fd;
 	uint32_t bps;
+
+	// settings last written to spidev, so unchanged ones are skipped
+	bool configured;               // bits per word and bit order set
+	bool mode_valid;
+	uint8_t mode;
+	uint32_t speed_hz;
+
+	// between SPI_session_begin and SPI_session_end SPI_off keeps the
+	// SPI_on mode instead of switching back and forth every line
+	bool session;
+
+	// transfers queued between SPI_batch_begin and SPI_batch_end go
+	// into a ring of batches.  The caller owns batches[filling]; a full
+	// one is handed to the sender thread, which sends the batches in
+	// order.  The two semaphores are the only handoff: 'full' counts
+	// batches waiting for the sender and 'empty' the free ones
+	bool batch;
+	size_t bufsiz;                 // data bytes allowed in one message
+	batch_type batches[SPI_BATCHES];
+	int filling;                   // only used by the caller
+	int sending;                   // only used by the sender
+	bool pending;                  // batches handed over since the last wait
+	bool stop;
+	sem_t full;
+	sem_t empty;
+	pthread_t sender;
 };
 
 
 // prototypes
 static void set_spi_mode(SPI_type *spi, uint8_t mode);
+static size_t spidev_bufsiz(void);
+static void *sender_thread(void *context);
+static void wait_sent(SPI_type *spi);
+static void free_batches(SPI_type *spi);
 
 
 // enable SPI access SPI fd
@@ -55,6 +118,47 @@ SPI_type *SPI_create(const char *spi_path, uint32_t bps) {
 
 	spi->bps = bps;
 
+	spi->configured = false;
+	spi->mode_valid = false;
+	spi->mode = SPI_MODE_0;
+	spi->speed_hz = 0;
+	spi->session = false;
+
+	spi->batch = false;
+	spi->bufsiz = spidev_bufsiz();
+	for (int i = 0; i < SPI_BATCHES; ++i) {
+		spi->batches[i].transfer_count = 0;
+		spi->batches[i].data_length = 0;
+		spi->batches[i].data = malloc(spi->bufsiz);
+	}
+	for (int i = 0; i < SPI_BATCHES; ++i) {
+		if (NULL == spi->batches[i].data) {
+			free_batches(spi);
+			close(spi->fd);
+			free(spi);
+			warn("falled to allocate SPI batch buffer");
+			return NULL;
+		}
+	}
+
+	// the caller starts with batch 0, the rest are free
+	spi->filling = 0;
+	spi->sending = 0;
+	spi->pending = false;
+	spi->stop = false;
+	sem_init(&spi->full, 0, 0);
+	sem_init(&spi->empty, 0, SPI_BATCHES - 1);
+	errno = pthread_create(&spi->sender, NULL, sender_thread, spi);
+	if (0 != errno) {
+		warn("cannot start SPI sender thread");
+		sem_destroy(&spi->full);
+		sem_destroy(&spi->empty);
+		free_batches(spi);
+		close(spi->fd);
+		free(spi);
+		return NULL;
+	}
+
 	return spi;
 }
 
@@ -64,7 +168,17 @@ bool SPI_destroy(SPI_type *spi) {
 	if (NULL == spi) {
 		return false;
 	}
+	SPI_flush(spi);
+	wait_sent(spi);
+
+	spi->stop = true;
+	sem_post(&spi->full);
+	pthread_join(spi->sender, NULL);
+	sem_destroy(&spi->full);
+	sem_destroy(&spi->empty);
+
 	close(spi->fd);
+	free_batches(spi);
 	free(spi);
 	return true;
 }
@@ -75,11 +189,7 @@ bool SPI_destroy(SPI_type *spi) {
 void SPI_on(SPI_type *spi) {
 	const uint8_t buffer[1] = {0};
 
-#if EPD_COG_VERSION == 1
-	set_spi_mode(spi, SPI_MODE_2);
-#else
-	set_spi_mode(spi, SPI_MODE_0);
-#endif
+	set_spi_mode(spi, SPI_ON_MODE);
 	SPI_send(spi, buffer, sizeof(buffer));
 }
 
@@ -89,13 +199,41 @@ void SPI_on(SPI_type *spi) {
 void SPI_off(SPI_type *spi) {
 	const uint8_t buffer[1] = {0};
 
-	set_spi_mode(spi, SPI_MODE_0);
+	if (!spi->session) {
+		set_spi_mode(spi, SPI_MODE_0);
+	}
 	SPI_send(spi, buffer, sizeof(buffer));
 }
 
 // send a data block to SPI
 // will only change CS if the SPI_CS bits are set
 void SPI_send(SPI_type *spi, const void *buffer, size_t length) {
+	if (spi->batch && length <= spi->bufsiz) {
+		batch_type *batch = &spi->batches[spi->filling];
+		if (SPI_MAX_TRANSFERS == batch->transfer_count ||
+		    batch->data_length + length > spi->bufsiz) {
+			SPI_flush(spi);
+			batch = &spi->batches[spi->filling];
+		}
+		uint8_t *data = batch->data + batch->data_length;
+		memcpy(data, buffer, length);
+		batch->data_length += length;
+
+		// CS is released after every transfer, as for separate sends;
+		// SPI_flush clears cs_change on the last one of each message
+		struct spi_ioc_transfer *transfer = &batch->transfers[batch->transfer_count++];
+		memset(transfer, 0, sizeof(*transfer));
+		transfer->tx_buf = (unsigned long)(data);
+		transfer->len = length;
+		transfer->delay_usecs = 2;
+		transfer->speed_hz = spi->bps;
+		transfer->bits_per_word = 8;
+		transfer->cs_change = 1;
+		return;
+	}
+	SPI_flush(spi);
+	wait_sent(spi);
+
 	struct spi_ioc_transfer transfer_buffer[1] = {
 		{
 			.tx_buf = (unsigned long)(buffer),
@@ -116,6 +254,9 @@ void SPI_send(SPI_type *spi, const void *buffer, size_t length) {
 // send a data block to SPI and return last bytes returned by slave
 // will only change CS if the SPI_CS bits are set
 void SPI_read(SPI_type *spi, const void *buffer, void *received, size_t length) {
+	SPI_flush(spi);
+	wait_sent(spi);
+
 	struct spi_ioc_transfer transfer_buffer[1] = {
 		{
 			.tx_buf = (unsigned long)(buffer),
@@ -134,9 +275,136 @@ void SPI_read(SPI_type *spi, const void *buffer, void *received, size_t length)
 }
 
 
+// select the SPI_on mode and keep it until SPI_session_end
+void SPI_session_begin(SPI_type *spi) {
+	set_spi_mode(spi, SPI_ON_MODE);
+	spi->session = true;
+}
+
+
+// leave the bus as SPI_off would have
+void SPI_session_end(SPI_type *spi) {
+	const uint8_t buffer[1] = {0};
+
+	spi->session = false;
+	if (SPI_MODE_0 != spi->mode) {
+		set_spi_mode(spi, SPI_MODE_0);
+		SPI_send(spi, buffer, sizeof(buffer));
+	}
+}
+
+
+// start collecting transfers to send as few ioctls
+void SPI_batch_begin(SPI_type *spi) {
+	spi->batch = true;
+}
+
+
+// send all collected transfers and go back to sending at once; the
+// caller may toggle GPIOs next, so wait until they are on the bus
+void SPI_batch_end(SPI_type *spi) {
+	SPI_flush(spi);
+	wait_sent(spi);
+	spi->batch = false;
+}
+
+
+// hand the collected transfers to the sender thread as one
+// SPI_IOC_MESSAGE and take the next free batch, waiting only if
+// every other batch is still queued
+void SPI_flush(SPI_type *spi) {
+	batch_type *batch = &spi->batches[spi->filling];
+	if (0 == batch->transfer_count) {
+		return;
+	}
+
+	// a cs_change on the last transfer would keep CS active after the
+	// message, the end of the message releases it anyway
+	batch->transfers[batch->transfer_count - 1].cs_change = 0;
+
+	sem_post(&spi->full);
+	spi->pending = true;
+	spi->filling = (spi->filling + 1) % SPI_BATCHES;
+	while (0 != sem_wait(&spi->empty)) {
+	}
+}
+
+
+// each transfer carries its speed, but spidev also limits it to the
+// maximum, so that is raised by setting the mode again
+void SPI_set_speed(SPI_type *spi, uint32_t bps) {
+	SPI_flush(spi);
+	wait_sent(spi);
+	spi->bps = bps;
+	if (spi->mode_valid) {
+		set_spi_mode(spi, spi->mode);
+	}
+}
+
+
 // internal functions
 // ==================
 
+// send the batches handed over by SPI_flush, in order
+static void *sender_thread(void *context) {
+	SPI_type *spi = context;
+	for (;;) {
+		while (0 != sem_wait(&spi->full)) {
+		}
+		if (spi->stop) {
+			break;
+		}
+		batch_type *batch = &spi->batches[spi->sending];
+		if (-1 == ioctl(spi->fd, SPI_IOC_MESSAGE(batch->transfer_count), batch->transfers)) {
+			warn("SPI: send failure");
+		}
+		batch->transfer_count = 0;
+		batch->data_length = 0;
+		spi->sending = (spi->sending + 1) % SPI_BATCHES;
+		sem_post(&spi->empty);
+	}
+	return NULL;
+}
+
+
+// wait until the sender has sent every batch handed to it, i.e. all
+// the batches but the one being filled are free
+static void wait_sent(SPI_type *spi) {
+	if (!spi->pending) {
+		return;
+	}
+	for (int i = 0; i < SPI_BATCHES - 1; ++i) {
+		while (0 != sem_wait(&spi->empty)) {
+		}
+	}
+	for (int i = 0; i < SPI_BATCHES - 1; ++i) {
+		sem_post(&spi->empty);
+	}
+	spi->pending = false;
+}
+
+
+static void free_batches(SPI_type *spi) {
+	for (int i = 0; i < SPI_BATCHES; ++i) {
+		free(spi->batches[i].data);
+	}
+}
+
+// read spidev's limit on the data in one message
+static size_t spidev_bufsiz(void) {
+	size_t bufsiz = SPIDEV_DEFAULT_BUFSIZ;
+	FILE *f = fopen(SPIDEV_BUFSIZ_PATH, "r");
+	if (NULL != f) {
+		unsigned long n = 0;
+		if (1 == fscanf(f, "%lu", &n) && n > 0) {
+			bufsiz = n;
+		}
+		fclose(f);
+	}
+	return bufsiz;
+}
+
+
 static void set_spi_mode(SPI_type *spi, uint8_t in_mode) {
 
 	uint8_t mode = in_mode;
@@ -144,20 +412,38 @@ static void set_spi_mode(SPI_type *spi, uint8_t in_mode) {
 	uint8_t lsb_first = 0;
 	uint32_t speed_hz = spi->bps;
 
-	// WR
-	if (-1 == ioctl(spi->fd, SPI_IOC_WR_MODE, &mode)) {
-		err(1,"SPI: cannot set SPI_IOC_WR_MODE  =%d", mode);
+	if (spi->configured && spi->mode_valid && mode == spi->mode && speed_hz == spi->speed_hz) {
+		return;
 	}
 
-	if (-1 == ioctl(spi->fd, SPI_IOC_WR_BITS_PER_WORD, &bits)) {
-		err(1,"SPI: cannot set SPI_IOC_WR_BITS_PER_WORD = %d", bits);
+	// mode changes take effect at once so send what is queued first
+	SPI_flush(spi);
+	wait_sent(spi);
+
+	// WR
+	if (!spi->mode_valid || mode != spi->mode) {
+		if (-1 == ioctl(spi->fd, SPI_IOC_WR_MODE, &mode)) {
+			err(1,"SPI: cannot set SPI_IOC_WR_MODE  =%d", mode);
+		}
+		spi->mode = mode;
+		spi->mode_valid = true;
 	}
 
-	if (-1 == ioctl(spi->fd, SPI_IOC_WR_LSB_FIRST, &lsb_first)) {
-		err(1,"SPI: cannot set SPI_IOC_WR_LSB_FIRST = %d", lsb_first);
+	if (!spi->configured) {
+		if (-1 == ioctl(spi->fd, SPI_IOC_WR_BITS_PER_WORD, &bits)) {
+			err(1,"SPI: cannot set SPI_IOC_WR_BITS_PER_WORD = %d", bits);
+		}
+
+		if (-1 == ioctl(spi->fd, SPI_IOC_WR_LSB_FIRST, &lsb_first)) {
+			err(1,"SPI: cannot set SPI_IOC_WR_LSB_FIRST = %d", lsb_first);
+		}
+		spi->configured = true;
 	}
 
-	if (-1 == ioctl(spi->fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed_hz)) {
-		err(1,"SPI: cannot set SPI_IOC_WR_MAX_SPEED_HZ = %d", speed_hz);
+	if (speed_hz != spi->speed_hz) {
+		if (-1 == ioctl(spi->fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed_hz)) {
+			err(1,"SPI: cannot set SPI_IOC_WR_MAX_SPEED_HZ = %d", speed_hz);
+		}
+		spi->speed_hz = speed_hz;
 	}
 }
@@ -50,4 +50,32 @@ void SPI_send(SPI_type *spi, const void *buffer, size_t length);
 // will only change CS if the SPI_CS bits are set
 void SPI_read(SPI_type *spi, const void *buffer, void *received, size_t length);
 
+// hold the SPI_on mode until SPI_session_end so the SPI_on and
+// SPI_off around each line do not switch mode (COG1 uses mode 2 for
+// data and mode 0 when off).  The zero bytes they send are unchanged
+void SPI_session_begin(SPI_type *spi);
+
+// return to mode 0, sending a zero byte if the mode changed
+void SPI_session_end(SPI_type *spi);
+
+// collect the following SPI_on, SPI_off and SPI_send calls and send
+// them as a few SPI_IOC_MESSAGE ioctls instead of one each.  The data
+// is copied, CS is still released between transfers and a message is
+// sent whenever spidev's bufsiz would be exceeded, before a mode
+// change and before SPI_read.  Messages are sent by a separate thread
+// so the caller can encode the next lines while one is on the bus
+void SPI_batch_begin(SPI_type *spi);
+
+// send anything collected, wait until everything has been sent and
+// return to sending each call at once
+void SPI_batch_end(SPI_type *spi);
+
+// send anything collected now, staying in batch mode; returns before
+// the message has been sent
+void SPI_flush(SPI_type *spi);
+
+// change the clock for the following transfers, anything already
+// collected is sent at the old one first
+void SPI_set_speed(SPI_type *spi, uint32_t bps);
+
 #endif
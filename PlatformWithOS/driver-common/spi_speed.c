@@ -0,0 +1,244 @@
+// Copyright 2013-2015 Pervasive Displays, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at:
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+// express or implied.  See the License for the specific language
+// governing permissions and limitations under the License.
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <err.h>
+
+#include "spi_speed.h"
+
+
+// where the board serial number can be found, in order
+static const char *board_files[] = {
+	"/proc/device-tree/serial-number",
+	"/etc/machine-id"
+};
+
+#define SPI_SPEED_DIRECTORY "/var/lib/epd-fuse"
+
+// the file is rewritten through one temporary file, so the panels'
+// update threads must take turns
+static pthread_mutex_t save_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#if EPD_PROBE_AVAILABLE
+// clocks tried by the calibration, slowest first
+static const uint32_t steps[] = {
+	SPI_SPEED_MINIMUM,
+	2000000,
+	4000000,
+	6000000,
+	8000000,
+	10000000,
+	12000000,
+	16000000,
+	20000000,
+	24000000,
+	SPI_SPEED_MAXIMUM
+};
+#endif
+
+#define SIZE_OF_ARRAY(a) (sizeof(a) / sizeof((a)[0]))
+
+
+// local function prototypes
+static bool board_id(char *buffer, size_t size);
+static bool save(const char *spi_device, uint32_t bps);
+
+
+bool SPI_SPEED_parse(const char *text, size_t length, uint32_t *bps, bool *calibrate) {
+	while (length > 0 && isspace((unsigned char)text[length - 1])) {
+		--length;
+	}
+	if (4 == length && 0 == memcmp(text, "auto", length)) {
+		*bps = 0;
+		*calibrate = true;
+		return true;
+	}
+
+	char buffer[16];
+	if (0 == length || length >= sizeof(buffer)) {
+		return false;
+	}
+	memcpy(buffer, text, length);
+	buffer[length] = '\0';
+
+	char *end = NULL;
+	unsigned long n = strtoul(buffer, &end, 0);
+	if (end != buffer + length || n < SPI_SPEED_MINIMUM || n > SPI_SPEED_MAXIMUM) {
+		return false;
+	}
+	*bps = (uint32_t)n;
+	*calibrate = false;
+	return true;
+}
+
+
+#if EPD_PROBE_AVAILABLE
+uint32_t SPI_SPEED_calibrate(EPD_type *epd, SPI_type *spi, uint32_t fallback) {
+	size_t passed = 0;  // steps at which every probe was correct
+
+	EPD_probe_begin(epd);
+	for (size_t i = 0; i < SIZE_OF_ARRAY(steps); ++i) {
+		SPI_set_speed(spi, steps[i]);
+
+		bool ok = true;
+		for (int probe = 0; ok && probe < SPI_SPEED_PROBES; ++probe) {
+			ok = EPD_probe(epd);
+		}
+		if (!ok) {
+			break;  // any faster will not be better
+		}
+		passed = i + 1;
+	}
+
+	// the fastest that passed may only just work, so keep one step
+	// below it as a margin for temperature and noise
+	uint32_t best = 0;
+	if (passed > 1) {
+		best = steps[passed - 2];
+	} else if (1 == passed) {
+		best = steps[0];
+	}
+
+	// power off at the clock that will be used
+	SPI_set_speed(spi, 0 == best ? fallback : best);
+	EPD_probe_end(epd);
+
+	return best;
+}
+#endif
+
+
+uint32_t SPI_SPEED_load(const char *spi_device) {
+	char board[128];
+	if (!board_id(board, sizeof(board))) {
+		return 0;
+	}
+
+	FILE *f = fopen(SPI_SPEED_FILE, "r");
+	if (NULL == f) {
+		return 0;  // never calibrated
+	}
+
+	uint32_t bps = 0;
+	char line[512];
+	while (NULL != fgets(line, sizeof(line), f)) {
+		char b[128];
+		char d[256];
+		unsigned long n = 0;
+		if (3 == sscanf(line, "%127s %255s %lu", b, d, &n) &&
+		    0 == strcmp(b, board) && 0 == strcmp(d, spi_device) &&
+		    n >= SPI_SPEED_MINIMUM && n <= SPI_SPEED_MAXIMUM) {
+			bps = (uint32_t)n;
+		}
+	}
+	fclose(f);
+
+	return bps;
+}
+
+
+bool SPI_SPEED_save(const char *spi_device, uint32_t bps) {
+	pthread_mutex_lock(&save_lock);
+	bool ok = save(spi_device, bps);
+	pthread_mutex_unlock(&save_lock);
+	return ok;
+}
+
+
+// private functions
+// =================
+
+// replace the line for this board and device, keeping the others
+static bool save(const char *spi_device, uint32_t bps) {
+	char board[128];
+	if (!board_id(board, sizeof(board))) {
+		warnx("cannot identify the board");
+		return false;
+	}
+
+	if (0 != mkdir(SPI_SPEED_DIRECTORY, 0755) && EEXIST != errno) {
+		warn("cannot create: %s", SPI_SPEED_DIRECTORY);
+		return false;
+	}
+
+	FILE *out = fopen(SPI_SPEED_FILE ".tmp", "w");
+	if (NULL == out) {
+		warn("cannot create: %s", SPI_SPEED_FILE ".tmp");
+		return false;
+	}
+
+	FILE *in = fopen(SPI_SPEED_FILE, "r");
+	if (NULL != in) {
+		char line[512];
+		while (NULL != fgets(line, sizeof(line), in)) {
+			char b[128];
+			char d[256];
+			if (2 == sscanf(line, "%127s %255s", b, d) &&
+			    0 == strcmp(b, board) && 0 == strcmp(d, spi_device)) {
+				continue;
+			}
+			fputs(line, out);
+		}
+		fclose(in);
+	}
+	fprintf(out, "%s %s %u\n", board, spi_device, bps);
+
+	if (0 != fclose(out) || 0 != rename(SPI_SPEED_FILE ".tmp", SPI_SPEED_FILE)) {
+		warn("cannot write: %s", SPI_SPEED_FILE);
+		unlink(SPI_SPEED_FILE ".tmp");
+		return false;
+	}
+	return true;
+}
+
+
+// the first word of the first board file that has one
+static bool board_id(char *buffer, size_t size) {
+	for (size_t i = 0; i < SIZE_OF_ARRAY(board_files); ++i) {
+		FILE *f = fopen(board_files[i], "r");
+		if (NULL == f) {
+			continue;
+		}
+		// the device tree string ends in a nul instead of a newline
+		size_t n = fread(buffer, 1, size - 1, f);
+		fclose(f);
+		buffer[n] = '\0';
+
+		size_t start = 0;
+		while (start < n && isspace((unsigned char)buffer[start])) {
+			++start;
+		}
+		size_t length = 0;
+		while (start + length < n && '\0' != buffer[start + length] &&
+		       !isspace((unsigned char)buffer[start + length])) {
+			++length;
+		}
+		if (length > 0) {
+			memmove(buffer, buffer + start, length);
+			buffer[length] = '\0';
+			return true;
+		}
+	}
+	return false;
+}
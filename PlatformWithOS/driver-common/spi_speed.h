@@ -0,0 +1,68 @@
+// Copyright 2013-2015 Pervasive Displays, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at:
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+// express or implied.  See the License for the specific language
+// governing permissions and limitations under the License.
+
+// SPI clock selection
+//
+// How fast the SPI clock can run depends on the wiring between the
+// board and the panel as much as on either of them, so it is found by
+// reading the COG back at faster and faster clocks.  The result is
+// saved in SPI_SPEED_FILE for this board and SPI device, one line of
+// "board device bps" each, where the board is its serial number.
+
+
+#if !defined(SPI_SPEED_H)
+#define SPI_SPEED_H 1
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "spi.h"
+#include "epd.h"
+
+
+#define SPI_SPEED_FILE "/var/lib/epd-fuse/spi-speed"
+
+// clocks that can be set (bps)
+#define SPI_SPEED_MINIMUM 1000000
+#define SPI_SPEED_MAXIMUM 32000000
+
+// reads of the COG at each clock that all must be correct
+#define SPI_SPEED_PROBES 32
+
+
+// functions
+// =========
+
+// look up "auto" (calibrate = true) or a clock in bps, ignoring
+// trailing white space
+bool SPI_SPEED_parse(const char *text, size_t length, uint32_t *bps, bool *calibrate);
+
+#if EPD_PROBE_AVAILABLE
+// step the clock up from SPI_SPEED_MINIMUM until a probe of the panel
+// reads back wrongly and return the step below the fastest at which
+// every probe was correct (SPI_SPEED_MINIMUM if only that one was),
+// leaving the SPI set to it.  If not even the slowest worked (no
+// panel?) the SPI is set to fallback and 0 is returned
+uint32_t SPI_SPEED_calibrate(EPD_type *epd, SPI_type *spi, uint32_t fallback);
+#endif
+
+// the clock saved for this board and SPI device (0 => none)
+uint32_t SPI_SPEED_load(const char *spi_device);
+
+// save the clock for this board and SPI device; calls from several
+// threads are serialised
+bool SPI_SPEED_save(const char *spi_device, uint32_t bps);
+
+#endif
@@ -0,0 +1,140 @@
+// Copyright 2013-2015 Pervasive Displays, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at:
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+// express or implied.  See the License for the specific language
+// governing permissions and limitations under the License.
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <err.h>
+
+#include "stage_timer.h"
+
+
+static const char *names[] = {
+	[STAGE_FINISH_NEAREST] = "nearest",
+	[STAGE_FINISH_PARTIAL] = "partial",
+	[STAGE_FINISH_IDLE] = "idle",
+};
+
+
+static uint64_t now_ns(void);
+static void sleep_until(uint64_t deadline);
+
+
+// functions
+// =========
+
+void STAGE_init(STAGE_type *timer, STAGE_finish finish) {
+	timer->finish = finish;
+	timer->line_ns = 0;
+}
+
+
+void STAGE_run(STAGE_type *timer, STAGE_statistics *statistics, long stage_ms, int lines,
+	       STAGE_send_function *send, void *context) {
+	if (lines <= 0) {
+		return;
+	}
+	if (stage_ms < 0) {
+		stage_ms = 0;
+	}
+
+	uint64_t t = now_ns();
+	const uint64_t deadline = t + (uint64_t)stage_ms * 1000000;
+	unsigned long frames = 0;
+
+	for (;;) {
+		send(context, lines);
+		++frames;
+
+		// a quarter weight for the newest frame smooths out the
+		// odd preempted frame without lagging a speed change long
+		uint64_t end = now_ns();
+		uint64_t line_ns = (end - t) / lines;
+		timer->line_ns = (0 == timer->line_ns) ? line_ns : (3 * timer->line_ns + line_ns) / 4;
+		t = end;
+
+		if (t >= deadline) {
+			break;
+		}
+		uint64_t remaining = deadline - t;
+		uint64_t frame_ns = timer->line_ns * lines;
+		if (STAGE_FINISH_NEAREST == timer->finish ? 2 * remaining < frame_ns : remaining < frame_ns) {
+			break;
+		}
+	}
+
+	if (t < deadline) {
+		if (STAGE_FINISH_PARTIAL == timer->finish && timer->line_ns > 0) {
+			uint64_t fit = (deadline - t) / timer->line_ns;
+			int partial = fit < (uint64_t)lines ? (int)fit : lines - 1;
+			if (partial > 0) {
+				send(context, partial);
+				statistics->partial_lines += partial;
+				t = now_ns();
+			}
+		} else if (STAGE_FINISH_IDLE == timer->finish) {
+			sleep_until(deadline);
+			t = deadline;  // waking late is not time spent sending
+		}
+	}
+
+	++statistics->runs;
+	statistics->frames += frames;
+	statistics->last_frames = frames;
+	if (t > deadline) {
+		++statistics->overruns;
+		statistics->overrun_us += (t - deadline) / 1000;
+	}
+}
+
+
+const char *STAGE_finish_name(STAGE_finish finish) {
+	return names[finish];
+}
+
+
+bool STAGE_finish_parse(const char *text, STAGE_finish *finish) {
+	for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+		if (0 == strcmp(names[i], text)) {
+			*finish = (STAGE_finish)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+
+// internal functions
+// ==================
+
+// monotonic time in nanoseconds, unaffected by setting the clock
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	if (-1 == clock_gettime(CLOCK_MONOTONIC, &ts)) {
+		err(1, "clock_gettime failed");
+	}
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+
+static void sleep_until(uint64_t deadline) {
+	struct timespec ts;
+	ts.tv_sec = deadline / 1000000000u;
+	ts.tv_nsec = deadline % 1000000000u;
+	while (EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)) {
+	}
+}
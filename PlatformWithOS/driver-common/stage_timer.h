@@ -0,0 +1,73 @@
+// Copyright 2013-2015 Pervasive Displays, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at:
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+// express or implied.  See the License for the specific language
+// governing permissions and limitations under the License.
+
+
+#if !defined(STAGE_TIMER_H)
+#define STAGE_TIMER_H 1
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+
+// what to do with the time left when another whole frame would not
+// end before the stage time
+typedef enum {
+	STAGE_FINISH_NEAREST,  // one more whole frame if at least half of it fits
+	STAGE_FINISH_PARTIAL,  // send as many lines of one more frame as fit
+	STAGE_FINISH_IDLE      // wait for the end of the stage time
+} STAGE_finish;
+
+// counters for one kind of stage, kept since the panel was created
+typedef struct {
+	unsigned long runs;           // times the stage was run
+	unsigned long frames;         // whole frames sent
+	unsigned long last_frames;    // whole frames sent by the latest run
+	unsigned long partial_lines;  // lines sent as partial frames
+	unsigned long overruns;       // runs that ended after the stage time
+	unsigned long overrun_us;     // total time after the stage time
+} STAGE_statistics;
+
+// timing state for one panel; the time to send a line is measured
+// on every frame and carried over from stage to stage
+typedef struct {
+	STAGE_finish finish;
+	uint64_t line_ns;             // average nanoseconds per line (0 => not known yet)
+} STAGE_type;
+
+// send the first 'lines' lines of the encoded frame
+typedef void STAGE_send_function(void *context, int lines);
+
+
+// functions
+// =========
+
+// set up a timer with no measurements
+void STAGE_init(STAGE_type *timer, STAGE_finish finish);
+
+// repeat a frame of 'lines' lines for stage_ms milliseconds of
+// CLOCK_MONOTONIC.  At least one whole frame is always sent, then
+// whole frames as long as they are predicted to end before the stage
+// time; the remainder is handled as set by STAGE_init
+void STAGE_run(STAGE_type *timer, STAGE_statistics *statistics, long stage_ms, int lines,
+	       STAGE_send_function *send, void *context);
+
+// name of a finish as used by the --finish option
+const char *STAGE_finish_name(STAGE_finish finish);
+
+// look up a finish by name
+bool STAGE_finish_parse(const char *text, STAGE_finish *finish);
+
+
+#endif